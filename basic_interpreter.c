@@ -1,125 +1,782 @@
+#define _GNU_SOURCE             /* for mremap */
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <ctype.h>
 #include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <limits.h>
 
-#define MAX_LINES 1000
-#define MAX_LINE_LENGTH 256
-#define MAX_VARS 26
-#define MAX_ARRAYS 26
-#define MAX_ARRAY_SIZE 1000
-#define MAX_FOR_STACK 10
+#define MAX_LINE_LENGTH 256     /* INPUT words and file names */
+#define MAX_NAMES 1024          /* slots for each kind of name, A-Z included */
+#define MAX_VARS MAX_NAMES
+#define MAX_ARRAYS MAX_NAMES
+#define MAX_MAPS MAX_NAMES
+#define MAX_DIMS 3
+#define ARRAY_MAP_BYTES (1 << 20)   /* larger arrays are mapped directly */
+#define MAX_EVAL_STACK 256      /* operand stack depth a line may use */
+#define MAX_NESTING 256         /* parentheses and function calls an expression may nest */
+#define MAX_TEMPS 64            /* hidden variables introduced by the optimizer */
+#define CSE_TEMPS 8             /* of which are reused within each line */
+#define SORT_INSERTION_LIMIT 64 /* SORT uses insertion sort up to this many elements */
+#define OUTPUT_BUFFER_SIZE 65536
+#define MAX_FILES 16            /* files open at once for PRINT #, numbered from 1 */
+#define INPUT_BUFFER_SIZE 65536
+
+/*
+ * Bytecode opcodes. The list is expanded both into the Opcode enum and,
+ * for threaded dispatch, into the table of handler labels.
+ */
+#define OPCODE_LIST(X) \
+    X(OP_PUSH_INT)          /* a: value */ \
+    X(OP_LOAD_VAR)          /* a: variable slot */ \
+    X(OP_LOAD_ARRAY)        /* a: array slot; pops index */ \
+    X(OP_ADD) \
+    X(OP_SUB) \
+    X(OP_MUL) \
+    X(OP_DIV) \
+    X(OP_POP_INT) \
+    X(OP_INSTR)             /* pops needle and haystack strings, and the start if a is set */ \
+    X(OP_PUSH_STR)          /* a: string pool offset, b: length */ \
+    X(OP_LOAD_STR)          /* a: string variable slot */ \
+    X(OP_LEFT) \
+    X(OP_RIGHT) \
+    X(OP_MID) \
+    X(OP_POP_STR) \
+    X(OP_CONCAT)            /* a: 1 if the result is only read, not stored */ \
+    X(OP_CMP)               /* a: comparison kind */ \
+    X(OP_STR_CMP)           /* a: comparison kind */ \
+    X(OP_JUMP_IF_FALSE) \
+    X(OP_PRINT_INT)         /* a: output channel */ \
+    X(OP_PRINT_STR)         /* a: output channel */ \
+    X(OP_PRINT_SPACE)       /* a: output channel */ \
+    X(OP_PRINT_NEWLINE)     /* a: output channel */ \
+    X(OP_STORE_VAR)         /* a: variable slot */ \
+    X(OP_STORE_STR)         /* a: string variable slot */ \
+    X(OP_STORE_STR_EMPTY)   /* a: string variable slot */ \
+    X(OP_CHECK_INDEX)       /* a: array slot; leaves the line on failure */ \
+    X(OP_STORE_ARRAY)       /* a: array slot; pops value and index */ \
+    X(OP_LOAD_ARRAY_N)      /* a: array slot, b: number of indices popped */ \
+    X(OP_CHECK_INDEX_N)     /* a: array slot, b: indices replaced by their offset; leaves the line on failure */ \
+    X(OP_GOTO) \
+    X(OP_GOTO_LINE)         /* a: line number, b: program index resolved at link time */ \
+    X(OP_DIM)               /* a: array slot, b: number of sizes popped */ \
+    X(OP_REDIM)             /* a: array slot, b: number of sizes popped */ \
+    X(OP_DIM_FILE)          /* a: array slot, b: number of sizes popped; pops a file name */ \
+    X(OP_FLUSH)             /* a: array slot, or -1 for every FILE array */ \
+    X(OP_MAT)               /* a: target array, b: MAT_ operation, c and d: operand arrays */ \
+    X(OP_REDUCE)            /* a: array, b: REDUCE_ kind, c: second array of DOT, d: range values popped */ \
+    X(OP_SCAN)              /* a: source array, b: target array, d: range values popped */ \
+    X(OP_SORT)              /* a: array, b: companion array or -1, c: 1 if descending, d: 1 if a count is popped */ \
+    X(OP_DIM_MAP)           /* a: map slot */ \
+    X(OP_LOAD_MAP)          /* a: map slot, b: 1 if the key is a string; pops the key */ \
+    X(OP_STORE_MAP)         /* a: map slot, b: 1 if the key is a string; pops value and key */ \
+    X(OP_HAS_MAP)           /* a: map slot, b: 1 if the key is a string; pops the key */ \
+    X(OP_DEL_MAP)           /* a: map slot, b: 1 if the key is a string; pops the key */ \
+    X(OP_OPEN)              /* a: file number, b: 1 to append; pops the file name */ \
+    X(OP_CLOSE)             /* a: file number, or 0 for every file */ \
+    X(OP_CHECK_FILE)        /* a: file number; leaves the line if it is not open */ \
+    X(OP_INPUT_PROMPT)      /* a: string pool offset, b: length */ \
+    X(OP_INPUT_INT)         /* a: variable slot; leaves the line on failure */ \
+    X(OP_INPUT_ARRAY)       /* a: array slot; leaves the line on failure */ \
+    X(OP_INPUT_STR)         /* a: string variable slot */ \
+    X(OP_INPUT_FLUSH) \
+    X(OP_DATA)              /* a: number or string pool offset, b: -1 for a number, else the length */ \
+    X(OP_READ_INT)          /* a: variable slot; leaves the line on failure */ \
+    X(OP_READ_ARRAY)        /* a: array slot; pops index; leaves the line on failure */ \
+    X(OP_READ_STR)          /* a: string variable slot; leaves the line on failure */ \
+    X(OP_RESTORE)           /* a: line number, or -1 for the first DATA */ \
+    X(OP_RECORD)            /* a: string variable or -1, b: field array or -1, c: line at end of input or -1 */ \
+    X(OP_FOR)               /* a: variable slot, b: matching NEXT line, c: FOR line */ \
+    X(OP_NEXT)              /* a: variable slot */ \
+    X(OP_END) \
+    X(OP_ERROR)             /* a: string pool offset of message */ \
+    X(OP_HALT) \
+    X(OP_TEE_VAR)           /* a: variable slot; stores the top of stack without popping */ \
+    /* Superinstructions formed by fuse_superinstructions() */ \
+    X(OP_INC_VAR)           /* variables[a] = variables[b] + c */ \
+    X(OP_ADD_CONST)         /* a: value added to the top of stack */ \
+    X(OP_LOAD_ARRAY_VAR)    /* a: array slot, b: index variable */ \
+    X(OP_CHECK_INDEX_VAR)   /* a: array slot, b: index variable */ \
+    X(OP_STORE_ARRAY_VAR)   /* a: array slot, b: index variable; pops value */ \
+    X(OP_IF_GOTO_VV)        /* IF var a <c> var b THEN GOTO line d */ \
+    X(OP_IF_GOTO_VC)        /* IF var a <c> constant b THEN GOTO line d */ \
+    /* Unchecked forms switched in by prove_loop_bounds() */ \
+    X(OP_LOAD_ARRAY_FAST)   /* OP_LOAD_ARRAY with the index proven in bounds */ \
+    X(OP_CHECK_INDEX_FAST)  /* OP_CHECK_INDEX proven to pass: does nothing */ \
+    X(OP_LOAD_ARRAY_VAR_FAST) \
+    X(OP_CHECK_INDEX_VAR_FAST) \
+    X(OP_JIT_ENTER)         /* a: JIT region whose loop head this replaces */
+
+#define OPCODE_ENUM(op) op,
+typedef enum {
+    OPCODE_LIST(OPCODE_ENUM)
+    OPCODE_COUNT
+} Opcode;
+#undef OPCODE_ENUM
+
+/*
+ * Dispatch: computed goto (direct threading) where the compiler supports
+ * it, a switch otherwise. Build with -DBASIC_SWITCH_DISPATCH to compare.
+ */
+#if defined(__GNUC__) && !defined(BASIC_SWITCH_DISPATCH)
+#define USE_THREADED_CODE 1
+#else
+#define USE_THREADED_CODE 0
+#endif
+
+/* The loop JIT emits x86-64 code; build with -DBASIC_NO_JIT to leave it out */
+#if defined(__x86_64__) && (defined(__unix__) || defined(__APPLE__)) && !defined(BASIC_NO_JIT)
+#define HAVE_JIT 1
+#include <sys/mman.h>
+#else
+#define HAVE_JIT 0
+#endif
+
+/* Large arrays are mapped pages rather than arena memory, as are FILE arrays */
+#if defined(__unix__) || defined(__APPLE__)
+#define HAVE_MMAP 1
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#else
+#define HAVE_MMAP 0
+#endif
+
+/* Standard input is read with read() and output is line-flushed on a terminal */
+#if defined(__unix__) || defined(__APPLE__)
+#define HAVE_POSIX_IO 1
+#include <unistd.h>
+#else
+#define HAVE_POSIX_IO 0
+#endif
+
+/* INSTR scans for candidate matches 16 bytes at a time with SSE2 */
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#define HAVE_SSE2 1
+#else
+#define HAVE_SSE2 0
+#endif
+
+/* MAT kernels also have an AVX2 version, used if the CPU has it */
+#if HAVE_SSE2 && defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define HAVE_AVX2 1
+#else
+#define HAVE_AVX2 0
+#endif
+
+/* Whole-array operations of OP_MAT */
+enum {
+    MAT_COPY,               /* C = A */
+    MAT_ZER,                /* C = ZER */
+    MAT_CON,                /* C = CON */
+    MAT_ADD,                /* C = A + B */
+    MAT_SUB,                /* C = A - B */
+    MAT_MUL,                /* C = A * B, element by element */
+    MAT_SCALE               /* C = A * k, k popped from the stack */
+};
+
+/* Array functions of OP_REDUCE */
+enum {
+    REDUCE_SUM,
+    REDUCE_MIN,
+    REDUCE_MAX,
+    REDUCE_COUNT,           /* elements equal to a value popped from the stack */
+    REDUCE_DOT              /* sum of products with a second array */
+};
+
+/* Comparison kinds for OP_CMP and OP_STR_CMP */
+enum {
+    CMP_NONE,
+    CMP_EQ,
+    CMP_LT,
+    CMP_GT,
+    CMP_LE,
+    CMP_GE,
+    CMP_NE
+};
+
+/* Jump target patched to the end of the line once it is compiled */
+#define TARGET_LINE_END -1
 
-/* Program storage */
 typedef struct {
-    int line_number;
-    char text[MAX_LINE_LENGTH];
+    int op;
+    int a;
+    int b;
+    int c;
+    int d;
+    int target;             /* jump target, relative to the line until linked */
+    const void *handler;    /* threaded-code label, set by thread_code() */
+} Instr;
+
+/*
+ * Program storage, grown as lines are added. The line numbers are kept
+ * sorted in an array of their own, so searches and insertions move only
+ * ints; the text of every line is packed, NUL-terminated, into
+ * program_text.
+ */
+typedef struct {
+    int text;                   /* offset of the line's text in program_text */
+    Instr *code;
+    int code_len;
 } ProgramLine;
 
-ProgramLine program[MAX_LINES];
+int *line_numbers = NULL;
+ProgramLine *program = NULL;
 int program_size = 0;
+int program_cap = 0;
+char *program_text = NULL;
+int program_text_len = 0;
+int program_text_cap = 0;
+int program_text_dead = 0;      /* bytes of replaced and deleted lines */
+
+/* Source text of program line i */
+static inline const char *line_text(int i) {
+    return program_text + program[i].text;
+}
+
+/* Line number index: open-addressing hash of program indices */
+int *line_hash = NULL;
+int line_hash_mask = 0;
+bool program_linked = false;
+
+/* Whole program code, concatenated and relocated by link_program() */
+Instr *linked_code = NULL;
+int *line_start = NULL;
+int linked_cap = 0;
+int line_start_cap = 0;
+
+/* Optimized code of each line, built by link_program() */
+Instr **opt_code = NULL;
+int *opt_len = NULL;
+int opt_cap = 0;
+
+/*
+ * Array accesses in FOR bodies whose bounds checks can be proven when the
+ * loop starts: the index is the loop variable (if uses_loop_var) plus
+ * offset plus a variable the body never assigns (offset_var, or -1).
+ */
+typedef struct {
+    int pc;                 /* relative to the line until linked */
+    int line;
+    int checked_op;
+    bool uses_loop_var;
+    long long offset;
+    int offset_var;
+} BoundsAccess;
+
+BoundsAccess *bounds_accesses = NULL;
+int bounds_access_count = 0;
+int bounds_access_cap = 0;
+int *loop_bounds_first = NULL;  /* per line: accesses proven by its FOR */
+int *loop_bounds_count = NULL;
+int loop_bounds_cap = 0;
+
+#if USE_THREADED_CODE
+const void *const *threaded_labels = NULL;
+#endif
+
+/* Loop JIT, enabled with --jit or JIT ON */
+bool jit_enabled = false;
+
+#if HAVE_JIT
+#define JIT_HOT_THRESHOLD 64
+#define JIT_EXIT_LABEL -1
+
+typedef int (*JitFunction)(void);
+
+/* A loop in linked_code: FOR body up to its NEXT, or a backward GOTO */
+typedef struct {
+    int start;              /* loop head, replaced by OP_JIT_ENTER */
+    int end;                /* first instruction after the loop */
+    int count;              /* times the loop head has been reached */
+    bool failed;            /* the loop head cannot be compiled */
+    Instr original;         /* instruction replaced by OP_JIT_ENTER */
+    JitFunction native;
+    size_t native_size;
+} JitRegion;
+
+JitRegion *jit_regions = NULL;
+int jit_region_count = 0;
+int jit_region_cap = 0;
+
+/* Loop head at which the interpreter resumes after a bail-out */
+const Instr *jit_resume_at = NULL;
 
-/* Variables A-Z */
-int variables[MAX_VARS];
+/* Code and jump fixups of the region being compiled */
+typedef struct {
+    int pos;                /* offset of a rel32 field */
+    int target;             /* instruction index, or JIT_EXIT_LABEL */
+} JitFixup;
+
+unsigned char *jit_buf = NULL;
+int jit_len = 0;
+int jit_cap = 0;
+JitFixup *jit_fixups = NULL;
+int jit_fixup_count = 0;
+int jit_fixup_cap = 0;
+int jit_depth = 0;          /* operand stack depth in the current segment */
+#endif
+
+/* String literals and messages referenced by compiled code */
+char *string_pool = NULL;
+int string_pool_len = 0;
+int string_pool_cap = 0;
+
+/* Variables, followed by the optimizer's temporaries */
+int variables[MAX_VARS + MAX_TEMPS];
+
+/* Constant folding, common subexpressions and loop-invariant hoisting */
+bool optimize_enabled = true;
+
+/*
+ * String values. Up to STR_SMALL bytes of text are held inline; longer
+ * text lives in a reference-counted StrBuf shared by every value holding
+ * it. A value with text but no buffer borrows it from the string pool,
+ * which does not move while code runs. Text is not NUL-terminated, so
+ * LEFT$, RIGHT$ and MID$ return views into their argument. All-zero is
+ * the empty string.
+ */
+#define STR_SMALL 16
+
+typedef struct StrBuf {
+    int refs;
+    int size_class;         /* free list it returns to, or -1 */
+    int capacity;
+    int used;               /* bytes of text claimed; the rest can be appended to */
+    struct StrBuf *next_free;
+    char text[];
+} StrBuf;
+
+typedef struct {
+    const char *text;       /* NULL: the text is in small[] */
+    int len;
+    StrBuf *buf;            /* buffer holding text, if any */
+    char small[STR_SMALL];
+} StrValue;
+
+/* String variables */
+StrValue string_variables[MAX_VARS];
+
+/*
+ * Memory for values. Temporaries made while a statement runs come from
+ * temp_arena, which is reset as soon as the statement holds no strings.
+ * String buffers and arrays come from value_arena, which NEW resets;
+ * string buffers freed before that are kept on free lists by size.
+ */
+#define ARENA_CHUNK 65536
+#define STR_CLASSES 12          /* buffers of 32 bytes up to ARENA_CHUNK */
+
+typedef struct ArenaChunk {
+    struct ArenaChunk *next;
+    size_t size;
+    size_t used;
+    char data[];
+} ArenaChunk;
+
+typedef struct {
+    ArenaChunk *chunks;         /* most recent first */
+    long allocations;
+    long chunk_allocations;
+    size_t bytes;
+} Arena;
+
+Arena temp_arena;
+Arena value_arena;
+
+/*
+ * Boyer-Moore-Horspool skip tables of recently searched INSTR needles.
+ * Entries are matched by content, so a literal or a variable searched
+ * for again and again reuses its table.
+ */
+#define SKIP_CACHE_SIZE 16
+#define SKIP_CACHE_NEEDLE 64    /* longest needle whose table is cached */
 
-/* String variables A-Z */
-char *string_variables[MAX_VARS];
+typedef struct {
+    int len;
+    char needle[SKIP_CACHE_NEEDLE];
+    int skip[256];
+} SkipTable;
+
+SkipTable skip_cache[SKIP_CACHE_SIZE];
+StrBuf *free_strings[STR_CLASSES];
+long strings_reused = 0;
 
-/* Arrays A-Z */
+/*
+ * Arrays. Elements are stored row-major in one buffer, so element
+ * (i, j, k) is at i * stride[0] + j * stride[1] + k. Elements from size
+ * up to capacity are zero, so REDIM within the capacity only has to move
+ * size. Small arrays live in value_arena; large ones are mapped and owned
+ * by the array. A FILE array maps its file shared, so its capacity is
+ * always its size; fd is -1 if the file could only be opened for reading.
+ */
 typedef struct {
     int *data;
-    int size;
+    long long size;
+    int dims;
+    long long extent[MAX_DIMS];
+    long long stride[MAX_DIMS];
+    long long capacity;
+    bool mapped;
+    bool file;
+    int fd;
     bool allocated;
 } Array;
 
 Array arrays[MAX_ARRAYS];
 
-/* FOR loop stack */
+/*
+ * Maps (DIM MAP), keyed by integers or strings: open-addressing hash
+ * tables with linear probing. Entries are 16 bytes, four to a cache line;
+ * each keeps its key's hash, so probes compare strings only on a hash
+ * match and growing the table never rehashes them. String keys are kept
+ * in the map's key pool.
+ */
+#define MAP_EMPTY (-1)          /* MapEntry.len of a free slot */
+#define MAP_INT_KEY (-2)        /* MapEntry.len of an entry with an integer key */
+#define MAP_PENDING (INT_MIN + 2) /* added to len while growing, until the entry is placed */
+
+typedef struct {
+    unsigned int hash;
+    int len;                /* MAP_EMPTY, MAP_INT_KEY or the length of a string key */
+    int key;                /* integer key, or offset of a string key in keys */
+    int value;
+} MapEntry;
+
+typedef struct {
+    MapEntry *entries;
+    unsigned int mask;      /* capacity - 1; the capacity is a power of 2 */
+    unsigned int count;
+    char *keys;
+    size_t keys_len;
+    size_t keys_cap;
+    size_t keys_dead;       /* bytes of keys whose entries have been deleted */
+    bool declared;
+} Map;
+
+Map maps[MAX_MAPS];
+
+/* A key being looked up: len is MAP_INT_KEY for integer keys */
+typedef struct {
+    unsigned int hash;
+    int len;
+    int key;
+    const char *text;
+} MapKey;
+
+/*
+ * Names of variables, string variables, arrays and maps, one table for
+ * each kind. A-Z are always slots 0-25; a longer name gets the next slot
+ * when the first line using it is compiled, so running code indexes
+ * variables[], arrays[] and the rest directly. Only the compiler looks
+ * names up in the hash index. The last slot stands in for names that do
+ * not fit.
+ */
+#define NAME_INDEX_SIZE (2 * MAX_NAMES)
+
+typedef struct {
+    char *names[MAX_NAMES];     /* upper case */
+    int count;
+    int index[NAME_INDEX_SIZE]; /* slot + 1 of a longer name, or 0 */
+} NameTable;
+
+NameTable var_names;
+NameTable str_names;
+NameTable array_names;
+NameTable map_names;
+
+/*
+ * PRINT output. Each channel gathers text in its buffer and hands it to
+ * stdio in one fwrite when the buffer is full, before INPUT reads, when
+ * the program stops, and after every line while stdout is a terminal.
+ * Channel 0 is stdout; channels 1 to MAX_FILES are files opened with
+ * OPEN for PRINT #.
+ */
+typedef struct {
+    FILE *fp;                   /* NULL while the channel is closed */
+    char *data;
+    int len;
+    bool line_flush;
+} OutputChannel;
+
+OutputChannel channels[MAX_FILES + 1];
+char stdout_buffer[OUTPUT_BUFFER_SIZE];
+
+/*
+ * Standard input. The command prompt and INPUT share one buffer that is
+ * filled a block at a time, and numbers are parsed straight out of it.
+ * RECORD grows the buffer to hold a line longer than it.
+ */
+typedef struct {
+    char *data;
+    int capacity;
+    int pos;
+    int len;
+    bool eof;
+} InputBuffer;
+
+char input_block[INPUT_BUFFER_SIZE];
+InputBuffer input_buffer = { input_block, INPUT_BUFFER_SIZE, 0, 0, false };
+
+/* DATA constants in program order, gathered by link_program() for READ */
+typedef struct {
+    int line_number;
+    int value;                  /* the number, or a string pool offset */
+    int len;                    /* -1 for a number, else the string length */
+} DataItem;
+
+DataItem *data_items = NULL;
+int data_count = 0;
+int data_cap = 0;
+int data_next = 0;              /* the item the next READ takes */
+
+/* FOR loop stack; each frame caches the loop limit and step */
 typedef struct {
-    char var_name;
+    int var_slot;
     int end_value;
     int step_value;
     int line_index;
+    int body_pc;
 } ForStackEntry;
 
-ForStackEntry for_stack[MAX_FOR_STACK];
+ForStackEntry *for_stack = NULL;
 int for_stack_ptr = 0;
+int for_stack_cap = 0;
+
+/* OP_FOR operand for a FOR whose NEXT has not been matched by link_program() */
+#define NEXT_UNRESOLVED -2
 
 /* Parser state */
 char *current_pos;
-int current_line_index;
+int nesting_depth = 0;
+bool too_complex = false;
+
+/* Compiler output */
+Instr *code_buf = NULL;
+int code_len = 0;
+int code_cap = 0;
 
 /* Function prototypes */
 void init_interpreter(void);
 void cleanup_interpreter(void);
 void run_program(void);
 void list_program(void);
+void dump_program(void);
+void set_optimize(bool enabled);
 void clear_program(void);
-int parse_expression(void);
-int parse_term(void);
-int parse_factor(void);
+void compile_expression(void);
+void compile_term(void);
+void compile_factor(void);
+bool compile_string_operand(void);
+bool compile_string_expression(bool stored);
 void skip_whitespace(void);
-void execute_line(int line_index);
-void execute_print(void);
-void execute_let(void);
-void execute_goto(void);
-void execute_if(void);
-void execute_dim(void);
-void execute_input(void);
-void execute_for(void);
-void execute_next(void);
-void skip_to_next(char var_name);
+void compile_statement(void);
+void compile_print(void);
+void compile_let(void);
+void compile_goto(void);
+void compile_if(void);
+int compile_subscripts(char closing);
+void compile_dim(int op);
+void compile_flush(void);
+void compile_mat(void);
+void compile_scan(void);
+void compile_sort(void);
+void compile_del(void);
+void compile_open(void);
+void compile_close(void);
+void compile_input(void);
+void compile_data(void);
+void compile_read(void);
+void compile_restore(void);
+void compile_record(void);
+void compile_for(void);
+void compile_next(void);
+int compile_to_buffer(const char *text);
+int compile_line(const char *text, Instr **code);
+int fuse_superinstructions(Instr *code, int len);
+int emit(int op, int a, int b);
+int pool_add(const char *s, int len);
+void thread_code(Instr *code, int len);
+void execute_code(Instr *code);
+void execute_direct(const char *text);
+void release_string(StrValue *s);
+void *arena_alloc(Arena *arena, size_t size);
+void arena_reset(Arena *arena, bool keep_chunk);
+void print_memory_stats(void);
+bool execute_for(int var_slot, int start_val, int end_val, int step_val, int line_index, int body_pc);
+void prove_loop_bounds(int line_index, int start_val, int end_val, int step_val, bool runs);
+int execute_next(int var_slot);
+void execute_dim(int arr_idx, const int *extent, int dims);
+void execute_redim(int arr_idx, const int *extent, int dims);
+void execute_dim_file(int arr_idx, const int *extent, int dims, const char *path);
+void execute_flush(int arr_idx);
+void execute_mat(int target, int op, int left, int right, int k);
+int execute_reduce(int kind, int arr_idx, int other, int value, const int *range, int count);
+void execute_scan(int source, int target, const int *range, int count);
+void execute_sort(int arr_idx, int with, bool descending, const int *count);
+void release_arrays(void);
+void execute_map_dim(int map_idx);
+MapKey int_map_key(int key);
+MapKey string_map_key(const char *text, int len);
+int *map_value(int map_idx, const MapKey *k, bool create);
+void map_delete(int map_idx, const MapKey *k);
+void release_maps(void);
+void reset_names(void);
+void flush_output(OutputChannel *out);
+void close_files(void);
+void execute_open(int file, bool append, const char *path, int len);
+void execute_close(int file);
+bool read_input_line(char **line, int *cap);
+bool execute_input_value(int *target);
+const DataItem *execute_read(bool string);
+void execute_restore(int line_number);
+int find_matching_next(int for_index, int var_slot);
 int find_line(int line_number);
+void build_line_index(void);
+void link_program(void);
+void jit_find_regions(void);
+void jit_reset(void);
+void jit_compile_region(int region_id);
+void set_jit(bool enabled);
 void insert_line(int line_number, const char *text);
 void save_program(const char *filename);
-void load_program(const char *filename);
+bool load_program(const char *filename);
+void compile_program_to_c(const char *filename);
 char *read_string_literal(void);
-char *parse_string_operand(void);
-int get_array_index(char var_name);
 
 /* Initialize interpreter */
 void init_interpreter(void) {
     int i;
-    
+
     /* Initialize variables to 0 */
-    for (i = 0; i < MAX_VARS; i++) {
+    for (i = 0; i < MAX_VARS + MAX_TEMPS; i++) {
         variables[i] = 0;
     }
-    
+
     /* Initialize string variables */
-    for (i = 0; i < MAX_VARS; i++) {
-        string_variables[i] = NULL;
-    }
+    memset(string_variables, 0, sizeof(string_variables));
+
+    /* Initialize arrays and maps, then forget the names of all four */
+    release_arrays();
+    release_maps();
+    reset_names();
+
+    /* PRINT writes to stdout through its buffer */
+    close_files();
+    channels[0].fp = stdout;
+    channels[0].data = stdout_buffer;
+#if HAVE_POSIX_IO
+    channels[0].line_flush = isatty(fileno(stdout));
+#endif
 
-    /* Initialize arrays */
-    for (i = 0; i < MAX_ARRAYS; i++) {
-        arrays[i].data = NULL;
-        arrays[i].size = 0;
-        arrays[i].allocated = false;
-    }
-    
     /* Reset FOR stack */
     for_stack_ptr = 0;
 
     program_size = 0;
+    string_pool_len = 0;
 }
 
 /* Cleanup interpreter */
 void cleanup_interpreter(void) {
     int i;
-    for (i = 0; i < MAX_ARRAYS; i++) {
-        if (arrays[i].allocated && arrays[i].data != NULL) {
-            free(arrays[i].data);
-            arrays[i].data = NULL;
-            arrays[i].allocated = false;
-        }
-    }
+    release_arrays();
+    release_maps();
     for (i = 0; i < MAX_VARS; i++) {
-        if (string_variables[i]) {
-            free(string_variables[i]);
-            string_variables[i] = NULL;
+        release_string(&string_variables[i]);
+    }
+    reset_names();
+    close_files();
+    flush_output(&channels[0]);
+    for (i = 1; i <= MAX_FILES; i++) {
+        free(channels[i].data);
+        channels[i].data = NULL;
+    }
+    arena_reset(&temp_arena, false);
+    arena_reset(&value_arena, false);
+    for (i = 0; i < program_size; i++) {
+        free(program[i].code);
+        program[i].code = NULL;
+    }
+    free(line_numbers);
+    free(program);
+    free(program_text);
+    line_numbers = NULL;
+    program = NULL;
+    program_text = NULL;
+    program_size = program_cap = 0;
+    program_text_len = program_text_cap = program_text_dead = 0;
+    free(string_pool);
+    string_pool = NULL;
+    string_pool_len = string_pool_cap = 0;
+    free(code_buf);
+    code_buf = NULL;
+    code_len = code_cap = 0;
+    free(line_hash);
+    line_hash = NULL;
+    line_hash_mask = 0;
+    free(for_stack);
+    for_stack = NULL;
+    for_stack_ptr = for_stack_cap = 0;
+    free(data_items);
+    data_items = NULL;
+    data_count = data_cap = 0;
+    free(linked_code);
+    linked_code = NULL;
+    linked_cap = 0;
+    free(line_start);
+    line_start = NULL;
+    line_start_cap = 0;
+    free(opt_code);
+    opt_code = NULL;
+    free(opt_len);
+    opt_len = NULL;
+    opt_cap = 0;
+    free(bounds_accesses);
+    bounds_accesses = NULL;
+    bounds_access_count = bounds_access_cap = 0;
+    free(loop_bounds_first);
+    loop_bounds_first = NULL;
+    free(loop_bounds_count);
+    loop_bounds_count = NULL;
+    loop_bounds_cap = 0;
+    jit_reset();
+#if HAVE_JIT
+    free(jit_regions);
+    jit_regions = NULL;
+    jit_region_cap = 0;
+    free(jit_buf);
+    jit_buf = NULL;
+    jit_len = jit_cap = 0;
+    free(jit_fixups);
+    jit_fixups = NULL;
+    jit_fixup_count = jit_fixup_cap = 0;
+#endif
+}
+
+/* Reset each name table to A-Z, freeing the longer names */
+void reset_names(void) {
+    static char letters[26][2];
+    static char overflow[] = "?";
+    NameTable *tables[] = { &var_names, &str_names, &array_names, &map_names };
+    int i, t;
+
+    for (t = 0; t < 4; t++) {
+        NameTable *table = tables[t];
+        for (i = 26; i < table->count; i++) {
+            free(table->names[i]);
+            table->names[i] = NULL;
+        }
+        for (i = 0; i < 26; i++) {
+            letters[i][0] = 'A' + i;
+            table->names[i] = letters[i];
         }
+        table->names[MAX_NAMES - 1] = overflow;
+        table->count = 26;
+        memset(table->index, 0, sizeof(table->index));
     }
 }
 
@@ -130,962 +787,8331 @@ void skip_whitespace(void) {
     }
 }
 
-/* Parse factor: number, variable, array element, or parenthesized expression */
-int parse_factor(void) {
-    skip_whitespace();
-    
-    if (*current_pos == '(') {
-        current_pos++;
-        int result = parse_expression();
-        skip_whitespace();
-        if (*current_pos == ')') {
-            current_pos++;
-        }
-        return result;
+/* Compare two values according to a comparison kind */
+static inline bool compare_values(int cmp, int left, int right) {
+    switch (cmp) {
+        case CMP_EQ: return left == right;
+        case CMP_LT: return left < right;
+        case CMP_GT: return left > right;
+        case CMP_LE: return left <= right;
+        case CMP_GE: return left >= right;
+        case CMP_NE: return left != right;
     }
-    
-    if (isalpha(*current_pos)) {
-        if (strncasecmp(current_pos, "INSTR", 5) == 0) {
-            current_pos += 5;
-            skip_whitespace();
-            if (*current_pos == '(') {
-                current_pos++;
-                char *haystack = parse_string_operand();
-                skip_whitespace();
-                if (*current_pos == ',') {
-                    current_pos++;
-                    char *needle = parse_string_operand();
-                    skip_whitespace();
-                    if (*current_pos == ')') {
-                        current_pos++;
-                        int result = 0;
-                        if (haystack && needle) {
-                            char *found = strstr(haystack, needle);
-                            if (found) {
-                                result = (int)(found - haystack) + 1;
-                            }
-                        }
-                        if (haystack) free(haystack);
-                        if (needle) free(needle);
-                        return result;
-                    }
-                    if (needle) free(needle);
-                }
-                if (haystack) free(haystack);
-            }
-            return 0;
-        }
+    return false;
+}
 
-        char var_name = toupper(*current_pos);
-        current_pos++;
-        skip_whitespace();
-        
-        /* Check for array subscript */
-        if (*current_pos == '[' || *current_pos == '(') {
-            char closing = (*current_pos == '[') ? ']' : ')';
-            current_pos++;
-            int index = parse_expression();
-            skip_whitespace();
-            if (*current_pos == closing) {
-                current_pos++;
-            }
-            
-            int arr_idx = var_name - 'A';
-            if (!arrays[arr_idx].allocated) {
-                fprintf(stderr, "Error: Array %c not dimensioned\n", var_name);
-                return 0;
-            }
-            if (index < 0 || index >= arrays[arr_idx].size) {
-                fprintf(stderr, "Error: Array index %d out of bounds for %c\n", index, var_name);
-                return 0;
-            }
-            return arrays[arr_idx].data[index];
-        }
-        
-        return variables[var_name - 'A'];
+/*
+ * Fold the arithmetic operator about to be emitted when its right operand,
+ * or both operands, are constants. Division by zero is left for run time.
+ */
+static bool fold_constants(int op, int cmp) {
+    Instr *c = code_buf;
+    int n = code_len;
+    unsigned int x, y;
+
+    if (!optimize_enabled || n < 1 || c[n - 1].op != OP_PUSH_INT) {
+        return false;
     }
-    
-    if (isdigit(*current_pos) || (*current_pos == '-' && isdigit(*(current_pos + 1)))) {
-        int sign = 1;
-        if (*current_pos == '-') {
-            sign = -1;
-            current_pos++;
-        }
-        int result = 0;
-        while (isdigit(*current_pos)) {
-            result = result * 10 + (*current_pos - '0');
-            current_pos++;
-        }
-        return sign * result;
+    y = (unsigned int)c[n - 1].a;
+
+    /* x + 0, x - 0, x * 1 and x / 1 are x */
+    if (((op == OP_ADD || op == OP_SUB) && y == 0) || ((op == OP_MUL || op == OP_DIV) && y == 1)) {
+        code_len--;
+        return true;
     }
-    
-    return 0;
-}
+    if (n < 2 || c[n - 2].op != OP_PUSH_INT) {
+        return false;
+    }
+    x = (unsigned int)c[n - 2].a;
 
-/* Parse term: factor with *, / */
-int parse_term(void) {
-    int result = parse_factor();
-    
-    while (1) {
-        skip_whitespace();
-        if (*current_pos == '*') {
-            current_pos++;
-            result *= parse_factor();
-        } else if (*current_pos == '/') {
-            current_pos++;
-            int divisor = parse_factor();
-            if (divisor != 0) {
-                result /= divisor;
-            } else {
-                fprintf(stderr, "Error: Division by zero\n");
+    switch (op) {
+        case OP_ADD:
+            x += y;
+            break;
+        case OP_SUB:
+            x -= y;
+            break;
+        case OP_MUL:
+            x *= y;
+            break;
+        case OP_DIV:
+            if (y == 0 || ((int)x == INT_MIN && (int)y == -1)) {
+                return false;
             }
-        } else {
+            x = (unsigned int)((int)x / (int)y);
             break;
-        }
+        case OP_CMP:
+            x = compare_values(cmp, (int)x, (int)y);
+            break;
+        default:
+            return false;
     }
-    
-    return result;
+    c[n - 2].a = (int)x;
+    code_len--;
+    return true;
 }
 
-/* Parse expression: term with +, - */
-int parse_expression(void) {
-    int result = parse_term();
-    
-    while (1) {
-        skip_whitespace();
-        if (*current_pos == '+') {
-            current_pos++;
-            result += parse_term();
-        } else if (*current_pos == '-') {
-            current_pos++;
-            result -= parse_term();
-        } else {
-            break;
+/* Append an instruction to the compiler output, returning its address */
+int emit(int op, int a, int b) {
+    if ((op == OP_ADD || op == OP_SUB || op == OP_MUL || op == OP_DIV || op == OP_CMP) &&
+        fold_constants(op, a)) {
+        return code_len - 1;
+    }
+    if (code_len >= code_cap) {
+        int new_cap = code_cap ? code_cap * 2 : 64;
+        Instr *grown = (Instr *)realloc(code_buf, new_cap * sizeof(Instr));
+        if (!grown) {
+            fprintf(stderr, "Error: Memory allocation failed\n");
+            exit(1);
         }
+        code_buf = grown;
+        code_cap = new_cap;
     }
-    
-    return result;
+    code_buf[code_len].op = op;
+    code_buf[code_len].a = a;
+    code_buf[code_len].b = b;
+    code_buf[code_len].c = 0;
+    code_buf[code_len].d = 0;
+    code_buf[code_len].target = 0;
+    code_buf[code_len].handler = NULL;
+    return code_len++;
 }
 
-/* Read string literal */
-char *read_string_literal(void) {
-    static char buffer[MAX_LINE_LENGTH];
-    int i = 0;
-    
-    skip_whitespace();
-    if (*current_pos != '"') {
-        return NULL;
-    }
-    
-    current_pos++; /* Skip opening quote */
-    while (*current_pos && *current_pos != '"' && i < MAX_LINE_LENGTH - 1) {
-        buffer[i++] = *current_pos++;
-    }
-    buffer[i] = '\0';
-    
-    if (*current_pos == '"') {
-        current_pos++; /* Skip closing quote */
-    }
-    
-    return buffer;
+/* Emit an instruction that leaves the line when it fails or is false */
+static int emit_line_exit(int op, int a, int b) {
+    int at = emit(op, a, b);
+    code_buf[at].target = TARGET_LINE_END;
+    return at;
 }
 
-/* Execute PRINT statement */
-void execute_print(void) {
-    bool first = true;
-    
-    while (1) {
-        skip_whitespace();
-        
-        if (!*current_pos || *current_pos == '\n') {
-            break;
-        }
-        
-        if (!first) {
-            printf(" ");
-        }
-        first = false;
-        
-        char *save_pos = current_pos;
-        char *str = parse_string_operand();
-        if (str) {
-            printf("%s", str);
-            free(str);
-        } else {
-            current_pos = save_pos;
-            char *before_parse = current_pos;
-            int val = parse_expression();
-            if (current_pos == before_parse) {
-                fprintf(stderr, "Error: Syntax error in PRINT statement\n");
-                break;
-            }
-            printf("%d", val);
+/* Add a NUL-terminated copy of a string to the pool, returning its offset */
+int pool_add(const char *s, int len) {
+    if (string_pool_len + len + 1 > string_pool_cap) {
+        int new_cap = string_pool_cap ? string_pool_cap : 1024;
+        while (string_pool_len + len + 1 > new_cap) {
+            new_cap *= 2;
         }
-        
-        skip_whitespace();
-        if (*current_pos == ',') {
-            current_pos++;
+        char *grown = (char *)realloc(string_pool, new_cap);
+        if (!grown) {
+            fprintf(stderr, "Error: Memory allocation failed\n");
+            exit(1);
         }
+        string_pool = grown;
+        string_pool_cap = new_cap;
     }
-    
-    printf("\n");
+    int offset = string_pool_len;
+    memcpy(string_pool + offset, s, len);
+    string_pool[offset + len] = '\0';
+    string_pool_len += len + 1;
+    return offset;
 }
 
-/* Execute LET statement */
-void execute_let(void) {
-    skip_whitespace();
-    
-    if (!isalpha(*current_pos)) {
-        fprintf(stderr, "Error: Expected variable name\n");
-        return;
+/* Emit a runtime error message */
+static void emit_error(const char *message) {
+    emit(OP_ERROR, pool_add(message, strlen(message)), 0);
+}
+
+/* True if the text at p is the keyword word, not the start of a longer name */
+static bool at_keyword(const char *p, const char *word) {
+    size_t len = strlen(word);
+    return strncasecmp(p, word, len) == 0 && !isalnum((unsigned char)p[len]) && p[len] != '_';
+}
+
+/* True if the text at p is the function word followed by its '(' */
+static bool at_function(const char *p, const char *word) {
+    if (!at_keyword(p, word)) {
+        return false;
     }
-    
-    char var_name = toupper(*current_pos);
-    current_pos++;
-    skip_whitespace();
+    p += strlen(word);
+    while (*p == ' ' || *p == '\t') {
+        p++;
+    }
+    return *p == '(';
+}
 
-    if (*current_pos == '$') {
-        current_pos++;
-        skip_whitespace();
-        if (*current_pos == '=') {
-            current_pos++;
-        }
-        char *val = parse_string_operand();
-        int idx = var_name - 'A';
-        if (string_variables[idx]) {
-            free(string_variables[idx]);
-            string_variables[idx] = NULL;
-        }
-        if (val) {
-            string_variables[idx] = val;
-        } else {
-             /* Assignment of empty or invalid string */
-            string_variables[idx] = (char *)malloc(1);
-            if (string_variables[idx]) *string_variables[idx] = '\0';
+/* Functions taking '(': arrays and string variables of the same name could not be read */
+static const char *const array_functions[] = {
+    "INSTR", "SUM", "MIN", "MAX", "COUNT", "DOT", "HAS", NULL
+};
+static const char *const string_functions[] = { "LEFT", "RIGHT", "MID", NULL };
+
+/* True if the len characters at text are exactly one of words */
+static bool is_word(const char *const *words, const char *text, int len) {
+    for (; *words; words++) {
+        if ((int)strlen(*words) == len && strncasecmp(*words, text, len) == 0) {
+            return true;
         }
-        return;
     }
-    
-    /* Check for array assignment */
-    if (*current_pos == '[' || *current_pos == '(') {
-        char closing = (*current_pos == '[') ? ']' : ')';
-        current_pos++;
-        int index = parse_expression();
-        skip_whitespace();
-        if (*current_pos == closing) {
-            current_pos++;
+    return false;
+}
+
+static void compile_dim_statement(void) {
+    compile_dim(OP_DIM);
+}
+
+static void compile_redim_statement(void) {
+    compile_dim(OP_REDIM);
+}
+
+static void compile_end(void) {
+    emit(OP_END, 0, 0);
+}
+
+/* A statement keyword and the function that compiles the rest of the statement */
+typedef struct {
+    const char *word;
+    void (*compile)(void);
+    bool whole_word;    /* not matched at the start of a longer name */
+    bool direct;        /* may be typed in direct mode */
+} Statement;
+
+/* Statement keywords, in the order compile_statement tries them */
+static const Statement statements[] = {
+    { "PRINT", compile_print, false, true },
+    { "LET", compile_let, false, true },
+    { "GOTO", compile_goto, false, false },
+    { "IF", compile_if, false, false },
+    { "DIM", compile_dim_statement, false, true },
+    { "REDIM", compile_redim_statement, false, true },
+    { "FLUSH", compile_flush, false, true },
+    { "MAT", compile_mat, false, true },
+    { "SCAN", compile_scan, false, true },
+    { "SORT", compile_sort, false, true },
+    { "DEL", compile_del, true, true },
+    { "OPEN", compile_open, true, true },
+    { "CLOSE", compile_close, true, true },
+    { "INPUT", compile_input, false, true },
+    { "DATA", compile_data, true, false },
+    { "READ", compile_read, true, true },
+    { "RESTORE", compile_restore, true, true },
+    { "RECORD", compile_record, true, true },
+    { "FOR", compile_for, false, true },
+    { "NEXT", compile_next, false, true },
+    { "END", compile_end, false, false },
+    { NULL, NULL, false, false }
+};
+
+/* The statement whose keyword starts the text at p, or NULL */
+static const Statement *find_statement(const char *p) {
+    const Statement *stmt;
+
+    for (stmt = statements; stmt->word; stmt++) {
+        if (stmt->whole_word ? at_keyword(p, stmt->word)
+                             : strncasecmp(p, stmt->word, strlen(stmt->word)) == 0) {
+            return stmt;
         }
-        
-        skip_whitespace();
-        if (*current_pos == '=') {
-            current_pos++;
+    }
+    return NULL;
+}
+
+/* True if the len characters at text are exactly a statement keyword */
+static bool is_statement_word(const char *text, int len) {
+    const Statement *stmt;
+
+    for (stmt = statements; stmt->word; stmt++) {
+        if ((int)strlen(stmt->word) == len && strncasecmp(stmt->word, text, len) == 0) {
+            return true;
         }
-        
-        int arr_idx = var_name - 'A';
-        if (!arrays[arr_idx].allocated) {
-            fprintf(stderr, "Error: Array %c not dimensioned\n", var_name);
+    }
+    return false;
+}
+
+/* Length of the name starting at p: a letter, then letters, digits or _ */
+static int name_length(const char *p) {
+    int len = 0;
+
+    if (!isalpha((unsigned char)*p)) {
+        return 0;
+    }
+    while (isalnum((unsigned char)p[len]) || p[len] == '_') {
+        len++;
+    }
+    return len;
+}
+
+/* Slot of the len-character name at text, giving a new name the next slot */
+static int name_slot(NameTable *table, const char *text, int len) {
+    unsigned int hash = 2166136261u;
+    unsigned int i;
+    char *name;
+    int k;
+
+    if (len == 1) {
+        return toupper((unsigned char)*text) - 'A';
+    }
+    if ((table == &array_names && is_word(array_functions, text, len)) ||
+        (table == &str_names && is_word(string_functions, text, len))) {
+        char message[64];
+        snprintf(message, sizeof(message), "%.*s is the name of a function", len, text);
+        emit_error(message);
+    }
+    for (k = 0; k < len; k++) {
+        hash = (hash ^ (unsigned char)toupper((unsigned char)text[k])) * 16777619u;
+    }
+    for (i = hash & (NAME_INDEX_SIZE - 1); table->index[i]; i = (i + 1) & (NAME_INDEX_SIZE - 1)) {
+        name = table->names[table->index[i] - 1];
+        if (strncasecmp(name, text, len) == 0 && name[len] == '\0') {
+            return table->index[i] - 1;
+        }
+    }
+    if (table->count >= MAX_NAMES - 1) {
+        emit_error("Too many names");
+        return MAX_NAMES - 1;
+    }
+    name = (char *)malloc(len + 1);
+    if (!name) {
+        fprintf(stderr, "Error: Memory allocation failed\n");
+        exit(1);
+    }
+    for (k = 0; k < len; k++) {
+        name[k] = toupper((unsigned char)text[k]);
+    }
+    name[len] = '\0';
+    table->names[table->count] = name;
+    table->index[i] = table->count + 1;
+    return table->count++;
+}
+
+/* Compile the name at current_pos, which starts with a letter, to its slot in table */
+static int compile_name(NameTable *table) {
+    int len = name_length(current_pos);
+
+    current_pos += len;
+    return name_slot(table, current_pos - len, len);
+}
+
+/*
+ * True if the statement at p assigns to a name: a name, with $ or a
+ * subscript or key, followed by =. This lets a statement such as
+ * PRINTED = 1 or FORMAT$ = "" start with a keyword, while IF (A) = 3
+ * stays an IF.
+ */
+static bool at_assignment(const char *p) {
+    int depth = 0;
+    char quote = 0;
+    int len = name_length(p);
+
+    if (is_statement_word(p, len)) {
+        return false;
+    }
+    p += len;
+    if (*p == '$') {
+        p++;
+    }
+    while (*p == ' ' || *p == '\t') {
+        p++;
+    }
+    if (*p == '(' || *p == '[' || *p == '{') {
+        for (; *p; p++) {
+            if (quote) {
+                if (*p == quote) quote = 0;
+            } else if (*p == '"') {
+                quote = '"';
+            } else if (*p == '(' || *p == '[' || *p == '{') {
+                depth++;
+            } else if ((*p == ')' || *p == ']' || *p == '}') && --depth == 0) {
+                break;
+            }
+        }
+        if (!*p) {
+            return false;
+        }
+        p++;
+        while (*p == ' ' || *p == '\t') {
+            p++;
+        }
+    }
+    return *p == '=';
+}
+
+/*
+ * Compile an array function after its keyword: SUM, MIN and MAX take an
+ * array, COUNT an array and the value to count, DOT two arrays. Each may
+ * end with the first element to use and the number of elements.
+ */
+static void compile_reduce(int kind) {
+    int arr, other = 0, pushed = 0, range = 0, at;
+
+    skip_whitespace();
+    if (*current_pos != '(') {
+        emit_error("Expected '(' after array function");
+        emit(OP_PUSH_INT, 0, 0);
+        return;
+    }
+    current_pos++;
+    skip_whitespace();
+    if (!isalpha(*current_pos)) {
+        emit_error("Expected array name");
+        emit(OP_PUSH_INT, 0, 0);
+        return;
+    }
+    arr = compile_name(&array_names);
+    skip_whitespace();
+
+    if (kind == REDUCE_COUNT || kind == REDUCE_DOT) {
+        if (*current_pos != ',') {
+            emit_error("Expected ',' in array function");
+            emit(OP_PUSH_INT, 0, 0);
             return;
         }
-        if (index < 0 || index >= arrays[arr_idx].size) {
-            fprintf(stderr, "Error: Array index %d out of bounds for %c\n", index, var_name);
+        current_pos++;
+        skip_whitespace();
+        if (kind == REDUCE_COUNT) {
+            compile_expression();
+            pushed++;
+        } else if (isalpha(*current_pos)) {
+            other = compile_name(&array_names);
+        } else {
+            emit_error("Expected array name");
+            emit(OP_PUSH_INT, 0, 0);
             return;
         }
-        
-        arrays[arr_idx].data[index] = parse_expression();
-        return;
+        skip_whitespace();
     }
-    
-    if (*current_pos == '=') {
+
+    /* Optional start and length */
+    while (*current_pos == ',' && range < 2) {
         current_pos++;
+        compile_expression();
+        range++;
+        skip_whitespace();
     }
-    
-    variables[var_name - 'A'] = parse_expression();
+    pushed += range;
+    if (*current_pos != ')') {
+        while (pushed-- > 0) {
+            emit(OP_POP_INT, 0, 0);
+        }
+        emit_error("Expected ')' in array function");
+        emit(OP_PUSH_INT, 0, 0);
+        return;
+    }
+    current_pos++;
+
+    at = emit(OP_REDUCE, arr, kind);
+    code_buf[at].c = other;
+    code_buf[at].d = range;
 }
 
-/* Execute DIM statement */
-void execute_dim(void) {
+/* True if the text at p starts a string operand */
+static bool at_string_operand(const char *p) {
+    int len = name_length(p);
+
+    return *p == '"' || strncasecmp(p, "LEFT$", 5) == 0 || strncasecmp(p, "RIGHT$", 6) == 0 ||
+           strncasecmp(p, "MID$", 4) == 0 || (len && p[len] == '$');
+}
+
+/*
+ * Compile the key of a map access, up to its closing bracket. A key that
+ * starts like a string is a string key; anything else is an integer.
+ * Returns 1 for a string key, the b operand of the map instructions.
+ */
+static int compile_map_key(char closing) {
+    char message[32];
+    int is_string = 0;
+
     skip_whitespace();
-    
-    if (!isalpha(*current_pos)) {
-        fprintf(stderr, "Error: Expected array name\n");
-        return;
+    if (!at_string_operand(current_pos)) {
+        compile_expression();
+    } else if (compile_string_expression(false)) {
+        is_string = 1;
+    } else {
+        emit(OP_PUSH_INT, 0, 0);
     }
-    
-    char var_name = toupper(*current_pos);
-    current_pos++;
     skip_whitespace();
-    
-    char closing = 0;
-    if (*current_pos == '[' || *current_pos == '(') {
-        closing = (*current_pos == '[') ? ']' : ')';
+    if (*current_pos == closing) {
         current_pos++;
+    } else {
+        snprintf(message, sizeof(message), "Expected '%c' after map key", closing);
+        emit_error(message);
     }
-    
-    int size = parse_expression();
+    return is_string;
+}
+
+/* Compile HAS(H, key) after its keyword */
+static void compile_has(void) {
+    int map_idx;
+
     skip_whitespace();
-    
-    if (closing && *current_pos == closing) {
-        current_pos++;
+    if (*current_pos != '(') {
+        emit_error("Expected '(' after HAS");
+        emit(OP_PUSH_INT, 0, 0);
+        return;
     }
-    
-    int arr_idx = var_name - 'A';
-    
-    if (arrays[arr_idx].allocated) {
-        fprintf(stderr, "Error: Array %c already dimensioned\n", var_name);
+    current_pos++;
+    skip_whitespace();
+    if (!isalpha(*current_pos)) {
+        emit_error("Expected map name");
+        emit(OP_PUSH_INT, 0, 0);
         return;
     }
-    
-    if (size <= 0 || size > MAX_ARRAY_SIZE) {
-        fprintf(stderr, "Error: Invalid array size %d\n", size);
+    map_idx = compile_name(&map_names);
+    skip_whitespace();
+    if (*current_pos != ',') {
+        emit_error("Expected ',' in HAS");
+        emit(OP_PUSH_INT, 0, 0);
         return;
     }
-    
-    arrays[arr_idx].data = (int *)calloc(size, sizeof(int));
-    if (!arrays[arr_idx].data) {
-        fprintf(stderr, "Error: Memory allocation failed\n");
+    current_pos++;
+    emit(OP_HAS_MAP, map_idx, compile_map_key(')'));
+}
+
+/*
+ * Count one more level of nesting for an operand; past MAX_NESTING, mark
+ * the line too complex and skip the rest of it rather than recurse further.
+ */
+static bool enter_nesting(void) {
+    if (nesting_depth >= MAX_NESTING) {
+        too_complex = true;
+        current_pos += strlen(current_pos);
+        return false;
+    }
+    nesting_depth++;
+    return true;
+}
+
+static void compile_factor_body(void);
+
+/* Compile factor: number, variable, array element, or parenthesized expression */
+void compile_factor(void) {
+    if (!enter_nesting()) {
+        emit(OP_PUSH_INT, 0, 0);
         return;
     }
-    
-    arrays[arr_idx].size = size;
-    arrays[arr_idx].allocated = true;
+    compile_factor_body();
+    nesting_depth--;
 }
 
-/* Execute INPUT statement */
-void execute_input(void) {
+static void compile_factor_body(void) {
     skip_whitespace();
 
-    if (*current_pos == '"') {
-        char *prompt = read_string_literal();
-        if (prompt) {
-            printf("%s", prompt);
-            fflush(stdout);
-        }
-
+    if (*current_pos == '(') {
+        current_pos++;
+        compile_expression();
         skip_whitespace();
-        if (*current_pos == ',') {
+        if (*current_pos == ')') {
             current_pos++;
         }
+        return;
     }
 
-    while (1) {
-        skip_whitespace();
-        if (!*current_pos || *current_pos == '\n') {
-            break;
+    if (isalpha(*current_pos)) {
+        if (at_function(current_pos, "INSTR")) {
+            current_pos += 5;
+            skip_whitespace();
+            if (*current_pos == '(') {
+                current_pos++;
+                bool has_haystack = compile_string_expression(false);
+                skip_whitespace();
+                if (*current_pos == ',') {
+                    current_pos++;
+                    bool has_needle = compile_string_expression(false);
+                    bool has_start = false;
+                    skip_whitespace();
+                    if (*current_pos == ',') {
+                        /* Optional position to start searching from */
+                        current_pos++;
+                        compile_expression();
+                        has_start = true;
+                        skip_whitespace();
+                    }
+                    if (*current_pos == ')') {
+                        current_pos++;
+                        if (has_haystack && has_needle) {
+                            emit(OP_INSTR, has_start, 0);
+                            return;
+                        }
+                        if (has_start) emit(OP_POP_INT, 0, 0);
+                        if (has_needle) emit(OP_POP_STR, 0, 0);
+                        if (has_haystack) emit(OP_POP_STR, 0, 0);
+                        emit(OP_PUSH_INT, 0, 0);
+                        return;
+                    }
+                    if (has_start) emit(OP_POP_INT, 0, 0);
+                    if (has_needle) emit(OP_POP_STR, 0, 0);
+                }
+                if (has_haystack) emit(OP_POP_STR, 0, 0);
+            }
+            emit(OP_PUSH_INT, 0, 0);
+            return;
         }
-
-        if (!isalpha(*current_pos)) {
-            fprintf(stderr, "Error: Expected variable name in INPUT\n");
+        if (at_function(current_pos, "SUM")) {
+            current_pos += 3;
+            compile_reduce(REDUCE_SUM);
+            return;
+        }
+        if (at_function(current_pos, "MIN")) {
+            current_pos += 3;
+            compile_reduce(REDUCE_MIN);
+            return;
+        }
+        if (at_function(current_pos, "MAX")) {
+            current_pos += 3;
+            compile_reduce(REDUCE_MAX);
+            return;
+        }
+        if (at_function(current_pos, "COUNT")) {
+            current_pos += 5;
+            compile_reduce(REDUCE_COUNT);
+            return;
+        }
+        if (at_function(current_pos, "DOT")) {
+            current_pos += 3;
+            compile_reduce(REDUCE_DOT);
+            return;
+        }
+        if (at_function(current_pos, "HAS")) {
+            current_pos += 3;
+            compile_has();
             return;
         }
 
-        char var_name = toupper(*current_pos);
-        current_pos++;
+        const char *name = current_pos;
+        int len = name_length(name);
+        current_pos += len;
+        skip_whitespace();
 
-        bool is_string = false;
-        if (*current_pos == '$') {
-            is_string = true;
+        /* Map lookup */
+        if (*current_pos == '{') {
+            int map_idx = name_slot(&map_names, name, len);
             current_pos++;
+            emit(OP_LOAD_MAP, map_idx, compile_map_key('}'));
+            return;
         }
 
-        int *target = NULL;
-
-        if (is_string) {
-            char buffer[MAX_LINE_LENGTH];
-            if (scanf("%255s", buffer) == 1) { /* 255 must be MAX_LINE_LENGTH - 1 */
-                int idx = var_name - 'A';
-                if (string_variables[idx]) free(string_variables[idx]);
-                string_variables[idx] = (char *)malloc(strlen(buffer) + 1);
-                if (string_variables[idx]) strcpy(string_variables[idx], buffer);
-            }
-        } else {
-            skip_whitespace();
-            if (*current_pos == '[' || *current_pos == '(') {
-                char closing = (*current_pos == '[') ? ']' : ')';
-                current_pos++;
-                int index = parse_expression();
-                skip_whitespace();
-                if (*current_pos == closing) {
-                    current_pos++;
-                }
-
-                int arr_idx = var_name - 'A';
-                if (!arrays[arr_idx].allocated) {
-                    fprintf(stderr, "Error: Array %c not dimensioned\n", var_name);
-                    return;
-                }
-                if (index < 0 || index >= arrays[arr_idx].size) {
-                    fprintf(stderr, "Error: Array index %d out of bounds for %c\n", index, var_name);
-                    return;
-                }
-                target = &arrays[arr_idx].data[index];
+        /* Check for array subscript */
+        if (*current_pos == '[' || *current_pos == '(') {
+            int arr = name_slot(&array_names, name, len);
+            char closing = (*current_pos == '[') ? ']' : ')';
+            current_pos++;
+            int count = compile_subscripts(closing);
+            if (count == 1) {
+                emit(OP_LOAD_ARRAY, arr, 0);
             } else {
-                target = &variables[var_name - 'A'];
+                emit(OP_LOAD_ARRAY_N, arr, count);
             }
+            return;
+        }
 
-            if (target) {
-                if (scanf("%d", target) != 1) {
-                    fprintf(stderr, "Error: Invalid input\n");
-                    while(getchar() != '\n' && !feof(stdin));
-                    return;
-                }
-            }
+        emit(OP_LOAD_VAR, name_slot(&var_names, name, len), 0);
+        return;
+    }
+
+    if (isdigit(*current_pos) || (*current_pos == '-' && isdigit(*(current_pos + 1)))) {
+        int sign = 1;
+        if (*current_pos == '-') {
+            sign = -1;
+            current_pos++;
+        }
+        int result = 0;
+        while (isdigit(*current_pos)) {
+            result = result * 10 + (*current_pos - '0');
+            current_pos++;
         }
+        emit(OP_PUSH_INT, sign * result, 0);
+        return;
+    }
+
+    emit(OP_PUSH_INT, 0, 0);
+}
+
+/* Compile term: factor with *, / */
+void compile_term(void) {
+    compile_factor();
 
+    while (1) {
         skip_whitespace();
-        if (*current_pos == ',') {
+        if (*current_pos == '*') {
+            current_pos++;
+            compile_factor();
+            emit(OP_MUL, 0, 0);
+        } else if (*current_pos == '/') {
             current_pos++;
+            compile_factor();
+            emit(OP_DIV, 0, 0);
         } else {
             break;
         }
     }
+}
 
-    /* Consume trailing newline */
-    int c;
-    while ((c = getchar()) != '\n' && c != EOF);
+/* Compile expression: term with +, - */
+void compile_expression(void) {
+    compile_term();
+
+    while (1) {
+        skip_whitespace();
+        if (*current_pos == '+') {
+            current_pos++;
+            compile_term();
+            emit(OP_ADD, 0, 0);
+        } else if (*current_pos == '-') {
+            current_pos++;
+            compile_term();
+            emit(OP_SUB, 0, 0);
+        } else {
+            break;
+        }
+    }
 }
 
-/* Execute FOR statement */
-void execute_for(void) {
+/* Read string literal */
+char *read_string_literal(void) {
+    static char *buffer = NULL;
+    static int buffer_cap = 0;
+    const char *start;
+    int len;
+
     skip_whitespace();
-    if (!isalpha(*current_pos)) {
-        fprintf(stderr, "Error: Expected variable name in FOR\n");
-        return;
+    if (*current_pos != '"') {
+        return NULL;
     }
-    char var_name = toupper(*current_pos);
-    current_pos++;
-    skip_whitespace();
 
-    if (*current_pos == '=') {
+    current_pos++; /* Skip opening quote */
+    start = current_pos;
+    while (*current_pos && *current_pos != '"') {
         current_pos++;
     }
+    len = (int)(current_pos - start);
+    if (len + 1 > buffer_cap) {
+        char *grown = (char *)realloc(buffer, len + 1);
+        if (!grown) {
+            fprintf(stderr, "Error: Memory allocation failed\n");
+            exit(1);
+        }
+        buffer = grown;
+        buffer_cap = len + 1;
+    }
+    memcpy(buffer, start, len);
+    buffer[len] = '\0';
+
+    if (*current_pos == '"') {
+        current_pos++; /* Skip closing quote */
+    }
+
+    return buffer;
+}
+
+/* Compile a LEFT$/RIGHT$ call after its keyword; returns true if it yields a string */
+static bool compile_left_right(int op, const char *name) {
+    char message[64];
+
+    skip_whitespace();
+    if (*current_pos == '(') {
+        current_pos++;
+        bool has_str = compile_string_expression(false);
+        skip_whitespace();
+        if (*current_pos == ',') {
+            current_pos++;
+            compile_expression();
+            skip_whitespace();
+            if (*current_pos == ')') {
+                current_pos++;
+                if (has_str) {
+                    emit(op, 0, 0);
+                } else {
+                    emit(OP_POP_INT, 0, 0);
+                }
+                return has_str;
+            } else {
+                emit(OP_POP_INT, 0, 0);
+                snprintf(message, sizeof(message), "Expected ')' in %s", name);
+                emit_error(message);
+            }
+        } else {
+            snprintf(message, sizeof(message), "Expected ',' in %s", name);
+            emit_error(message);
+        }
+        if (has_str) emit(OP_POP_STR, 0, 0);
+    } else {
+        snprintf(message, sizeof(message), "Expected '(' after %s", name);
+        emit_error(message);
+    }
+    return false;
+}
+
+static bool compile_string_operand_body(void);
+
+/*
+ * Compile string operand. Returns true if the emitted code leaves a string
+ * on the string stack; otherwise the code only carries the side effects
+ * (error messages) of the failed parse.
+ */
+bool compile_string_operand(void) {
+    bool ok;
+
+    if (!enter_nesting()) {
+        return false;
+    }
+    ok = compile_string_operand_body();
+    nesting_depth--;
+    return ok;
+}
+
+static bool compile_string_operand_body(void) {
+    skip_whitespace();
+    if (*current_pos == '"') {
+        char *s = read_string_literal();
+        int len = strlen(s);
+        emit(OP_PUSH_STR, pool_add(s, len), len);
+        return true;
+    } else if (strncasecmp(current_pos, "LEFT$", 5) == 0) {
+        current_pos += 5;
+        return compile_left_right(OP_LEFT, "LEFT$");
+    } else if (strncasecmp(current_pos, "RIGHT$", 6) == 0) {
+        current_pos += 6;
+        return compile_left_right(OP_RIGHT, "RIGHT$");
+    } else if (strncasecmp(current_pos, "MID$", 4) == 0) {
+        current_pos += 4;
+        skip_whitespace();
+        if (*current_pos == '(') {
+            current_pos++;
+            bool has_str = compile_string_expression(false);
+            skip_whitespace();
+            if (*current_pos == ',') {
+                current_pos++;
+                compile_expression();
+                skip_whitespace();
+                if (*current_pos == ',') {
+                    current_pos++;
+                    compile_expression();
+                    skip_whitespace();
+                    if (*current_pos == ')') {
+                        current_pos++;
+                        if (has_str) {
+                            emit(OP_MID, 0, 0);
+                            return true;
+                        }
+                        emit(OP_POP_INT, 0, 0);
+                        emit(OP_POP_INT, 0, 0);
+                        return false;
+                    }
+                    emit(OP_POP_INT, 0, 0);
+                }
+                emit(OP_POP_INT, 0, 0);
+            }
+            if (has_str) emit(OP_POP_STR, 0, 0);
+        }
+    } else if (isalpha(*current_pos)) {
+         int len = name_length(current_pos);
+         if (current_pos[len] == '$') {
+             int slot = name_slot(&str_names, current_pos, len);
+             current_pos += len + 1; /* skip name and $ */
+             emit(OP_LOAD_STR, slot, 0);
+             return true;
+         }
+    }
+    return false;
+}
+
+/*
+ * Compile a string expression: operands joined with +. A result that will
+ * be stored in a variable is built in a growable buffer, so that
+ * A$ = A$ + X$ appends in place; one that is only read (printed, compared
+ * or passed to a function) is built in temp_arena.
+ */
+bool compile_string_expression(bool stored) {
+    if (!compile_string_operand()) {
+        return false;
+    }
+    while (1) {
+        skip_whitespace();
+        if (*current_pos != '+') {
+            break;
+        }
+        current_pos++;
+        if (!compile_string_operand()) {
+            emit_error("Type mismatch in string expression");
+            break;
+        }
+        emit(OP_CONCAT, !stored, 0);
+    }
+    return true;
+}
+
+/* Compile the file number of PRINT #, OPEN or CLOSE, with its optional #; 0 after an error */
+static int compile_file_number(void) {
+    char message[48];
+    int file = 0;
+
+    skip_whitespace();
+    if (*current_pos == '#') {
+        current_pos++;
+        skip_whitespace();
+    }
+    while (isdigit((unsigned char)*current_pos)) {
+        if (file <= MAX_FILES) {
+            file = file * 10 + (*current_pos - '0');
+        }
+        current_pos++;
+    }
+    if (file < 1 || file > MAX_FILES) {
+        snprintf(message, sizeof(message), "Expected a file number from 1 to %d", MAX_FILES);
+        emit_error(message);
+        return 0;
+    }
+    return file;
+}
+
+/* Compile PRINT statement, or PRINT #n to a file opened with OPEN */
+void compile_print(void) {
+    bool first = true;
+    int channel = 0;
+
+    skip_whitespace();
+    if (*current_pos == '#') {
+        channel = compile_file_number();
+        if (!channel) {
+            return;
+        }
+        skip_whitespace();
+        if (*current_pos == ',') {
+            current_pos++;
+        }
+        emit_line_exit(OP_CHECK_FILE, channel, 0);
+    }
+
+    while (1) {
+        skip_whitespace();
+
+        if (!*current_pos || *current_pos == '\n') {
+            break;
+        }
+
+        if (!first) {
+            emit(OP_PRINT_SPACE, channel, 0);
+        }
+        first = false;
+
+        char *save_pos = current_pos;
+        if (compile_string_expression(false)) {
+            emit(OP_PRINT_STR, channel, 0);
+        } else {
+            current_pos = save_pos;
+            char *before_parse = current_pos;
+            int before_emit = code_len;
+            compile_expression();
+            if (current_pos == before_parse) {
+                code_len = before_emit;
+                emit_error("Syntax error in PRINT statement");
+                break;
+            }
+            emit(OP_PRINT_INT, channel, 0);
+        }
+
+        skip_whitespace();
+        if (*current_pos == ',') {
+            current_pos++;
+        }
+    }
+
+    emit(OP_PRINT_NEWLINE, channel, 0);
+}
+
+/* Compile OPEN "file" FOR OUTPUT AS #n, or FOR APPEND */
+void compile_open(void) {
+    int append, file;
+
+    skip_whitespace();
+    if (!compile_string_expression(false)) {
+        emit_error("Expected file name");
+        return;
+    }
+    skip_whitespace();
+    if (!at_keyword(current_pos, "FOR")) {
+        emit(OP_POP_STR, 0, 0);
+        emit_error("Expected FOR in OPEN");
+        return;
+    }
+    current_pos += 3;
+    skip_whitespace();
+    if (at_keyword(current_pos, "OUTPUT") || at_keyword(current_pos, "APPEND")) {
+        append = toupper(*current_pos) == 'A';
+        current_pos += 6;
+    } else {
+        emit(OP_POP_STR, 0, 0);
+        emit_error("Expected OUTPUT or APPEND in OPEN");
+        return;
+    }
+    skip_whitespace();
+    if (!at_keyword(current_pos, "AS")) {
+        emit(OP_POP_STR, 0, 0);
+        emit_error("Expected AS in OPEN");
+        return;
+    }
+    current_pos += 2;
+    file = compile_file_number();
+    if (!file) {
+        emit(OP_POP_STR, 0, 0);
+        return;
+    }
+    emit(OP_OPEN, file, append);
+}
+
+/* Compile CLOSE #n, or CLOSE for every file */
+void compile_close(void) {
+    int file;
+
+    skip_whitespace();
+    if (!*current_pos || *current_pos == '\n') {
+        emit(OP_CLOSE, 0, 0);
+        return;
+    }
+    file = compile_file_number();
+    if (file) {
+        emit(OP_CLOSE, file, 0);
+    }
+}
+
+/* Compile LET statement */
+void compile_let(void) {
+    skip_whitespace();
+
+    if (!isalpha(*current_pos)) {
+        emit_error("Expected variable name");
+        return;
+    }
+
+    const char *name = current_pos;
+    int len = name_length(name);
+    current_pos += len;
+    skip_whitespace();
+
+    if (*current_pos == '$') {
+        int slot = name_slot(&str_names, name, len);
+        current_pos++;
+        skip_whitespace();
+        if (*current_pos == '=') {
+            current_pos++;
+        }
+        if (compile_string_expression(true)) {
+            emit(OP_STORE_STR, slot, 0);
+        } else {
+            /* Assignment of empty or invalid string */
+            emit(OP_STORE_STR_EMPTY, slot, 0);
+        }
+        return;
+    }
+
+    /* Map assignment */
+    if (*current_pos == '{') {
+        int map_idx = name_slot(&map_names, name, len);
+        current_pos++;
+        int is_string = compile_map_key('}');
+        skip_whitespace();
+        if (*current_pos == '=') {
+            current_pos++;
+        }
+        compile_expression();
+        emit(OP_STORE_MAP, map_idx, is_string);
+        return;
+    }
+
+    /* Check for array assignment */
+    if (*current_pos == '[' || *current_pos == '(') {
+        int arr = name_slot(&array_names, name, len);
+        char closing = (*current_pos == '[') ? ']' : ')';
+        current_pos++;
+        int count = compile_subscripts(closing);
+
+        skip_whitespace();
+        if (*current_pos == '=') {
+            current_pos++;
+        }
+
+        if (count == 1) {
+            emit_line_exit(OP_CHECK_INDEX, arr, 0);
+        } else {
+            emit_line_exit(OP_CHECK_INDEX_N, arr, count);
+        }
+        compile_expression();
+        emit(OP_STORE_ARRAY, arr, 0);
+        return;
+    }
+
+    int slot = name_slot(&var_names, name, len);
+    if (*current_pos == '=') {
+        current_pos++;
+    }
+
+    compile_expression();
+    emit(OP_STORE_VAR, slot, 0);
+}
+
+/*
+ * Compile the comma-separated subscripts after an array name, up to the
+ * closing bracket, and return how many there were.
+ */
+int compile_subscripts(char closing) {
+    int count = 0;
+
+    while (1) {
+        compile_expression();
+        count++;
+        skip_whitespace();
+        if (*current_pos != ',') {
+            break;
+        }
+        current_pos++;
+    }
+    if (*current_pos == closing) {
+        current_pos++;
+    }
+    if (count > MAX_DIMS) {
+        emit_error("Too many dimensions");
+    }
+    return count;
+}
+
+/* Compile DIM or REDIM statement */
+void compile_dim(int op) {
+    skip_whitespace();
+
+    /* DIM MAP H */
+    if (op == OP_DIM && at_keyword(current_pos, "MAP")) {
+        current_pos += 3;
+        skip_whitespace();
+        if (!isalpha(*current_pos)) {
+            emit_error("Expected map name");
+            return;
+        }
+        emit(OP_DIM_MAP, compile_name(&map_names), 0);
+        return;
+    }
+
+    if (!isalpha(*current_pos)) {
+        emit_error("Expected array name");
+        return;
+    }
+
+    int arr = compile_name(&array_names);
+    skip_whitespace();
+
+    char closing = 0;
+    if (*current_pos == '[' || *current_pos == '(') {
+        closing = (*current_pos == '[') ? ']' : ')';
+        current_pos++;
+    }
+
+    int dims = compile_subscripts(closing);
+    skip_whitespace();
+
+    if (op == OP_DIM && strncasecmp(current_pos, "FILE", 4) == 0) {
+        current_pos += 4;
+        skip_whitespace();
+        if (!compile_string_expression(false)) {
+            emit_error("Expected file name");
+            return;
+        }
+        op = OP_DIM_FILE;
+    }
+
+    emit(op, arr, dims);
+}
+
+/* Compile FLUSH statement */
+void compile_flush(void) {
+    skip_whitespace();
+
+    if (isalpha(*current_pos)) {
+        emit(OP_FLUSH, compile_name(&array_names), 0);
+    } else {
+        emit(OP_FLUSH, -1, 0);
+    }
+}
+
+/*
+ * Compile MAT statement. An operand that is just a name is an
+ * array; any other operand of * is a scalar, so MAT C = A * K multiplies
+ * two arrays and MAT C = A * (K) scales A by the variable K.
+ */
+void compile_mat(void) {
+    int target, left, right, op = MAT_COPY, at;
+
+    skip_whitespace();
+    if (!isalpha(*current_pos)) {
+        emit_error("Expected array name");
+        return;
+    }
+    target = compile_name(&array_names);
+    skip_whitespace();
+    if (*current_pos != '=') {
+        emit_error("Expected = in MAT");
+        return;
+    }
+    current_pos++;
+    skip_whitespace();
+
+    if (at_keyword(current_pos, "ZER") || at_keyword(current_pos, "CON")) {
+        op = toupper(*current_pos) == 'Z' ? MAT_ZER : MAT_CON;
+        current_pos += 3;
+        at = emit(OP_MAT, target, op);
+        code_buf[at].c = target;
+        code_buf[at].d = target;
+        return;
+    }
+
+    if (*current_pos == '(') {
+        /* MAT C = (k) * A */
+        compile_factor();
+        skip_whitespace();
+        if (*current_pos != '*') {
+            emit_error("Expected * in MAT");
+            return;
+        }
+        current_pos++;
+        skip_whitespace();
+        if (!isalpha(*current_pos)) {
+            emit_error("Expected array name");
+            return;
+        }
+        left = compile_name(&array_names);
+        op = MAT_SCALE;
+    } else if (isalpha(*current_pos)) {
+        left = compile_name(&array_names);
+        skip_whitespace();
+        if (*current_pos == '+' || *current_pos == '-' || *current_pos == '*') {
+            char sign = *current_pos++;
+            skip_whitespace();
+            int len = name_length(current_pos);
+            if (len && current_pos[len] != '(' && current_pos[len] != '[' && current_pos[len] != '$') {
+                const char *after = current_pos + len;
+                while (*after == ' ' || *after == '\t') after++;
+                if (!*after || *after == '\n') {
+                    right = compile_name(&array_names);
+                    op = sign == '+' ? MAT_ADD : sign == '-' ? MAT_SUB : MAT_MUL;
+                }
+            }
+            if (op == MAT_COPY) {
+                if (sign != '*') {
+                    emit_error("Expected array name");
+                    return;
+                }
+                compile_expression();
+                op = MAT_SCALE;
+            }
+        }
+    } else {
+        emit_error("Expected array name");
+        return;
+    }
+
+    at = emit(OP_MAT, target, op);
+    code_buf[at].c = left;
+    code_buf[at].d = op == MAT_SCALE || op == MAT_COPY ? left : right;
+}
+
+/* Compile SCAN A TO B [, start [, length]]: running totals of A into B */
+void compile_scan(void) {
+    int source, target, range = 0, at;
+
+    skip_whitespace();
+    if (!isalpha(*current_pos)) {
+        emit_error("Expected array name");
+        return;
+    }
+    source = compile_name(&array_names);
+    skip_whitespace();
+    if (!at_keyword(current_pos, "TO")) {
+        emit_error("Expected TO in SCAN");
+        return;
+    }
+    current_pos += 2;
+    skip_whitespace();
+    if (!isalpha(*current_pos)) {
+        emit_error("Expected array name");
+        return;
+    }
+    target = compile_name(&array_names);
+    skip_whitespace();
+
+    while (*current_pos == ',' && range < 2) {
+        current_pos++;
+        compile_expression();
+        range++;
+        skip_whitespace();
+    }
+
+    at = emit(OP_SCAN, source, target);
+    code_buf[at].d = range;
+}
+
+/* Compile DEL H{key} */
+void compile_del(void) {
+    int map_idx;
+
+    skip_whitespace();
+    if (!isalpha(*current_pos)) {
+        emit_error("Expected map name");
+        return;
+    }
+    map_idx = compile_name(&map_names);
+    skip_whitespace();
+    if (*current_pos != '{') {
+        emit_error("Expected '{' after map name");
+        return;
+    }
+    current_pos++;
+    emit(OP_DEL_MAP, map_idx, compile_map_key('}'));
+}
+
+/* Compile SORT A [WITH B] [, count] [, DESC] */
+void compile_sort(void) {
+    int arr, with = -1, at;
+    bool has_count = false, descending = false;
+
+    skip_whitespace();
+    if (!isalpha(*current_pos)) {
+        emit_error("Expected array name");
+        return;
+    }
+    arr = compile_name(&array_names);
+    skip_whitespace();
+    if (at_keyword(current_pos, "WITH")) {
+        current_pos += 4;
+        skip_whitespace();
+        if (!isalpha(*current_pos)) {
+            emit_error("Expected array name");
+            return;
+        }
+        with = compile_name(&array_names);
+        skip_whitespace();
+    }
+
+    while (*current_pos == ',') {
+        current_pos++;
+        skip_whitespace();
+        if (at_keyword(current_pos, "DESC")) {
+            current_pos += 4;
+            descending = true;
+        } else if (!has_count && !descending) {
+            compile_expression();
+            has_count = true;
+        } else {
+            break;
+        }
+        skip_whitespace();
+    }
+
+    at = emit(OP_SORT, arr, with);
+    code_buf[at].c = descending;
+    code_buf[at].d = has_count;
+}
+
+/* Compile INPUT statement */
+void compile_input(void) {
+    skip_whitespace();
+
+    if (*current_pos == '"') {
+        char *prompt = read_string_literal();
+        int len = strlen(prompt);
+        emit(OP_INPUT_PROMPT, pool_add(prompt, len), len);
+
+        skip_whitespace();
+        if (*current_pos == ',') {
+            current_pos++;
+        }
+    }
+
+    while (1) {
+        skip_whitespace();
+        if (!*current_pos || *current_pos == '\n') {
+            break;
+        }
+
+        if (!isalpha(*current_pos)) {
+            emit_error("Expected variable name in INPUT");
+            return;
+        }
+
+        const char *name = current_pos;
+        int len = name_length(name);
+        current_pos += len;
+
+        if (*current_pos == '$') {
+            current_pos++;
+            emit(OP_INPUT_STR, name_slot(&str_names, name, len), 0);
+        } else {
+            skip_whitespace();
+            if (*current_pos == '[' || *current_pos == '(') {
+                int arr = name_slot(&array_names, name, len);
+                char closing = (*current_pos == '[') ? ']' : ')';
+                current_pos++;
+                int count = compile_subscripts(closing);
+                if (count > 1) {
+                    emit_line_exit(OP_CHECK_INDEX_N, arr, count);
+                }
+                emit_line_exit(OP_INPUT_ARRAY, arr, 0);
+            } else {
+                emit_line_exit(OP_INPUT_INT, name_slot(&var_names, name, len), 0);
+            }
+        }
+
+        skip_whitespace();
+        if (*current_pos == ',') {
+            current_pos++;
+        } else {
+            break;
+        }
+    }
+
+    /* Consume trailing newline */
+    emit(OP_INPUT_FLUSH, 0, 0);
+}
+
+/* Parse len characters as a signed decimal number; false if they are not one */
+static bool parse_data_number(const char *text, int len, int *value) {
+    unsigned int n = 0;
+    int i = 0;
+
+    if (len > 0 && (text[0] == '-' || text[0] == '+')) {
+        i++;
+    }
+    if (i == len) {
+        return false;
+    }
+    for (; i < len; i++) {
+        if (!isdigit((unsigned char)text[i])) {
+            return false;
+        }
+        n = n * 10 + (unsigned int)(text[i] - '0');
+    }
+    *value = (int)(text[0] == '-' ? 0u - n : n);
+    return true;
+}
+
+/*
+ * Compile DATA. Each item becomes an OP_DATA carrying a number or a
+ * string in the pool; items are quoted strings, or unquoted text that is
+ * a number if it parses as one.
+ */
+void compile_data(void) {
+    while (1) {
+        skip_whitespace();
+        if (!*current_pos || *current_pos == '\n') {
+            break;
+        }
+
+        if (*current_pos == '"') {
+            char *text = read_string_literal();
+            int len = strlen(text);
+            emit(OP_DATA, pool_add(text, len), len);
+        } else {
+            const char *end = current_pos;
+            int len, value;
+            while (*end && *end != ',' && *end != '\n') {
+                end++;
+            }
+            len = end - current_pos;
+            while (len > 0 && isspace((unsigned char)current_pos[len - 1])) {
+                len--;
+            }
+            if (parse_data_number(current_pos, len, &value)) {
+                emit(OP_DATA, value, -1);
+            } else {
+                emit(OP_DATA, pool_add(current_pos, len), len);
+            }
+            current_pos = (char *)end;
+        }
+
+        skip_whitespace();
+        if (*current_pos == ',') {
+            current_pos++;
+        } else {
+            break;
+        }
+    }
+}
+
+/* Compile READ into variables, array elements and string variables */
+void compile_read(void) {
+    while (1) {
+        skip_whitespace();
+        if (!isalpha(*current_pos)) {
+            emit_error("Expected variable name in READ");
+            return;
+        }
+
+        const char *name = current_pos;
+        int len = name_length(name);
+        current_pos += len;
+
+        if (*current_pos == '$') {
+            current_pos++;
+            emit_line_exit(OP_READ_STR, name_slot(&str_names, name, len), 0);
+        } else {
+            skip_whitespace();
+            if (*current_pos == '[' || *current_pos == '(') {
+                int arr = name_slot(&array_names, name, len);
+                char closing = (*current_pos == '[') ? ']' : ')';
+                current_pos++;
+                int count = compile_subscripts(closing);
+                if (count > 1) {
+                    emit_line_exit(OP_CHECK_INDEX_N, arr, count);
+                }
+                emit_line_exit(OP_READ_ARRAY, arr, 0);
+            } else {
+                emit_line_exit(OP_READ_INT, name_slot(&var_names, name, len), 0);
+            }
+        }
+
+        skip_whitespace();
+        if (*current_pos == ',') {
+            current_pos++;
+        } else {
+            break;
+        }
+    }
+}
+
+/*
+ * Compile RECORD R$, F, line: any of a string variable for the next input
+ * line, an array for its fields, and the line to go to at the end of
+ * input, which otherwise ends the program.
+ */
+void compile_record(void) {
+    int str = -1, arr = -1, end_line = -1;
+    int at;
+
+    while (1) {
+        skip_whitespace();
+        if (!*current_pos || *current_pos == '\n') {
+            break;
+        }
+        if (isdigit((unsigned char)*current_pos)) {
+            end_line = (int)strtol(current_pos, &current_pos, 10);
+        } else if (isalpha((unsigned char)*current_pos)) {
+            const char *name = current_pos;
+            int len = name_length(name);
+            current_pos += len;
+            if (*current_pos == '$') {
+                current_pos++;
+                str = name_slot(&str_names, name, len);
+            } else {
+                arr = name_slot(&array_names, name, len);
+            }
+        } else {
+            emit_error("Expected variable, array or line number in RECORD");
+            return;
+        }
+        skip_whitespace();
+        if (*current_pos == ',') {
+            current_pos++;
+        } else {
+            break;
+        }
+    }
+
+    at = emit(OP_RECORD, str, arr);
+    code_buf[at].c = end_line;
+}
+
+/* Compile RESTORE, or RESTORE line to READ from the first DATA at or after it */
+void compile_restore(void) {
+    int line_number = -1;
+
+    skip_whitespace();
+    if (isdigit((unsigned char)*current_pos)) {
+        line_number = (int)strtol(current_pos, &current_pos, 10);
+    } else if (*current_pos && *current_pos != '\n') {
+        emit_error("Expected line number in RESTORE");
+        return;
+    }
+    emit(OP_RESTORE, line_number, 0);
+}
+
+/* Compile FOR statement */
+void compile_for(void) {
+    skip_whitespace();
+    if (!isalpha(*current_pos)) {
+        emit_error("Expected variable name in FOR");
+        return;
+    }
+    int slot = compile_name(&var_names);
+    skip_whitespace();
+
+    if (*current_pos == '=') {
+        current_pos++;
+    }
+
+    compile_expression();
+    skip_whitespace();
+
+    if (strncasecmp(current_pos, "TO", 2) != 0) {
+        emit(OP_POP_INT, 0, 0);
+        emit_error("Expected TO in FOR");
+        return;
+    }
+    current_pos += 2;
+
+    compile_expression();
+    skip_whitespace();
+
+    if (strncasecmp(current_pos, "STEP", 4) == 0) {
+        current_pos += 4;
+        compile_expression();
+    } else {
+        emit(OP_PUSH_INT, 1, 0);
+    }
+
+    emit(OP_FOR, slot, NEXT_UNRESOLVED);
+}
+
+/* Compile NEXT statement */
+void compile_next(void) {
+    skip_whitespace();
+    if (!isalpha(*current_pos)) {
+        emit_error("Expected variable name in NEXT");
+        return;
+    }
+    emit(OP_NEXT, compile_name(&var_names), 0);
+}
+
+/* Compile GOTO statement */
+void compile_goto(void) {
+    int start = code_len;
+    compile_expression();
+
+    /* Constant targets are resolved to a program index by link_program() */
+    if (code_len == start + 1 && code_buf[start].op == OP_PUSH_INT) {
+        code_len = start;
+        emit(OP_GOTO_LINE, code_buf[start].a, -1);
+        return;
+    }
+    emit(OP_GOTO, 0, 0);
+}
+
+/* Compile IF statement */
+void compile_if(void) {
+    skip_whitespace();
+
+    bool is_string_comp = false;
+
+    char *save_pos = current_pos;
+    if (compile_string_expression(false)) {
+        is_string_comp = true;
+    } else {
+        current_pos = save_pos;
+        compile_expression();
+    }
+
+    skip_whitespace();
+
+    char op[3] = {0};
+    int op_len = 0;
+
+    /* Read comparison operator */
+    if (*current_pos == '=' || *current_pos == '<' || *current_pos == '>') {
+        op[op_len++] = *current_pos++;
+        if (*current_pos == '=' || (*current_pos == '>' && op[0] == '<')) {
+            op[op_len++] = *current_pos++;
+        }
+    }
+
+    int cmp = CMP_NONE;
+    if (strcmp(op, "=") == 0 || strcmp(op, "==") == 0) {
+        cmp = CMP_EQ;
+    } else if (strcmp(op, "<") == 0) {
+        cmp = CMP_LT;
+    } else if (strcmp(op, ">") == 0) {
+        cmp = CMP_GT;
+    } else if (strcmp(op, "<=") == 0) {
+        cmp = CMP_LE;
+    } else if (strcmp(op, ">=") == 0) {
+        cmp = CMP_GE;
+    } else if (strcmp(op, "<>") == 0) {
+        cmp = CMP_NE;
+    }
+
+    if (is_string_comp) {
+        if (!compile_string_expression(false)) {
+            emit_error("Type mismatch in IF");
+            emit(OP_POP_STR, 0, 0);
+            return;
+        }
+        emit(OP_STR_CMP, cmp, 0);
+    } else {
+        compile_expression();
+        emit(OP_CMP, cmp, 0);
+    }
+
+    /* Look for THEN or GOTO */
+    skip_whitespace();
+    if (strncasecmp(current_pos, "THEN", 4) == 0) {
+        current_pos += 4;
+        skip_whitespace();
+    }
+
+    emit_line_exit(OP_JUMP_IF_FALSE, 0, 0);
+    if (at_assignment(current_pos)) {
+        compile_let();
+    } else if (strncasecmp(current_pos, "GOTO", 4) == 0) {
+        current_pos += 4;
+        compile_goto();
+    } else if (strncasecmp(current_pos, "PRINT", 5) == 0) {
+        current_pos += 5;
+        compile_print();
+    } else if (strncasecmp(current_pos, "LET", 3) == 0) {
+        current_pos += 3;
+        compile_let();
+    } else if (isalpha(*current_pos)) {
+        /* Direct assignment without LET */
+        compile_let();
+    }
+}
+
+/* Compile a single statement at current_pos */
+void compile_statement(void) {
+    const Statement *stmt;
+
+    skip_whitespace();
+
+    if (at_assignment(current_pos)) {
+        /* An assignment, even to a name starting with a keyword */
+        compile_let();
+    } else if ((stmt = find_statement(current_pos)) != NULL) {
+        current_pos += strlen(stmt->word);
+        stmt->compile();
+    } else if (*current_pos) {
+        /* Assume it's a LET statement without LET keyword */
+        compile_let();
+    }
+}
+
+/* True for opcodes whose target is relative to their line until linked */
+static bool has_line_target(int op) {
+    return op == OP_JUMP_IF_FALSE || op == OP_CHECK_INDEX || op == OP_CHECK_INDEX_VAR ||
+           op == OP_CHECK_INDEX_N || op == OP_CHECK_FILE ||
+           op == OP_INPUT_INT || op == OP_INPUT_ARRAY || op == OP_READ_INT ||
+           op == OP_READ_ARRAY || op == OP_READ_STR || op == OP_CHECK_INDEX_FAST ||
+           op == OP_CHECK_INDEX_VAR_FAST;
+}
+
+/* Replace common instruction sequences with superinstructions; returns the new length */
+int fuse_superinstructions(Instr *code, int len) {
+    Instr *c = code;
+    int n = len;
+    int i = 0, j = 0;
+
+    while (i < n) {
+        Instr fused = c[i];
+        int used = 1;
+
+        if (c[i].op == OP_LOAD_VAR && i + 3 < n && c[i + 1].op == OP_PUSH_INT &&
+            (c[i + 2].op == OP_ADD || c[i + 2].op == OP_SUB) && c[i + 3].op == OP_STORE_VAR) {
+            /* LET A = B + k */
+            fused.op = OP_INC_VAR;
+            fused.a = c[i + 3].a;
+            fused.b = c[i].a;
+            fused.c = c[i + 2].op == OP_ADD ? c[i + 1].a : (int)(0u - (unsigned int)c[i + 1].a);
+            used = 4;
+        } else if (c[i].op == OP_LOAD_VAR && i + 4 < n &&
+                   (c[i + 1].op == OP_LOAD_VAR || c[i + 1].op == OP_PUSH_INT) &&
+                   c[i + 2].op == OP_CMP && c[i + 3].op == OP_JUMP_IF_FALSE &&
+                   c[i + 4].op == OP_GOTO_LINE) {
+            /* IF A < B THEN GOTO n */
+            fused.op = c[i + 1].op == OP_LOAD_VAR ? OP_IF_GOTO_VV : OP_IF_GOTO_VC;
+            fused.a = c[i].a;
+            fused.b = c[i + 1].a;
+            fused.c = c[i + 2].a;
+            fused.d = c[i + 4].a;
+            fused.target = -1;
+            used = 5;
+        } else if (c[i].op == OP_LOAD_VAR && i + 1 < n && c[i + 1].op == OP_LOAD_ARRAY) {
+            fused.op = OP_LOAD_ARRAY_VAR;
+            fused.a = c[i + 1].a;
+            fused.b = c[i].a;
+            used = 2;
+        } else if (c[i].op == OP_LOAD_VAR && i + 1 < n && c[i + 1].op == OP_CHECK_INDEX &&
+                   c[n - 1].op == OP_STORE_ARRAY) {
+            /* LET A(I) = ...: the index variable is read again by the store */
+            fused = c[i + 1];
+            fused.op = OP_CHECK_INDEX_VAR;
+            fused.b = c[i].a;
+            c[n - 1].op = OP_STORE_ARRAY_VAR;
+            c[n - 1].b = c[i].a;
+            used = 2;
+        } else if (c[i].op == OP_PUSH_INT && i + 1 < n &&
+                   (c[i + 1].op == OP_ADD || c[i + 1].op == OP_SUB)) {
+            fused.op = OP_ADD_CONST;
+            fused.a = c[i + 1].op == OP_ADD ? c[i].a : (int)(0u - (unsigned int)c[i].a);
+            used = 2;
+        }
+
+        c[j++] = fused;
+        i += used;
+    }
+    return j;
+}
+
+/* True if two instruction sequences are identical */
+static bool same_code(const Instr *x, const Instr *y, int len) {
+    int i;
+    for (i = 0; i < len; i++) {
+        if (x[i].op != y[i].op || x[i].a != y[i].a || x[i].b != y[i].b) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/*
+ * Start of the side-effect-free integer expression whose value is pushed by
+ * code[end - 1], or -1 if it is not one. Such expressions cannot fail, so
+ * they may be evaluated once instead of several times.
+ */
+static int expression_start(const Instr *code, int end) {
+    int need = 1;
+    int i = end;
+
+    while (need > 0) {
+        if (--i < 0) {
+            return -1;
+        }
+        switch (code[i].op) {
+            case OP_PUSH_INT:
+            case OP_LOAD_VAR:
+                need--;
+                break;
+            case OP_ADD:
+            case OP_SUB:
+            case OP_MUL:
+            case OP_CMP:
+                need++;
+                break;
+            case OP_ADD_CONST:
+                break;
+            default:
+                return -1;
+        }
+    }
+    return i;
+}
+
+/* Integer variable assigned by an instruction, or -1 */
+static int assigned_variable(const Instr *ip) {
+    switch (ip->op) {
+        case OP_STORE_VAR:
+        case OP_INPUT_INT:
+        case OP_READ_INT:
+        case OP_FOR:
+        case OP_NEXT:
+        case OP_INC_VAR:
+        case OP_TEE_VAR:
+            return ip->a;
+    }
+    return -1;
+}
+
+/*
+ * Common subexpression elimination within a line: the first evaluation of
+ * a repeated expression is kept in a scratch temporary with OP_TEE_VAR and
+ * later ones load it. Only the part of the line before its first
+ * assignment is considered, so the variables read cannot change.
+ */
+static int eliminate_common_subexpressions(Instr *code, int len) {
+    Instr *copy;
+    int temp;
+
+    if (!optimize_enabled) {
+        return len;
+    }
+    copy = (Instr *)malloc(len * sizeof(Instr));
+    if (!copy) {
+        return len;
+    }
+
+    for (temp = MAX_VARS; temp < MAX_VARS + CSE_TEMPS; temp++) {
+        int best_start = -1, best_len = 0;
+        int limit, end, i, j;
+
+        for (limit = 0; limit < len; limit++) {
+            if (code[limit].op != OP_TEE_VAR && assigned_variable(&code[limit]) >= 0) {
+                break;
+            }
+        }
+
+        /* Find the longest expression that appears again later */
+        for (end = 1; end <= limit; end++) {
+            int start = expression_start(code, end);
+            int n = end - start;
+            if (start < 0 || n < 3 || n <= best_len) {
+                continue;
+            }
+            for (i = end; i + n <= limit; i++) {
+                if (same_code(code + start, code + i, n)) {
+                    best_start = start;
+                    best_len = n;
+                    break;
+                }
+            }
+        }
+        if (best_start < 0) {
+            break;
+        }
+
+        /* Keep the first evaluation, load the temporary for the others */
+        memcpy(copy, code, len * sizeof(Instr));
+        j = best_start + best_len;
+        code[j] = copy[best_start];
+        code[j].op = OP_TEE_VAR;
+        code[j].a = temp;
+        code[j].b = 0;
+        j++;
+        for (i = best_start + best_len; i < len; ) {
+            if (i + best_len <= limit && same_code(copy + best_start, copy + i, best_len)) {
+                code[j] = copy[i];
+                code[j].op = OP_LOAD_VAR;
+                code[j].a = temp;
+                code[j].b = 0;
+                i += best_len;
+            } else {
+                code[j] = copy[i++];
+            }
+            j++;
+        }
+        len = j;
+    }
+
+    free(copy);
+    return len;
+}
+
+static int stack_effect(const Instr *ip, bool strings);
+
+/* True if code never holds more than MAX_EVAL_STACK values on either operand stack */
+static bool fits_eval_stack(const Instr *code, int len) {
+    int depth = 0, str_depth = 0;
+    int i;
+
+    for (i = 0; i < len; i++) {
+        depth += stack_effect(&code[i], false);
+        str_depth += stack_effect(&code[i], true);
+        if (depth > MAX_EVAL_STACK || str_depth > MAX_EVAL_STACK) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/*
+ * Compile one line of source text into code_buf and return its length.
+ * Jumps that leave the line target the instruction after its last one.
+ */
+int compile_to_buffer(const char *text) {
+    int i;
+
+    current_pos = (char *)text;
+    code_len = 0;
+    nesting_depth = 0;
+    too_complex = false;
+
+    compile_statement();
+    if (too_complex || !fits_eval_stack(code_buf, code_len)) {
+        code_len = 0;
+        emit_error("Expression too complex");
+    }
+    code_len = eliminate_common_subexpressions(code_buf, code_len);
+    code_len = fuse_superinstructions(code_buf, code_len);
+
+    for (i = 0; i < code_len; i++) {
+        if (code_buf[i].target == TARGET_LINE_END && has_line_target(code_buf[i].op)) {
+            code_buf[i].target = code_len;
+        }
+    }
+    return code_len;
+}
+
+/*
+ * Compile one line of source text to bytecode. The code is returned in a
+ * freshly allocated array (NULL for an empty line) and its length returned.
+ */
+int compile_line(const char *text, Instr **code) {
+    compile_to_buffer(text);
+
+    *code = NULL;
+    if (code_len > 0) {
+        *code = (Instr *)malloc(code_len * sizeof(Instr));
+        if (!*code) {
+            fprintf(stderr, "Error: Memory allocation failed\n");
+            return 0;
+        }
+        memcpy(*code, code_buf, code_len * sizeof(Instr));
+    }
+    return code_len;
+}
+
+/*
+ * Allocate from an arena. Chunks come zeroed from the system; a large
+ * block gets a chunk of its own behind the current one, which keeps
+ * serving small blocks.
+ */
+void *arena_alloc(Arena *arena, size_t size) {
+    ArenaChunk *chunk = arena->chunks;
+
+    size = (size + 7) & ~(size_t)7;
+    if (!chunk || chunk->size - chunk->used < size) {
+        bool large = size > ARENA_CHUNK / 4;
+        size_t chunk_size = large ? size : ARENA_CHUNK;
+        ArenaChunk *fresh = (ArenaChunk *)calloc(1, sizeof(ArenaChunk) + chunk_size);
+        if (!fresh) {
+            return NULL;
+        }
+        fresh->size = chunk_size;
+        fresh->used = 0;
+        if (large && chunk) {
+            fresh->next = chunk->next;
+            chunk->next = fresh;
+        } else {
+            fresh->next = chunk;
+            arena->chunks = fresh;
+        }
+        arena->chunk_allocations++;
+        chunk = fresh;
+    }
+    arena->allocations++;
+    arena->bytes += size;
+    chunk->used += size;
+    return chunk->data + chunk->used - size;
+}
+
+/*
+ * Free everything allocated from an arena. With keep_chunk, the most
+ * recent chunk is kept for reuse, as temp_arena is reset very often.
+ */
+void arena_reset(Arena *arena, bool keep_chunk) {
+    ArenaChunk *chunk = arena->chunks;
+
+    if (keep_chunk && chunk) {
+        chunk->used = 0;
+        chunk = chunk->next;
+        arena->chunks->next = NULL;
+    } else {
+        arena->chunks = NULL;
+    }
+    while (chunk) {
+        ArenaChunk *next = chunk->next;
+        free(chunk);
+        chunk = next;
+    }
+    if (arena == &value_arena) {
+        memset(free_strings, 0, sizeof(free_strings));
+    }
+}
+
+/* Report what the interpreter has allocated so far, for MEMORY */
+void print_memory_stats(void) {
+    long long elements = 0, keys = 0;
+    size_t mapped = 0, map_bytes = 0;
+    int i;
+
+    for (i = 0; i < MAX_ARRAYS; i++) {
+        elements += arrays[i].size;
+        if (arrays[i].mapped) {
+            mapped += (size_t)arrays[i].capacity * sizeof(int);
+        }
+    }
+    for (i = 0; i < MAX_MAPS; i++) {
+        if (maps[i].entries) {
+            keys += maps[i].count;
+            map_bytes += ((size_t)maps[i].mask + 1) * sizeof(MapEntry) + maps[i].keys_cap;
+        }
+    }
+    printf("Temporaries: %ld allocations, %zu bytes, %ld chunks\n",
+           temp_arena.allocations, temp_arena.bytes, temp_arena.chunk_allocations);
+    printf("Values: %ld allocations, %zu bytes, %ld chunks, %ld string buffers reused\n",
+           value_arena.allocations, value_arena.bytes, value_arena.chunk_allocations, strings_reused);
+    printf("Arrays: %lld elements, %zu bytes mapped\n", elements, mapped);
+    printf("Maps: %lld keys, %zu bytes\n", keys, map_bytes);
+}
+
+/* A string buffer with room for len bytes, reused from a free list if possible */
+static StrBuf *alloc_string_buffer(int len) {
+    size_t size = sizeof(StrBuf) + len;
+    int size_class = 0;
+    StrBuf *buf;
+
+    while (size_class < STR_CLASSES && ((size_t)32 << size_class) < size) {
+        size_class++;
+    }
+    if (size_class == STR_CLASSES) {
+        buf = (StrBuf *)malloc(size);
+        size_class = -1;
+        value_arena.allocations++;
+        value_arena.bytes += size;
+    } else if (free_strings[size_class]) {
+        buf = free_strings[size_class];
+        free_strings[size_class] = buf->next_free;
+        strings_reused++;
+    } else {
+        buf = (StrBuf *)arena_alloc(&value_arena, (size_t)32 << size_class);
+    }
+    if (buf) {
+        buf->refs = 1;
+        buf->size_class = size_class;
+        buf->capacity = size_class < 0 ? len : (int)(((size_t)32 << size_class) - sizeof(StrBuf));
+        buf->used = len;
+    }
+    return buf;
+}
+
+/* Drop a reference to a string, leaving it empty */
+void release_string(StrValue *s) {
+    StrBuf *buf = s->buf;
+
+    if (buf && --buf->refs == 0) {
+        if (buf->size_class < 0) {
+            free(buf);
+        } else {
+            buf->next_free = free_strings[buf->size_class];
+            free_strings[buf->size_class] = buf;
+        }
+    }
+    s->text = NULL;
+    s->len = 0;
+    s->buf = NULL;
+}
+
+static inline const char *string_text(const StrValue *s) {
+    return s->text ? s->text : s->small;
+}
+
+/* A string holding its own copy of len bytes of text */
+static StrValue new_string(const char *text, int len) {
+    StrValue s;
+
+    s.text = NULL;
+    s.len = len;
+    s.buf = NULL;
+    if (len > STR_SMALL) {
+        s.buf = alloc_string_buffer(len);
+        if (!s.buf) {
+            fprintf(stderr, "Error: Memory allocation failed\n");
+            s.len = 0;
+            return s;
+        }
+        s.text = s.buf->text;
+    }
+    memcpy(s.buf ? s.buf->text : s.small, text, len);
+    return s;
+}
+
+/* A string borrowing text that outlives it */
+static inline StrValue borrow_string(const char *text, int len) {
+    StrValue s;
+    s.text = text;
+    s.len = len;
+    s.buf = NULL;
+    return s;
+}
+
+/* Another reference to the text of a string */
+static inline StrValue share_string(const StrValue *s) {
+    StrValue r = *s;
+    if (r.buf) {
+        r.buf->refs++;
+    }
+    return r;
+}
+
+/*
+ * Make a string independent of the string pool before it is stored in a
+ * variable. Short views of a buffer move inline so they do not keep a
+ * large buffer alive.
+ */
+static StrValue own_string(StrValue s) {
+    if (s.text && (!s.buf || s.len <= STR_SMALL)) {
+        StrValue r = new_string(s.text, s.len);
+        release_string(&s);
+        return r;
+    }
+    return s;
+}
+
+/* Keep n bytes of a string starting at offset */
+static inline void slice_string(StrValue *s, int offset, int n) {
+    if (s->text) {
+        s->text += offset;
+    } else if (offset > 0) {
+        memmove(s->small, s->small + offset, n);
+    }
+    s->len = n;
+}
+
+/*
+ * Extend the last block allocated from an arena from old_size to
+ * new_size bytes, if the chunk has room.
+ */
+static bool arena_extend(Arena *arena, const char *block, size_t old_size, size_t new_size) {
+    ArenaChunk *chunk = arena->chunks;
+
+    old_size = (old_size + 7) & ~(size_t)7;
+    new_size = (new_size + 7) & ~(size_t)7;
+    if (!chunk || chunk->used < old_size || block != chunk->data + chunk->used - old_size ||
+        chunk->size - chunk->used < new_size - old_size) {
+        return false;
+    }
+    chunk->used += new_size - old_size;
+    arena->bytes += new_size - old_size;
+    return true;
+}
+
+/*
+ * Append right to left, releasing right. When left is the last text in a
+ * buffer with room to spare, or the last block of temp_arena, the text is
+ * appended in place; otherwise a stored result gets a buffer with room to
+ * double, so building a string by repeated appends costs amortized O(1)
+ * per append, while a transient result is copied into temp_arena.
+ */
+static void concat_strings(StrValue *left, StrValue *right, bool transient) {
+    StrBuf *buf = left->buf;
+    int len;
+    char *text;
+
+    if (left->len > INT_MAX / 2 - right->len) {
+        fprintf(stderr, "Error: String too long\n");
+        release_string(right);
+        return;
+    }
+    len = left->len + right->len;
+
+    if (len <= STR_SMALL) {
+        char joined[STR_SMALL];
+        memcpy(joined, string_text(left), left->len);
+        memcpy(joined + left->len, string_text(right), right->len);
+        release_string(left);
+        *left = new_string(joined, len);
+    } else if (buf && left->text + left->len == buf->text + buf->used && buf->capacity - buf->used >= right->len) {
+        memcpy(buf->text + buf->used, string_text(right), right->len);
+        buf->used += right->len;
+        left->len = len;
+    } else if (transient && !buf && left->text && arena_extend(&temp_arena, left->text, left->len, len)) {
+        memcpy((char *)left->text + left->len, string_text(right), right->len);
+        left->len = len;
+    } else {
+        StrBuf *grown = NULL;
+        if (transient) {
+            text = (char *)arena_alloc(&temp_arena, len);
+        } else {
+            grown = alloc_string_buffer(len * 2);
+            text = grown ? grown->text : NULL;
+        }
+        if (!text) {
+            fprintf(stderr, "Error: Memory allocation failed\n");
+            release_string(right);
+            return;
+        }
+        memcpy(text, string_text(left), left->len);
+        memcpy(text + left->len, string_text(right), right->len);
+        release_string(left);
+        if (grown) {
+            grown->used = len;
+        }
+        left->text = text;
+        left->len = len;
+        left->buf = grown;
+    }
+    release_string(right);
+}
+
+/* strcmp() ordering of two strings */
+static int compare_strings(const StrValue *a, const StrValue *b) {
+    int n = a->len < b->len ? a->len : b->len;
+    int c = memcmp(string_text(a), string_text(b), n);
+    if (c != 0 || a->len == b->len) {
+        return c;
+    }
+    return a->len < b->len ? -1 : 1;
+}
+
+/* Needles of 2 to 16 bytes: test the first and last byte of 16 positions at once */
+static int search_short(const char *h, int hlen, const char *n, int nlen) {
+    int last = hlen - nlen;
+    int i = 0;
+
+#if HAVE_SSE2
+    __m128i first = _mm_set1_epi8(n[0]);
+    __m128i final = _mm_set1_epi8(n[nlen - 1]);
+    for (; i + 15 <= last; i += 16) {
+        __m128i a = _mm_loadu_si128((const __m128i *)(h + i));
+        __m128i b = _mm_loadu_si128((const __m128i *)(h + i + nlen - 1));
+        unsigned mask = (unsigned)_mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(a, first),
+                                                                  _mm_cmpeq_epi8(b, final)));
+        while (mask) {
+            int bit = __builtin_ctz(mask);
+            if (memcmp(h + i + bit + 1, n + 1, nlen - 2) == 0) {
+                return i + bit;
+            }
+            mask &= mask - 1;
+        }
+    }
+#endif
+    while (i <= last) {
+        const char *p = (const char *)memchr(h + i, n[0], last - i + 1);
+        if (!p) {
+            break;
+        }
+        i = (int)(p - h);
+        if (memcmp(p + 1, n + 1, nlen - 1) == 0) {
+            return i;
+        }
+        i++;
+    }
+    return -1;
+}
+
+static void build_skip_table(const char *n, int nlen, int *skip) {
+    int i;
+
+    for (i = 0; i < 256; i++) {
+        skip[i] = nlen;
+    }
+    for (i = 0; i < nlen - 1; i++) {
+        skip[(unsigned char)n[i]] = nlen - 1 - i;
+    }
+}
+
+/* Longer needles: Boyer-Moore-Horspool, with the skip table from skip_cache */
+static int search_long(const char *h, int hlen, const char *n, int nlen) {
+    int scratch[256];
+    const int *skip = scratch;
+    unsigned char final = (unsigned char)n[nlen - 1];
+    int last = hlen - nlen;
+    int i = 0;
+
+    if (nlen <= SKIP_CACHE_NEEDLE) {
+        SkipTable *table = &skip_cache[(nlen * 31 + (unsigned char)n[0] * 7 + final) % SKIP_CACHE_SIZE];
+        if (table->len != nlen || memcmp(table->needle, n, nlen) != 0) {
+            table->len = nlen;
+            memcpy(table->needle, n, nlen);
+            build_skip_table(n, nlen, table->skip);
+        }
+        skip = table->skip;
+    } else {
+        build_skip_table(n, nlen, scratch);
+    }
+
+    while (i <= last) {
+        unsigned char c = (unsigned char)h[i + nlen - 1];
+        if (c == final && memcmp(h + i, n, nlen - 1) == 0) {
+            return i;
+        }
+        i += skip[c];
+    }
+    return -1;
+}
+
+/* Offset of the first occurrence of n in h, or -1 */
+static int search_text(const char *h, int hlen, const char *n, int nlen) {
+    if (nlen > hlen) {
+        return -1;
+    }
+    if (nlen == 0) {
+        return 0;
+    }
+    if (nlen == 1) {
+        const char *p = (const char *)memchr(h, n[0], hlen);
+        return p ? (int)(p - h) : -1;
+    }
+    if (nlen <= 16) {
+        return search_short(h, hlen, n, nlen);
+    }
+    return search_long(h, hlen, n, nlen);
+}
+
+/* Position of needle in haystack counting from 1, searching from start, or 0 */
+static int find_string(const StrValue *haystack, const StrValue *needle, int start) {
+    int offset;
+
+    if (start < 1) {
+        start = 1;
+    }
+    if (start > haystack->len + 1) {
+        return 0;
+    }
+    offset = search_text(string_text(haystack) + (start - 1), haystack->len - (start - 1),
+                         string_text(needle), needle->len);
+    return offset < 0 ? 0 : offset + start;
+}
+
+/* Check that an array is dimensioned and the index is in range */
+static inline bool check_array_index(int arr_idx, int index) {
+    if (!arrays[arr_idx].allocated) {
+        fprintf(stderr, "Error: Array %s not dimensioned\n", array_names.names[arr_idx]);
+        return false;
+    }
+    if (index < 0 || index >= arrays[arr_idx].size) {
+        fprintf(stderr, "Error: Array index %d out of bounds for %s\n", index, array_names.names[arr_idx]);
+        return false;
+    }
+    return true;
+}
+
+/* Report why count indices do not name an element of an array; returns -1 */
+static long long element_error(int arr_idx, const int *index, int count) {
+    const Array *array = &arrays[arr_idx];
+    int k;
+
+    if (!array->allocated) {
+        fprintf(stderr, "Error: Array %s not dimensioned\n", array_names.names[arr_idx]);
+    } else if (count != array->dims) {
+        fprintf(stderr, "Error: Array %s has %d dimensions\n", array_names.names[arr_idx], array->dims);
+    } else {
+        for (k = 0; index[k] >= 0 && index[k] < array->extent[k]; k++)
+            ;
+        fprintf(stderr, "Error: Array index %d out of bounds for %s\n", index[k], array_names.names[arr_idx]);
+    }
+    return -1;
+}
+
+/*
+ * Offset of the element at count indices, each checked against its own
+ * extent, or -1 after an error. An array that is not dimensioned has no
+ * dimensions, so one compare rules it out too. A single index addresses
+ * the flat buffer of an array of any shape.
+ */
+static inline long long element_offset(int arr_idx, const int *index, int count) {
+    const Array *array = &arrays[arr_idx];
+    long long offset = 0;
+    int k;
+
+    if (count != array->dims) {
+        return element_error(arr_idx, index, count);
+    }
+    for (k = 0; k < count; k++) {
+        if ((unsigned long long)(long long)index[k] >= (unsigned long long)array->extent[k]) {
+            return element_error(arr_idx, index, count);
+        }
+        offset += index[k] * array->stride[k];
+    }
+    return offset;
+}
+
+/* Hand a channel's buffered text to stdio */
+void flush_output(OutputChannel *out) {
+    if (out->len > 0) {
+        fwrite(out->data, 1, out->len, out->fp);
+        out->len = 0;
+        fflush(out->fp);
+    }
+}
+
+/* Flush and close every file opened for PRINT # */
+void close_files(void) {
+    int i;
+
+    for (i = 1; i <= MAX_FILES; i++) {
+        if (channels[i].fp) {
+            flush_output(&channels[i]);
+            fclose(channels[i].fp);
+            channels[i].fp = NULL;
+        }
+    }
+}
+
+/* Open a file for PRINT #file, replacing or appending to its contents */
+void execute_open(int file, bool append, const char *path, int len) {
+    OutputChannel *out = &channels[file];
+    char *name;
+
+    if (out->fp) {
+        fprintf(stderr, "Error: File #%d already open\n", file);
+        return;
+    }
+    name = (char *)malloc(len + 1);
+    if (!out->data) {
+        out->data = (char *)malloc(OUTPUT_BUFFER_SIZE);
+    }
+    if (!name || !out->data) {
+        fprintf(stderr, "Error: Memory allocation failed\n");
+        exit(1);
+    }
+    memcpy(name, path, len);
+    name[len] = '\0';
+    out->fp = fopen(name, append ? "a" : "w");
+    if (!out->fp) {
+        fprintf(stderr, "Error: Cannot open file %s for writing\n", name);
+    }
+    out->len = 0;
+    free(name);
+}
+
+/* CLOSE #file, or every file if file is 0 */
+void execute_close(int file) {
+    if (file == 0) {
+        close_files();
+    } else if (!channels[file].fp) {
+        fprintf(stderr, "Error: File #%d not open\n", file);
+    } else {
+        flush_output(&channels[file]);
+        fclose(channels[file].fp);
+        channels[file].fp = NULL;
+    }
+}
+
+/* Append len bytes of text to a channel */
+static inline void output_text(OutputChannel *out, const char *text, int len) {
+    if (out->len + len > OUTPUT_BUFFER_SIZE) {
+        flush_output(out);
+        if (len > OUTPUT_BUFFER_SIZE) {
+            fwrite(text, 1, len, out->fp);
+            return;
+        }
+    }
+    memcpy(out->data + out->len, text, len);
+    out->len += len;
+}
+
+/* Append a character; a newline ends the line on a terminal */
+static inline void output_char(OutputChannel *out, char c) {
+    if (out->len == OUTPUT_BUFFER_SIZE) {
+        flush_output(out);
+    }
+    out->data[out->len++] = c;
+    if (c == '\n' && out->line_flush) {
+        flush_output(out);
+    }
+}
+
+/*
+ * Append an integer in decimal. Digits are produced two at a time from a
+ * table, right to left, so a number costs a few divisions by 100 rather
+ * than a printf format.
+ */
+static inline void output_int(OutputChannel *out, int value) {
+    static const char digit_pairs[] =
+        "00010203040506070809101112131415161718192021222324252627282930313233343536373839"
+        "40414243444546474849505152535455565758596061626364656667686970717273747576777879"
+        "8081828384858687888990919293949596979899";
+    char digits[12];
+    char *p = digits + sizeof(digits);
+    unsigned int n = value < 0 ? 0u - (unsigned int)value : (unsigned int)value;
+
+    while (n >= 100) {
+        unsigned int pair = n % 100;
+        n /= 100;
+        p -= 2;
+        memcpy(p, digit_pairs + 2 * pair, 2);
+    }
+    if (n >= 10) {
+        p -= 2;
+        memcpy(p, digit_pairs + 2 * n, 2);
+    } else {
+        *--p = (char)('0' + n);
+    }
+    if (value < 0) {
+        *--p = '-';
+    }
+    output_text(out, p, (int)(digits + sizeof(digits) - p));
+}
+
+/*
+ * Read more input after the unread part of the buffer, which is moved to
+ * the front; false at the end of input or if the buffer is full. PRINT
+ * output is flushed first, since the program may be about to wait for a
+ * reply.
+ */
+static bool fill_input(void) {
+    InputBuffer *in = &input_buffer;
+    int kept = in->len - in->pos;
+    int n;
+
+    if (in->eof || kept >= in->capacity - 1) {
+        return false;
+    }
+    flush_output(&channels[0]);
+    fflush(stdout);
+    memmove(in->data, in->data + in->pos, kept);
+#if HAVE_POSIX_IO
+    n = (int)read(fileno(stdin), in->data + kept, in->capacity - kept);
+#else
+    n = fgets(in->data + kept, in->capacity - kept, stdin) ? (int)strlen(in->data + kept) : 0;
+#endif
+    in->pos = 0;
+    in->len = kept + (n > 0 ? n : 0);
+    in->eof = n <= 0;
+    return n > 0;
+}
+
+/* Next input character without consuming it, or EOF */
+static inline int peek_input(void) {
+    if (input_buffer.pos == input_buffer.len && !fill_input()) {
+        return EOF;
+    }
+    return (unsigned char)input_buffer.data[input_buffer.pos];
+}
+
+/* Skip spaces and line breaks; returns the next character or EOF */
+static inline int skip_input_space(void) {
+    int c;
+    while ((c = peek_input()) != EOF && isspace(c)) {
+        input_buffer.pos++;
+    }
+    return c;
+}
+
+/*
+ * Parse a decimal integer with an optional sign, like scanf("%d") but
+ * straight from the buffer. Digits accumulate unsigned, so a value out of
+ * range wraps. False if no digit follows.
+ */
+static inline bool input_int(int *target) {
+    InputBuffer *in = &input_buffer;
+    unsigned int n = 0;
+    bool negative = false, digits = false;
+    int c = skip_input_space();
+
+    if (c == '-' || c == '+') {
+        negative = c == '-';
+        in->pos++;
+    }
+    do {
+        const char *p = in->data + in->pos, *end = in->data + in->len;
+        while (p < end && (unsigned char)(*p - '0') < 10) {
+            n = n * 10 + (unsigned int)(*p++ - '0');
+            digits = true;
+        }
+        in->pos = (int)(p - in->data);
+        if (p < end) {
+            break;
+        }
+    } while (fill_input());
+
+    if (digits) {
+        *target = (int)(negative ? 0u - n : n);
+    }
+    return digits;
+}
+
+/* Read a word of up to size - 1 characters, like scanf("%s"); -1 at the end of input */
+static inline int input_word(char *word, int size) {
+    int len = 0;
+    int c = skip_input_space();
+
+    if (c == EOF) {
+        return -1;
+    }
+    while (c != EOF && !isspace(c) && len < size - 1) {
+        word[len++] = (char)c;
+        input_buffer.pos++;
+        c = peek_input();
+    }
+    word[len] = '\0';
+    return len;
+}
+
+/* Discard input up to and including the next newline */
+static void skip_input_line(void) {
+    InputBuffer *in = &input_buffer;
+
+    do {
+        const char *newline = (const char *)memchr(in->data + in->pos, '\n', in->len - in->pos);
+        if (newline) {
+            in->pos = (int)(newline - in->data) + 1;
+            return;
+        }
+        in->pos = in->len;
+    } while (fill_input());
+}
+
+/* Double the input buffer when it is full; false if it cannot grow */
+static bool grow_input(void) {
+    InputBuffer *in = &input_buffer;
+    char *grown;
+
+    if (in->eof || in->len - in->pos < in->capacity - 1 || in->capacity > INT_MAX / 2) {
+        return false;
+    }
+    if (in->data == input_block) {
+        grown = (char *)malloc((size_t)in->capacity * 2);
+        if (grown) {
+            memcpy(grown, in->data, in->len);
+        }
+    } else {
+        grown = (char *)realloc(in->data, (size_t)in->capacity * 2);
+    }
+    if (!grown) {
+        fprintf(stderr, "Error: Memory allocation failed\n");
+        return false;
+    }
+    in->data = grown;
+    in->capacity *= 2;
+    return true;
+}
+
+/*
+ * Take the next input line as a record for RECORD. The record is not
+ * copied: *text points at it in the buffer, *len bytes long without its
+ * line ending, until input is next read. The buffer grows to hold a line
+ * longer than it. False at the end of input.
+ */
+static bool next_record(const char **text, int *len) {
+    InputBuffer *in = &input_buffer;
+    const char *start, *newline;
+    int searched = 0, n;
+
+    do {
+        /* Only the text read since the last search can hold the newline */
+        start = in->data + in->pos;
+        newline = (const char *)memchr(start + searched, '\n', in->len - in->pos - searched);
+        if (newline) {
+            n = (int)(newline - start);
+            in->pos += n + 1;
+            break;
+        }
+        searched = in->len - in->pos;
+    } while (fill_input() || (grow_input() && fill_input()));
+
+    if (!newline) {
+        start = in->data + in->pos;
+        n = in->len - in->pos;
+        if (n == 0) {
+            return false;
+        }
+        in->pos = in->len;
+    }
+    if (n > 0 && start[n - 1] == '\r') {
+        n--;
+    }
+    *text = start;
+    *len = n;
+    return true;
+}
+
+/*
+ * Split a record into fields separated by spaces, tabs or a comma, and
+ * store their numeric values in F(1), F(2), ... with the count in F(0).
+ * A field that is not a number counts as its leading digits, or 0, as do
+ * fields the record does not have. The array is declared or grown as
+ * needed, and must have one dimension.
+ */
+static void split_record(int arr_idx, const char *text, int len) {
+    Array *array = &arrays[arr_idx];
+    const char *p = text, *end = text + len;
+    int count = 0;
+
+    if (array->allocated && array->dims > 1) {
+        fprintf(stderr, "Error: RECORD needs a one-dimensional array, not %s\n", array_names.names[arr_idx]);
+        return;
+    }
+    while (1) {
+        while (p < end && (*p == ' ' || *p == '\t')) {
+            p++;
+        }
+        if (p == end) {
+            break;
+        }
+        count++;
+        if (count >= array->size) {
+            int extent = array->size < 8 ? 16 : (int)array->size * 2;
+            execute_redim(arr_idx, &extent, 1);
+            if (count >= array->size) {
+                count--;
+                break;
+            }
+        }
+
+        unsigned int n = 0;
+        bool negative = *p == '-';
+        if (*p == '-' || *p == '+') {
+            p++;
+        }
+        while (p < end && (unsigned char)(*p - '0') < 10) {
+            n = n * 10 + (unsigned int)(*p++ - '0');
+        }
+        array->data[count] = (int)(negative ? 0u - n : n);
+
+        while (p < end && *p != ' ' && *p != '\t' && *p != ',') {
+            p++;
+        }
+        while (p < end && (*p == ' ' || *p == '\t')) {
+            p++;
+        }
+        if (p < end && *p == ',') {
+            p++;
+        }
+    }
+    if (!array->allocated) {
+        int extent = 16;
+        execute_redim(arr_idx, &extent, 1);
+    }
+    if (array->allocated) {
+        /* Clear the fields the previous record had beyond this one's */
+        for (long long i = count + 1; i <= array->data[0] && i < array->size; i++) {
+            array->data[i] = 0;
+        }
+        array->data[0] = count;
+    }
+}
+
+/*
+ * Read a line, newline included, into *line, which is grown to any
+ * length and has *cap bytes; false at the end of input.
+ */
+bool read_input_line(char **line, int *cap) {
+    InputBuffer *in = &input_buffer;
+    int len = 0;
+
+    while (in->pos < in->len || fill_input()) {
+        const char *start = in->data + in->pos;
+        int n = in->len - in->pos;
+        const char *newline = (const char *)memchr(start, '\n', n);
+        if (newline) {
+            n = (int)(newline - start) + 1;
+        }
+        if (len + n + 1 > *cap) {
+            int new_cap = *cap ? *cap : 256;
+            while (new_cap < len + n + 1) {
+                new_cap *= 2;
+            }
+            char *grown = (char *)realloc(*line, new_cap);
+            if (!grown) {
+                fprintf(stderr, "Error: Memory allocation failed\n");
+                exit(1);
+            }
+            *line = grown;
+            *cap = new_cap;
+        }
+        memcpy(*line + len, start, n);
+        len += n;
+        in->pos += n;
+        if (newline) {
+            break;
+        }
+    }
+    if (len > 0) {
+        (*line)[len] = '\0';
+    }
+    return len > 0;
+}
+
+/* Resolve the handler label of each instruction for threaded dispatch */
+void thread_code(Instr *code, int len) {
+#if USE_THREADED_CODE
+    int i;
+
+    if (!threaded_labels) {
+        execute_code(NULL);
+    }
+    for (i = 0; i < len; i++) {
+        code[i].handler = threaded_labels[code[i].op];
+    }
+#else
+    (void)code;
+    (void)len;
+#endif
+}
+
+/*
+ * Execute compiled code until OP_HALT or END. The linked program runs as
+ * one piece of code; direct-mode statements run from their own buffer and
+ * ignore the control transfers of FOR and NEXT. With threaded dispatch,
+ * calling this with NULL publishes the handler labels to thread_code().
+ */
+void execute_code(Instr *code) {
+    int stack[MAX_EVAL_STACK];
+    StrValue str_stack[MAX_EVAL_STACK];
+    int *sp = stack - 1;
+    StrValue *ssp = str_stack - 1;
+    const Instr *pc = code;
+    const Instr *ip;
+    bool direct = (code != linked_code);
+
+/* Temporaries die with the last string a statement holds */
+#define RELEASE_TEMPORARIES() \
+    do { \
+        if (ssp < str_stack && temp_arena.chunks && temp_arena.chunks->used) { \
+            arena_reset(&temp_arena, true); \
+        } \
+    } while (0)
+
+#if USE_THREADED_CODE
+#define HANDLER_LABEL(op) &&do_##op,
+    static const void *const labels[OPCODE_COUNT] = { OPCODE_LIST(HANDLER_LABEL) };
+#undef HANDLER_LABEL
+#define VM_CASE(op) do_##op:
+#define VM_DISPATCH() do { ip = pc++; goto *ip->handler; } while (0)
+#define VM_EXECUTE(instr) do { ip = (instr); goto *ip->handler; } while (0)
+
+    if (!code) {
+        threaded_labels = labels;
+        return;
+    }
+    VM_DISPATCH();
+#else
+#define VM_CASE(op) case op:
+#define VM_DISPATCH() goto dispatch
+#define VM_EXECUTE(instr) do { ip = (instr); goto execute; } while (0)
+
+dispatch:
+    ip = pc++;
+execute:
+    switch (ip->op) {
+#endif
+
+    VM_CASE(OP_PUSH_INT)
+        *++sp = ip->a;
+        VM_DISPATCH();
+    VM_CASE(OP_LOAD_VAR)
+        *++sp = variables[ip->a];
+        VM_DISPATCH();
+    VM_CASE(OP_LOAD_ARRAY)
+        *sp = check_array_index(ip->a, *sp) ? arrays[ip->a].data[*sp] : 0;
+        VM_DISPATCH();
+    VM_CASE(OP_ADD)
+        sp--;
+        sp[0] += sp[1];
+        VM_DISPATCH();
+    VM_CASE(OP_SUB)
+        sp--;
+        sp[0] -= sp[1];
+        VM_DISPATCH();
+    VM_CASE(OP_MUL)
+        sp--;
+        sp[0] *= sp[1];
+        VM_DISPATCH();
+    VM_CASE(OP_DIV)
+        sp--;
+        if (sp[1] != 0) {
+            sp[0] /= sp[1];
+        } else {
+            fprintf(stderr, "Error: Division by zero\n");
+        }
+        VM_DISPATCH();
+    VM_CASE(OP_POP_INT)
+        sp--;
+        VM_DISPATCH();
+    VM_CASE(OP_INSTR) {
+        int start = ip->a ? *sp-- : 1;
+        ssp -= 2;
+        *++sp = find_string(&ssp[1], &ssp[2], start);
+        release_string(&ssp[1]);
+        release_string(&ssp[2]);
+        RELEASE_TEMPORARIES();
+        VM_DISPATCH();
+    }
+    VM_CASE(OP_PUSH_STR)
+        *++ssp = borrow_string(string_pool + ip->a, ip->b);
+        VM_DISPATCH();
+    VM_CASE(OP_LOAD_STR)
+        *++ssp = share_string(&string_variables[ip->a]);
+        VM_DISPATCH();
+    VM_CASE(OP_LEFT)
+    VM_CASE(OP_RIGHT) {
+        int n = *sp--;
+        int len = ssp->len;
+        if (n < 0) n = 0;
+        if (n > len) n = len;
+        slice_string(ssp, ip->op == OP_LEFT ? 0 : len - n, n);
+        VM_DISPATCH();
+    }
+    VM_CASE(OP_MID) {
+        int n = *sp--;
+        int start = *sp--;
+        int len = ssp->len;
+        if (start < 1) start = 1;
+        if (start > len) {
+            slice_string(ssp, 0, 0);
+        } else {
+            int available = len - (start - 1);
+            if (n < 0) n = 0;
+            if (n > available) n = available;
+            slice_string(ssp, start - 1, n);
+        }
+        VM_DISPATCH();
+    }
+    VM_CASE(OP_CONCAT)
+        ssp--;
+        concat_strings(ssp, ssp + 1, ip->a);
+        VM_DISPATCH();
+    VM_CASE(OP_POP_STR)
+        release_string(ssp--);
+        RELEASE_TEMPORARIES();
+        VM_DISPATCH();
+    VM_CASE(OP_CMP)
+        sp--;
+        sp[0] = compare_values(ip->a, sp[0], sp[1]);
+        VM_DISPATCH();
+    VM_CASE(OP_STR_CMP)
+        ssp -= 2;
+        *++sp = compare_values(ip->a, compare_strings(&ssp[1], &ssp[2]), 0);
+        release_string(&ssp[1]);
+        release_string(&ssp[2]);
+        RELEASE_TEMPORARIES();
+        VM_DISPATCH();
+    VM_CASE(OP_JUMP_IF_FALSE)
+        if (!*sp--) {
+            pc = code + ip->target;
+        }
+        VM_DISPATCH();
+    VM_CASE(OP_PRINT_INT)
+        output_int(&channels[ip->a], *sp--);
+        VM_DISPATCH();
+    VM_CASE(OP_PRINT_STR)
+        output_text(&channels[ip->a], string_text(ssp), ssp->len);
+        release_string(ssp--);
+        RELEASE_TEMPORARIES();
+        VM_DISPATCH();
+    VM_CASE(OP_PRINT_SPACE)
+        output_char(&channels[ip->a], ' ');
+        VM_DISPATCH();
+    VM_CASE(OP_PRINT_NEWLINE)
+        output_char(&channels[ip->a], '\n');
+        VM_DISPATCH();
+    VM_CASE(OP_STORE_VAR)
+        variables[ip->a] = *sp--;
+        VM_DISPATCH();
+    VM_CASE(OP_STORE_STR) {
+        StrValue value = own_string(*ssp--);
+        release_string(&string_variables[ip->a]);
+        string_variables[ip->a] = value;
+        RELEASE_TEMPORARIES();
+        VM_DISPATCH();
+    }
+    VM_CASE(OP_STORE_STR_EMPTY)
+        release_string(&string_variables[ip->a]);
+        VM_DISPATCH();
+    VM_CASE(OP_CHECK_INDEX)
+        if (!check_array_index(ip->a, *sp)) {
+            sp--;
+            pc = code + ip->target;
+        }
+        VM_DISPATCH();
+    VM_CASE(OP_STORE_ARRAY)
+        sp -= 2;
+        arrays[ip->a].data[sp[1]] = sp[2];
+        VM_DISPATCH();
+    VM_CASE(OP_LOAD_ARRAY_N) {
+        long long offset;
+        sp -= ip->b - 1;
+        offset = element_offset(ip->a, sp, ip->b);
+        *sp = offset >= 0 ? arrays[ip->a].data[offset] : 0;
+        VM_DISPATCH();
+    }
+    VM_CASE(OP_CHECK_INDEX_N) {
+        long long offset;
+        sp -= ip->b - 1;
+        offset = element_offset(ip->a, sp, ip->b);
+        if (offset >= 0) {
+            *sp = (int)offset;
+        } else {
+            sp--;
+            pc = code + ip->target;
+        }
+        VM_DISPATCH();
+    }
+    VM_CASE(OP_GOTO) {
+        int line_num = *sp--;
+        int index = find_line(line_num);
+        if (index >= 0) {
+            pc = code + line_start[index];
+        } else {
+            fprintf(stderr, "Error: Line %d not found\n", line_num);
+        }
+        VM_DISPATCH();
+    }
+    VM_CASE(OP_GOTO_LINE)
+        if (ip->target >= 0) {
+            pc = code + ip->target;
+        } else {
+            fprintf(stderr, "Error: Line %d not found\n", ip->a);
+        }
+        VM_DISPATCH();
+    VM_CASE(OP_DIM)
+        sp -= ip->b;
+        execute_dim(ip->a, sp + 1, ip->b);
+        VM_DISPATCH();
+    VM_CASE(OP_REDIM)
+        sp -= ip->b;
+        execute_redim(ip->a, sp + 1, ip->b);
+        VM_DISPATCH();
+    VM_CASE(OP_DIM_FILE) {
+        char path[MAX_LINE_LENGTH];
+        sp -= ip->b;
+        if (ssp->len < (int)sizeof(path)) {
+            memcpy(path, string_text(ssp), ssp->len);
+            path[ssp->len] = '\0';
+            execute_dim_file(ip->a, sp + 1, ip->b, path);
+        } else {
+            fprintf(stderr, "Error: File name too long\n");
+        }
+        release_string(ssp--);
+        RELEASE_TEMPORARIES();
+        VM_DISPATCH();
+    }
+    VM_CASE(OP_FLUSH)
+        execute_flush(ip->a);
+        VM_DISPATCH();
+    VM_CASE(OP_MAT)
+        if (ip->b == MAT_SCALE) {
+            execute_mat(ip->a, ip->b, ip->c, ip->d, *sp--);
+        } else {
+            execute_mat(ip->a, ip->b, ip->c, ip->d, 0);
+        }
+        VM_DISPATCH();
+    VM_CASE(OP_REDUCE) {
+        const int *range = sp - ip->d + 1;
+        int value = 0, result;
+        sp -= ip->d;
+        if (ip->b == REDUCE_COUNT) {
+            value = *sp--;
+        }
+        result = execute_reduce(ip->b, ip->a, ip->c, value, range, ip->d);
+        *++sp = result;
+        VM_DISPATCH();
+    }
+    VM_CASE(OP_SCAN)
+        sp -= ip->d;
+        execute_scan(ip->a, ip->b, sp + 1, ip->d);
+        VM_DISPATCH();
+    VM_CASE(OP_SORT)
+        sp -= ip->d;
+        execute_sort(ip->a, ip->b, ip->c, ip->d ? sp + 1 : NULL);
+        VM_DISPATCH();
+    VM_CASE(OP_DIM_MAP)
+        execute_map_dim(ip->a);
+        VM_DISPATCH();
+    VM_CASE(OP_LOAD_MAP)
+    VM_CASE(OP_HAS_MAP) {
+        MapKey key = ip->b ? string_map_key(string_text(ssp), ssp->len) : int_map_key(*sp--);
+        int *value = map_value(ip->a, &key, false);
+        *++sp = ip->op == OP_HAS_MAP ? value != NULL : value ? *value : 0;
+        if (ip->b) {
+            release_string(ssp--);
+            RELEASE_TEMPORARIES();
+        }
+        VM_DISPATCH();
+    }
+    VM_CASE(OP_STORE_MAP) {
+        int v = *sp--;
+        MapKey key = ip->b ? string_map_key(string_text(ssp), ssp->len) : int_map_key(*sp--);
+        int *value = map_value(ip->a, &key, true);
+        if (value) {
+            *value = v;
+        }
+        if (ip->b) {
+            release_string(ssp--);
+            RELEASE_TEMPORARIES();
+        }
+        VM_DISPATCH();
+    }
+    VM_CASE(OP_DEL_MAP) {
+        MapKey key = ip->b ? string_map_key(string_text(ssp), ssp->len) : int_map_key(*sp--);
+        map_delete(ip->a, &key);
+        if (ip->b) {
+            release_string(ssp--);
+            RELEASE_TEMPORARIES();
+        }
+        VM_DISPATCH();
+    }
+    VM_CASE(OP_OPEN)
+        execute_open(ip->a, ip->b, string_text(ssp), ssp->len);
+        release_string(ssp--);
+        RELEASE_TEMPORARIES();
+        VM_DISPATCH();
+    VM_CASE(OP_CLOSE)
+        execute_close(ip->a);
+        VM_DISPATCH();
+    VM_CASE(OP_CHECK_FILE)
+        if (!channels[ip->a].fp) {
+            fprintf(stderr, "Error: File #%d not open\n", ip->a);
+            pc = code + ip->target;
+        }
+        VM_DISPATCH();
+    VM_CASE(OP_INPUT_PROMPT)
+        output_text(&channels[0], string_pool + ip->a, ip->b);
+        VM_DISPATCH();
+    VM_CASE(OP_INPUT_INT)
+        if (!execute_input_value(&variables[ip->a])) {
+            pc = code + ip->target;
+        }
+        VM_DISPATCH();
+    VM_CASE(OP_INPUT_ARRAY) {
+        int index = *sp--;
+        if (!check_array_index(ip->a, index) ||
+            !execute_input_value(&arrays[ip->a].data[index])) {
+            pc = code + ip->target;
+        }
+        VM_DISPATCH();
+    }
+    VM_CASE(OP_INPUT_STR) {
+        char buffer[MAX_LINE_LENGTH];
+        int len = input_word(buffer, sizeof(buffer));
+        if (len >= 0) {
+            release_string(&string_variables[ip->a]);
+            string_variables[ip->a] = new_string(buffer, len);
+        }
+        VM_DISPATCH();
+    }
+    VM_CASE(OP_INPUT_FLUSH)
+        skip_input_line();
+        VM_DISPATCH();
+    VM_CASE(OP_DATA)
+        VM_DISPATCH();
+    VM_CASE(OP_READ_INT) {
+        const DataItem *item = execute_read(false);
+        if (item) {
+            variables[ip->a] = item->value;
+        } else {
+            pc = code + ip->target;
+        }
+        VM_DISPATCH();
+    }
+    VM_CASE(OP_READ_ARRAY) {
+        int index = *sp--;
+        const DataItem *item;
+        if (!check_array_index(ip->a, index) || !(item = execute_read(false))) {
+            pc = code + ip->target;
+        } else {
+            arrays[ip->a].data[index] = item->value;
+        }
+        VM_DISPATCH();
+    }
+    VM_CASE(OP_READ_STR) {
+        const DataItem *item = execute_read(true);
+        if (item) {
+            release_string(&string_variables[ip->a]);
+            string_variables[ip->a] = new_string(string_pool + item->value, item->len);
+        } else {
+            pc = code + ip->target;
+        }
+        VM_DISPATCH();
+    }
+    VM_CASE(OP_RESTORE)
+        execute_restore(ip->a);
+        VM_DISPATCH();
+    VM_CASE(OP_RECORD) {
+        const char *text;
+        int len;
+        if (!next_record(&text, &len)) {
+            /* Direct mode has no lines to go to: stop at the end of input */
+            if (direct) {
+                goto halt;
+            }
+            if (ip->target < 0) {
+                fprintf(stderr, "Error: Line %d not found\n", ip->c);
+                goto halt;
+            }
+            pc = code + ip->target;
+        } else {
+            if (ip->a >= 0) {
+                release_string(&string_variables[ip->a]);
+                string_variables[ip->a] = new_string(text, len);
+            }
+            if (ip->b >= 0) {
+                split_record(ip->b, text, len);
+            }
+        }
+        VM_DISPATCH();
+    }
+    VM_CASE(OP_FOR)
+        sp -= 3;
+        if (!execute_for(ip->a, sp[1], sp[2], sp[3], direct ? -1 : ip->c, direct ? -1 : (int)(pc - code))) {
+            int next_index = ip->b;
+            if (next_index == NEXT_UNRESOLVED) {
+                next_index = find_matching_next(0, ip->a);
+            }
+            if (next_index < 0) {
+                fprintf(stderr, "Error: Matching NEXT %s not found\n", var_names.names[ip->a]);
+                goto halt;
+            }
+            if (direct) {
+                goto halt;
+            }
+            pc = code + ip->target;
+        }
+        VM_DISPATCH();
+    VM_CASE(OP_NEXT) {
+        int body_pc = execute_next(ip->a);
+        if (body_pc >= 0 && !direct) {
+            pc = code + body_pc;
+        }
+        VM_DISPATCH();
+    }
+    VM_CASE(OP_END)
+        goto halt;
+    VM_CASE(OP_ERROR)
+        fprintf(stderr, "Error: %s\n", string_pool + ip->a);
+        VM_DISPATCH();
+    VM_CASE(OP_HALT)
+        goto halt;
+    VM_CASE(OP_TEE_VAR)
+        variables[ip->a] = *sp;
+        VM_DISPATCH();
+    VM_CASE(OP_INC_VAR)
+        variables[ip->a] = variables[ip->b] + ip->c;
+        VM_DISPATCH();
+    VM_CASE(OP_ADD_CONST)
+        *sp += ip->a;
+        VM_DISPATCH();
+    VM_CASE(OP_LOAD_ARRAY_VAR) {
+        int index = variables[ip->b];
+        *++sp = check_array_index(ip->a, index) ? arrays[ip->a].data[index] : 0;
+        VM_DISPATCH();
+    }
+    VM_CASE(OP_CHECK_INDEX_VAR)
+        if (!check_array_index(ip->a, variables[ip->b])) {
+            pc = code + ip->target;
+        }
+        VM_DISPATCH();
+    VM_CASE(OP_STORE_ARRAY_VAR)
+        arrays[ip->a].data[variables[ip->b]] = *sp--;
+        VM_DISPATCH();
+    VM_CASE(OP_LOAD_ARRAY_FAST)
+        *sp = arrays[ip->a].data[*sp];
+        VM_DISPATCH();
+    VM_CASE(OP_LOAD_ARRAY_VAR_FAST)
+        *++sp = arrays[ip->a].data[variables[ip->b]];
+        VM_DISPATCH();
+    VM_CASE(OP_CHECK_INDEX_FAST)
+    VM_CASE(OP_CHECK_INDEX_VAR_FAST)
+        VM_DISPATCH();
+    VM_CASE(OP_IF_GOTO_VV)
+        if (compare_values(ip->c, variables[ip->a], variables[ip->b])) {
+            if (ip->target >= 0) {
+                pc = code + ip->target;
+            } else {
+                fprintf(stderr, "Error: Line %d not found\n", ip->d);
+            }
+        }
+        VM_DISPATCH();
+    VM_CASE(OP_IF_GOTO_VC)
+        if (compare_values(ip->c, variables[ip->a], ip->b)) {
+            if (ip->target >= 0) {
+                pc = code + ip->target;
+            } else {
+                fprintf(stderr, "Error: Line %d not found\n", ip->d);
+            }
+        }
+        VM_DISPATCH();
+    VM_CASE(OP_JIT_ENTER) {
+#if HAVE_JIT
+        JitRegion *region = &jit_regions[ip->a];
+        if (ip == jit_resume_at) {
+            jit_resume_at = NULL;
+        } else {
+            if (!region->native && !region->failed && ++region->count >= JIT_HOT_THRESHOLD) {
+                jit_compile_region(ip->a);
+            }
+            if (region->native) {
+                int resume = region->native();
+                if (resume < 0) {
+                    /* Bail-out: interpret the line that needs the slow path */
+                    resume = -resume - 1;
+                    jit_resume_at = code + resume;
+                }
+                pc = code + resume;
+                VM_DISPATCH();
+            }
+        }
+        VM_EXECUTE(&region->original);
+#else
+        goto halt;
+#endif
+    }
+
+#if !USE_THREADED_CODE
+    default:
+        goto halt;
+    }
+#endif
+#undef VM_CASE
+#undef VM_DISPATCH
+#undef VM_EXECUTE
+#undef RELEASE_TEMPORARIES
+
+halt:
+    /* Release strings left by an abandoned statement */
+    while (ssp >= str_stack) {
+        release_string(ssp--);
+    }
+    arena_reset(&temp_arena, true);
+}
+
+/* Compile and run a statement typed in direct mode */
+void execute_direct(const char *text) {
+    int pool_mark = string_pool_len;
+    const Statement *stmt = find_statement(text);
+
+    /* READ and RESTORE use the DATA items gathered when the program is linked */
+    if (stmt && (stmt->compile == compile_read || stmt->compile == compile_restore) &&
+        !program_linked && program_size > 0) {
+        link_program();
+    }
+    compile_to_buffer(text);
+    emit(OP_HALT, 0, 0);
+    thread_code(code_buf, code_len);
+    execute_code(code_buf);
+    flush_output(&channels[0]);
+    string_pool_len = pool_mark;
+}
+
+/* Read an integer for INPUT, draining the line on failure */
+bool execute_input_value(int *target) {
+    if (!input_int(target)) {
+        fprintf(stderr, "Error: Invalid input\n");
+        skip_input_line();
+        return false;
+    }
+    return true;
+}
+
+/* Take the next DATA item for READ, which must be a string if string is set */
+const DataItem *execute_read(bool string) {
+    const DataItem *item;
+
+    if (data_next >= data_count) {
+        fprintf(stderr, "Error: Out of DATA\n");
+        return NULL;
+    }
+    item = &data_items[data_next];
+    if ((item->len >= 0) != string) {
+        fprintf(stderr, "Error: Type mismatch in READ\n");
+        return NULL;
+    }
+    data_next++;
+    return item;
+}
+
+/* RESTORE: the next READ takes the first DATA item at or after line_number */
+void execute_restore(int line_number) {
+    int lo = 0, hi = data_count;
+
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        if (data_items[mid].line_number < line_number) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    data_next = lo;
+}
+
+/*
+ * Zeroed storage for count ints. Small arrays come from value_arena;
+ * large ones are mapped straight from the kernel, with transparent huge
+ * pages requested to cut TLB misses on sweeps over them.
+ */
+static int *alloc_array_data(long long count, bool *mapped) {
+    size_t bytes = (size_t)count * sizeof(int);
+    void *data;
+
+    *mapped = bytes >= ARRAY_MAP_BYTES;
+    if (!*mapped) {
+        return (int *)arena_alloc(&value_arena, bytes);
+    }
+#if HAVE_MMAP
+    data = mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (data == MAP_FAILED) {
+        return NULL;
+    }
+#ifdef MADV_HUGEPAGE
+    madvise(data, bytes, MADV_HUGEPAGE);
+#endif
+#else
+    data = calloc(count, sizeof(int));
+#endif
+    return (int *)data;
+}
+
+/* Give back the storage of an array that owns it */
+static void free_array_data(Array *array) {
+    if (array->mapped) {
+#if HAVE_MMAP
+        munmap(array->data, (size_t)array->capacity * sizeof(int));
+        if (array->file && array->fd >= 0) {
+            close(array->fd);
+        }
+#else
+        free(array->data);
+#endif
+    }
+}
+
+/* Forget every array, unmapping the large ones */
+void release_arrays(void) {
+    int i;
+    for (i = 0; i < MAX_ARRAYS; i++) {
+        free_array_data(&arrays[i]);
+        arrays[i].data = NULL;
+        arrays[i].size = 0;
+        arrays[i].dims = 0;
+        arrays[i].capacity = 0;
+        arrays[i].mapped = false;
+        arrays[i].file = false;
+        arrays[i].fd = -1;
+        arrays[i].allocated = false;
+    }
+}
+
+/*
+ * Grow the storage of an array to capacity elements, keeping its
+ * contents. Mapped arrays are remapped, so the kernel moves page tables
+ * instead of copying data; arena arrays are copied once they outgrow
+ * their block.
+ */
+static bool grow_array_data(Array *array, long long capacity) {
+    size_t old_bytes = (size_t)array->capacity * sizeof(int);
+    size_t new_bytes = (size_t)capacity * sizeof(int);
+    bool mapped;
+    int *data;
+
+#if HAVE_MMAP
+    /* The file keeps the contents; it only has to be extended and mapped again */
+    if (array->file) {
+        void *moved;
+        if (array->fd < 0 || ftruncate(array->fd, (off_t)new_bytes) != 0) {
+            return false;
+        }
+#ifdef MREMAP_MAYMOVE
+        moved = mremap(array->data, old_bytes, new_bytes, MREMAP_MAYMOVE);
+#else
+        munmap(array->data, old_bytes);
+        moved = mmap(NULL, new_bytes, PROT_READ | PROT_WRITE, MAP_SHARED, array->fd, 0);
+#endif
+        if (moved == MAP_FAILED) {
+            return false;
+        }
+        array->data = (int *)moved;
+        array->capacity = capacity;
+        return true;
+    }
+#endif
+#if HAVE_MMAP && defined(MREMAP_MAYMOVE)
+    if (array->mapped) {
+        void *moved = mremap(array->data, old_bytes, new_bytes, MREMAP_MAYMOVE);
+        if (moved == MAP_FAILED) {
+            return false;
+        }
+#ifdef MADV_HUGEPAGE
+        madvise(moved, new_bytes, MADV_HUGEPAGE);
+#endif
+        array->data = (int *)moved;
+        array->capacity = capacity;
+        return true;
+    }
+#endif
+    data = alloc_array_data(capacity, &mapped);
+    if (!data) {
+        return false;
+    }
+    memcpy(data, array->data, old_bytes);
+    free_array_data(array);
+    array->data = data;
+    array->capacity = capacity;
+    array->mapped = mapped;
+    return true;
+}
+
+/* Elements in an array of the given extents, or -1 after reporting why there can be no such array */
+static long long shape_size(int arr_idx, const int *extent, int dims) {
+    long long size = 1;
+    int k;
+
+    for (k = 0; k < dims; k++) {
+        if (extent[k] <= 0) {
+            fprintf(stderr, "Error: Invalid array size %d\n", extent[k]);
+            return -1;
+        }
+        size *= extent[k];
+        if (size > INT_MAX) {
+            fprintf(stderr, "Error: Array %s is too large\n", array_names.names[arr_idx]);
+            return -1;
+        }
+    }
+    return size;
+}
+
+/* Record the shape of an array: first is its first extent, the others come from extent */
+static void set_shape(Array *array, long long first, const int *extent, int dims) {
+    long long stride = 1;
+    int k;
+
+    array->dims = dims;
+    for (k = dims - 1; k >= 0; k--) {
+        array->extent[k] = k == 0 ? first : extent[k];
+        array->stride[k] = stride;
+        stride *= array->extent[k];
+    }
+    array->size = stride;
+}
+
+/* Execute DIM statement */
+void execute_dim(int arr_idx, const int *extent, int dims) {
+    Array *array = &arrays[arr_idx];
+    long long size;
+    bool mapped;
+
+    if (array->allocated) {
+        fprintf(stderr, "Error: Array %s already dimensioned\n", array_names.names[arr_idx]);
+        return;
+    }
+
+    size = shape_size(arr_idx, extent, dims);
+    if (size < 0) {
+        return;
+    }
+
+    array->data = alloc_array_data(size, &mapped);
+    if (!array->data) {
+        fprintf(stderr, "Error: Memory allocation failed\n");
+        return;
+    }
+
+    set_shape(array, extent[0], extent, dims);
+    array->capacity = size;
+    array->mapped = mapped;
+    array->allocated = true;
+}
+
+/*
+ * Execute REDIM statement: grow an array, keeping its elements and
+ * zeroing the new ones. Only the first extent may change, so rows are
+ * added after the existing ones. Arrays never shrink, so bounds proven
+ * for a running loop stay valid. Capacity at least doubles each time it
+ * runs out, so growing an array step by step costs amortized constant
+ * time.
+ */
+void execute_redim(int arr_idx, const int *extent, int dims) {
+    Array *array = &arrays[arr_idx];
+    long long size, capacity;
+    int k;
+
+    if (!array->allocated) {
+        execute_dim(arr_idx, extent, dims);
+        return;
+    }
+
+    size = shape_size(arr_idx, extent, dims);
+    if (size < 0) {
+        return;
+    }
+    for (k = 1; k < dims; k++) {
+        if (extent[k] != array->extent[k]) {
+            break;
+        }
+    }
+    if (dims != array->dims || k < dims) {
+        fprintf(stderr, "Error: REDIM can only change the first dimension of %s\n",
+                array_names.names[arr_idx]);
+        return;
+    }
+
+    if (size < array->size) {
+        fprintf(stderr, "Error: Cannot shrink array %s to %d\n", array_names.names[arr_idx], extent[0]);
+        return;
+    }
+
+    if (size > array->capacity) {
+        capacity = array->file ? size : array->capacity * 2;
+        if (capacity < size) capacity = size;
+        if (capacity > INT_MAX) capacity = INT_MAX;
+        if (!grow_array_data(array, capacity) && !grow_array_data(array, size)) {
+            fprintf(stderr, "Error: Memory allocation failed\n");
+            return;
+        }
+    }
+    set_shape(array, extent[0], extent, dims);
+}
+
+/*
+ * Execute DIM ... FILE: map a file of native ints as the storage of an
+ * array, creating or extending it to hold every element. A first extent
+ * of 0 takes as many rows as the file holds. Writes go to the page cache and reach the file when
+ * the kernel writes them back, at FLUSH, or when the array is released.
+ * A file that cannot be written is mapped privately, so changes to it
+ * are not kept.
+ */
+void execute_dim_file(int arr_idx, const int *extent, int dims, const char *path) {
+#if HAVE_MMAP
+    Array *array = &arrays[arr_idx];
+    int shape[MAX_DIMS];
+    long long size, first = extent[0];
+    struct stat st;
+    size_t bytes;
+    void *data;
+    int fd;
+    bool writable = true;
+
+    if (array->allocated) {
+        fprintf(stderr, "Error: Array %s already dimensioned\n", array_names.names[arr_idx]);
+        return;
+    }
+
+    /* Validate the shape with a single row standing in for "the whole file" */
+    memcpy(shape, extent, dims * sizeof(int));
+    if (shape[0] == 0) {
+        shape[0] = 1;
+    }
+    size = shape_size(arr_idx, shape, dims);
+    if (size < 0) {
+        return;
+    }
+
+    fd = open(path, O_RDWR | O_CREAT, 0644);
+    if (fd < 0) {
+        writable = false;
+        fd = open(path, O_RDONLY);
+    }
+    if (fd < 0 || fstat(fd, &st) != 0) {
+        fprintf(stderr, "Error: Cannot open file %s\n", path);
+        if (fd >= 0) close(fd);
+        return;
+    }
+
+    if (first == 0) {
+        first = (long long)(st.st_size / sizeof(int)) / size;
+        if (first < 1 || first * size > INT_MAX) {
+            fprintf(stderr, "Error: File %s does not hold an array\n", path);
+            close(fd);
+            return;
+        }
+        size *= first;
+    }
+
+    bytes = (size_t)size * sizeof(int);
+    if ((off_t)bytes > st.st_size && (!writable || ftruncate(fd, (off_t)bytes) != 0)) {
+        fprintf(stderr, "Error: Cannot extend file %s\n", path);
+        close(fd);
+        return;
+    }
+
+    data = mmap(NULL, bytes, PROT_READ | PROT_WRITE, writable ? MAP_SHARED : MAP_PRIVATE, fd, 0);
+    if (data == MAP_FAILED) {
+        fprintf(stderr, "Error: Cannot map file %s\n", path);
+        close(fd);
+        return;
+    }
+    if (!writable) {
+        close(fd);
+        fd = -1;
+    }
+
+    array->data = (int *)data;
+    set_shape(array, first, extent, dims);
+    array->capacity = size;
+    array->mapped = true;
+    array->file = true;
+    array->fd = fd;
+    array->allocated = true;
+#else
+    (void)arr_idx;
+    (void)extent;
+    (void)dims;
+    (void)path;
+    fprintf(stderr, "Error: FILE arrays are not supported on this platform\n");
+#endif
+}
+
+/* Execute FLUSH: write a FILE array (or all of them) back to its file */
+void execute_flush(int arr_idx) {
+    int i;
+
+    if (arr_idx >= 0 && !arrays[arr_idx].file) {
+        fprintf(stderr, "Error: Array %s is not a FILE array\n", array_names.names[arr_idx]);
+        return;
+    }
+    for (i = 0; i < MAX_ARRAYS; i++) {
+        if ((arr_idx < 0 || i == arr_idx) && arrays[i].file && arrays[i].fd >= 0) {
+#if HAVE_MMAP
+            if (msync(arrays[i].data, (size_t)arrays[i].capacity * sizeof(int), MS_SYNC) != 0) {
+                fprintf(stderr, "Error: Cannot write array %s to its file\n", array_names.names[i]);
+            }
+#endif
+        }
+    }
+}
+
+/*
+ * MAT kernels: target[i] = left[i] op right[i] (or op k) for n elements.
+ * Arithmetic wraps like the rest of the VM. The plain loop finishes what
+ * the vector loops leave over.
+ */
+static void mat_kernel_scalar(int op, int *target, const int *left, const int *right, int k, long long n) {
+    long long i;
+
+    for (i = 0; i < n; i++) {
+        switch (op) {
+            case MAT_CON:   target[i] = 1; break;
+            case MAT_ADD:   target[i] = (int)((unsigned int)left[i] + (unsigned int)right[i]); break;
+            case MAT_SUB:   target[i] = (int)((unsigned int)left[i] - (unsigned int)right[i]); break;
+            case MAT_MUL:   target[i] = (int)((unsigned int)left[i] * (unsigned int)right[i]); break;
+            case MAT_SCALE: target[i] = (int)((unsigned int)left[i] * (unsigned int)k); break;
+        }
+    }
+}
+
+#if HAVE_SSE2
+/* Low 32 bits of each product; SSE2 has no pmulld */
+static inline __m128i mullo_sse2(__m128i x, __m128i y) {
+    __m128i even = _mm_mul_epu32(x, y);
+    __m128i odd = _mm_mul_epu32(_mm_srli_epi64(x, 32), _mm_srli_epi64(y, 32));
+    return _mm_unpacklo_epi32(_mm_shuffle_epi32(even, _MM_SHUFFLE(0, 0, 2, 0)),
+                              _mm_shuffle_epi32(odd, _MM_SHUFFLE(0, 0, 2, 0)));
+}
+
+static void mat_kernel_sse2(int op, int *target, const int *left, const int *right, int k, long long n) {
+    __m128i scalar = _mm_set1_epi32(op == MAT_CON ? 1 : k);
+    long long i = 0;
+
+    for (; i + 4 <= n; i += 4) {
+        __m128i x = _mm_loadu_si128((const __m128i *)(left + i));
+        __m128i y = op == MAT_SCALE || op == MAT_CON ? scalar : _mm_loadu_si128((const __m128i *)(right + i));
+        switch (op) {
+            case MAT_CON:   x = scalar; break;
+            case MAT_ADD:   x = _mm_add_epi32(x, y); break;
+            case MAT_SUB:   x = _mm_sub_epi32(x, y); break;
+            default:        x = mullo_sse2(x, y); break;
+        }
+        _mm_storeu_si128((__m128i *)(target + i), x);
+    }
+    mat_kernel_scalar(op, target + i, left + i, right + i, k, n - i);
+}
+#endif
+
+#if HAVE_AVX2
+__attribute__((target("avx2")))
+static void mat_kernel_avx2(int op, int *target, const int *left, const int *right, int k, long long n) {
+    __m256i scalar = _mm256_set1_epi32(op == MAT_CON ? 1 : k);
+    long long i = 0;
+
+    for (; i + 8 <= n; i += 8) {
+        __m256i x = _mm256_loadu_si256((const __m256i *)(left + i));
+        __m256i y = op == MAT_SCALE || op == MAT_CON ? scalar : _mm256_loadu_si256((const __m256i *)(right + i));
+        switch (op) {
+            case MAT_CON:   x = scalar; break;
+            case MAT_ADD:   x = _mm256_add_epi32(x, y); break;
+            case MAT_SUB:   x = _mm256_sub_epi32(x, y); break;
+            default:        x = _mm256_mullo_epi32(x, y); break;
+        }
+        _mm256_storeu_si256((__m256i *)(target + i), x);
+    }
+    mat_kernel_scalar(op, target + i, left + i, right + i, k, n - i);
+}
+#endif
+
+typedef void (*MatKernel)(int op, int *target, const int *left, const int *right, int k, long long n);
+
+/* The widest kernel this CPU runs, chosen on first use */
+static MatKernel mat_kernel(void) {
+    static MatKernel kernel = NULL;
+
+    if (!kernel) {
+        kernel = mat_kernel_scalar;
+#if HAVE_SSE2
+        kernel = mat_kernel_sse2;
+#endif
+#if HAVE_AVX2
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx2")) {
+            kernel = mat_kernel_avx2;
+        }
+#endif
+    }
+    return kernel;
+}
+
+/* True if two dimensioned arrays have the same shape */
+static bool same_shape(const Array *x, const Array *y) {
+    int k;
+
+    if (x->dims != y->dims) {
+        return false;
+    }
+    for (k = 0; k < x->dims; k++) {
+        if (x->extent[k] != y->extent[k]) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/*
+ * Execute MAT statement. The operands must have one shape; a target that
+ * is not dimensioned yet takes it, one that is must already have it.
+ * Element-wise work runs in the vector kernels, which also handle a
+ * target that is one of the operands.
+ */
+void execute_mat(int target, int op, int left, int right, int k) {
+    Array *t = &arrays[target], *l = &arrays[left], *r = &arrays[right];
+
+    if (!l->allocated || !r->allocated) {
+        fprintf(stderr, "Error: Array %s not dimensioned\n", array_names.names[l->allocated ? right : left]);
+        return;
+    }
+    if (!same_shape(l, r)) {
+        fprintf(stderr, "Error: MAT arrays %s and %s differ in shape\n",
+                array_names.names[left], array_names.names[right]);
+        return;
+    }
+    if (!t->allocated) {
+        int extent[MAX_DIMS], d;
+        for (d = 0; d < l->dims; d++) {
+            extent[d] = (int)l->extent[d];
+        }
+        execute_dim(target, extent, l->dims);
+        if (!t->allocated) {
+            return;
+        }
+    } else if (!same_shape(t, l)) {
+        fprintf(stderr, "Error: MAT arrays %s and %s differ in shape\n",
+                array_names.names[target], array_names.names[left]);
+        return;
+    }
+
+    switch (op) {
+        case MAT_COPY:
+            memmove(t->data, l->data, (size_t)t->size * sizeof(int));
+            break;
+        case MAT_ZER:
+            memset(t->data, 0, (size_t)t->size * sizeof(int));
+            break;
+        default:
+            mat_kernel()(op, t->data, l->data, r->data, k, t->size);
+            break;
+    }
+}
+
+/*
+ * Reduction kernels for SUM, MIN, MAX, COUNT and DOT over n > 0
+ * elements of x (and y for DOT). Sums wrap like the rest of the VM.
+ */
+static int reduce_kernel_scalar(int kind, const int *x, const int *y, int value, long long n) {
+    unsigned int sum = 0;
+    int best = x[0];
+    long long i;
+
+    switch (kind) {
+        case REDUCE_SUM:
+            for (i = 0; i < n; i++) sum += (unsigned int)x[i];
+            return (int)sum;
+        case REDUCE_MIN:
+            for (i = 1; i < n; i++) if (x[i] < best) best = x[i];
+            return best;
+        case REDUCE_MAX:
+            for (i = 1; i < n; i++) if (x[i] > best) best = x[i];
+            return best;
+        case REDUCE_COUNT:
+            for (i = 0; i < n; i++) sum += x[i] == value;
+            return (int)sum;
+        default:
+            for (i = 0; i < n; i++) sum += (unsigned int)x[i] * (unsigned int)y[i];
+            return (int)sum;
+    }
+}
+
+/* Running totals of n elements of x into out, continuing from carry */
+static void scan_kernel_scalar(int *out, const int *x, unsigned int carry, long long n) {
+    long long i;
+
+    for (i = 0; i < n; i++) {
+        carry += (unsigned int)x[i];
+        out[i] = (int)carry;
+    }
+}
+
+#if HAVE_SSE2
+/* Lanes of x where pick is set, of y elsewhere; SSE2 has no pblendvb */
+static inline __m128i select_sse2(__m128i pick, __m128i x, __m128i y) {
+    return _mm_or_si128(_mm_and_si128(pick, x), _mm_andnot_si128(pick, y));
+}
+
+static int reduce_kernel_sse2(int kind, const int *x, const int *y, int value, long long n) {
+    __m128i acc = kind == REDUCE_MIN || kind == REDUCE_MAX ? _mm_set1_epi32(x[0]) : _mm_setzero_si128();
+    __m128i match = _mm_set1_epi32(value);
+    int lanes[4], result, k;
+    long long i = 0;
+
+    for (; i + 4 <= n; i += 4) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(x + i));
+        switch (kind) {
+            case REDUCE_SUM:   acc = _mm_add_epi32(acc, v); break;
+            case REDUCE_MIN:   acc = select_sse2(_mm_cmplt_epi32(v, acc), v, acc); break;
+            case REDUCE_MAX:   acc = select_sse2(_mm_cmpgt_epi32(v, acc), v, acc); break;
+            case REDUCE_COUNT: acc = _mm_sub_epi32(acc, _mm_cmpeq_epi32(v, match)); break;
+            default:
+                acc = _mm_add_epi32(acc, mullo_sse2(v, _mm_loadu_si128((const __m128i *)(y + i))));
+                break;
+        }
+    }
+    if (i == 0) {
+        return reduce_kernel_scalar(kind, x, y, value, n);
+    }
+
+    /* Fold the lanes, then the elements left over */
+    _mm_storeu_si128((__m128i *)lanes, acc);
+    result = lanes[0];
+    for (k = 1; k < 4; k++) {
+        switch (kind) {
+            case REDUCE_MIN: if (lanes[k] < result) result = lanes[k]; break;
+            case REDUCE_MAX: if (lanes[k] > result) result = lanes[k]; break;
+            default:         result = (int)((unsigned int)result + (unsigned int)lanes[k]); break;
+        }
+    }
+    if (i < n) {
+        int rest = reduce_kernel_scalar(kind, x + i, y + i, value, n - i);
+        switch (kind) {
+            case REDUCE_MIN: if (rest < result) result = rest; break;
+            case REDUCE_MAX: if (rest > result) result = rest; break;
+            default:         result = (int)((unsigned int)result + (unsigned int)rest); break;
+        }
+    }
+    return result;
+}
+
+/* Each block of four is summed in two shifted adds, then offset by the carry */
+static void scan_kernel_sse2(int *out, const int *x, unsigned int carry, long long n) {
+    __m128i total = _mm_set1_epi32((int)carry);
+    long long i = 0;
+
+    for (; i + 4 <= n; i += 4) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(x + i));
+        v = _mm_add_epi32(v, _mm_slli_si128(v, 4));
+        v = _mm_add_epi32(v, _mm_slli_si128(v, 8));
+        v = _mm_add_epi32(v, total);
+        _mm_storeu_si128((__m128i *)(out + i), v);
+        total = _mm_shuffle_epi32(v, _MM_SHUFFLE(3, 3, 3, 3));
+    }
+    scan_kernel_scalar(out + i, x + i, (unsigned int)_mm_cvtsi128_si32(total), n - i);
+}
+#endif
+
+#if HAVE_AVX2
+__attribute__((target("avx2")))
+static int reduce_kernel_avx2(int kind, const int *x, const int *y, int value, long long n) {
+    __m256i acc = kind == REDUCE_MIN || kind == REDUCE_MAX ? _mm256_set1_epi32(x[0]) : _mm256_setzero_si256();
+    __m256i match = _mm256_set1_epi32(value);
+    int lanes[8], result, k;
+    long long i = 0;
+
+    for (; i + 8 <= n; i += 8) {
+        __m256i v = _mm256_loadu_si256((const __m256i *)(x + i));
+        switch (kind) {
+            case REDUCE_SUM:   acc = _mm256_add_epi32(acc, v); break;
+            case REDUCE_MIN:   acc = _mm256_min_epi32(acc, v); break;
+            case REDUCE_MAX:   acc = _mm256_max_epi32(acc, v); break;
+            case REDUCE_COUNT: acc = _mm256_sub_epi32(acc, _mm256_cmpeq_epi32(v, match)); break;
+            default:
+                acc = _mm256_add_epi32(acc, _mm256_mullo_epi32(v, _mm256_loadu_si256((const __m256i *)(y + i))));
+                break;
+        }
+    }
+    if (i == 0) {
+        return reduce_kernel_scalar(kind, x, y, value, n);
+    }
+
+    _mm256_storeu_si256((__m256i *)lanes, acc);
+    result = lanes[0];
+    for (k = 1; k < 8; k++) {
+        switch (kind) {
+            case REDUCE_MIN: if (lanes[k] < result) result = lanes[k]; break;
+            case REDUCE_MAX: if (lanes[k] > result) result = lanes[k]; break;
+            default:         result = (int)((unsigned int)result + (unsigned int)lanes[k]); break;
+        }
+    }
+    if (i < n) {
+        int rest = reduce_kernel_scalar(kind, x + i, y + i, value, n - i);
+        switch (kind) {
+            case REDUCE_MIN: if (rest < result) result = rest; break;
+            case REDUCE_MAX: if (rest > result) result = rest; break;
+            default:         result = (int)((unsigned int)result + (unsigned int)rest); break;
+        }
+    }
+    return result;
+}
+
+/* As the SSE2 scan, with the low half's total carried into the high half */
+__attribute__((target("avx2")))
+static void scan_kernel_avx2(int *out, const int *x, unsigned int carry, long long n) {
+    __m256i total = _mm256_set1_epi32((int)carry);
+    __m256i last = _mm256_set1_epi32(7);
+    long long i = 0;
+
+    for (; i + 8 <= n; i += 8) {
+        __m256i v = _mm256_loadu_si256((const __m256i *)(x + i));
+        v = _mm256_add_epi32(v, _mm256_slli_si256(v, 4));
+        v = _mm256_add_epi32(v, _mm256_slli_si256(v, 8));
+        v = _mm256_add_epi32(v, _mm256_permute2x128_si256(_mm256_shuffle_epi32(v, _MM_SHUFFLE(3, 3, 3, 3)),
+                                                          v, 0x08));
+        v = _mm256_add_epi32(v, total);
+        _mm256_storeu_si256((__m256i *)(out + i), v);
+        total = _mm256_permutevar8x32_epi32(v, last);
+    }
+    scan_kernel_scalar(out + i, x + i, (unsigned int)_mm256_cvtsi256_si32(total), n - i);
+}
+#endif
+
+typedef int (*ReduceKernel)(int kind, const int *x, const int *y, int value, long long n);
+typedef void (*ScanKernel)(int *out, const int *x, unsigned int carry, long long n);
+
+/* The widest reduction and scan kernels this CPU runs, chosen on first use */
+static ReduceKernel reduce_kernel(ScanKernel *scan) {
+    static ReduceKernel kernel = NULL;
+    static ScanKernel scan_kernel = NULL;
+
+    if (!kernel) {
+        kernel = reduce_kernel_scalar;
+        scan_kernel = scan_kernel_scalar;
+#if HAVE_SSE2
+        kernel = reduce_kernel_sse2;
+        scan_kernel = scan_kernel_sse2;
+#endif
+#if HAVE_AVX2
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx2")) {
+            kernel = reduce_kernel_avx2;
+            scan_kernel = scan_kernel_avx2;
+        }
+#endif
+    }
+    if (scan) {
+        *scan = scan_kernel;
+    }
+    return kernel;
+}
+
+/*
+ * Resolve the optional start and length of an array function against an
+ * array: by default from element 0 (or start) to the end. Returns false
+ * after reporting an array that is not dimensioned or a range outside it.
+ */
+static bool array_range(int arr_idx, const int *range, int count, long long *start, long long *length) {
+    const Array *array = &arrays[arr_idx];
+
+    if (!array->allocated) {
+        fprintf(stderr, "Error: Array %s not dimensioned\n", array_names.names[arr_idx]);
+        return false;
+    }
+    *start = count > 0 ? range[0] : 0;
+    if (*start < 0 || *start > array->size) {
+        fprintf(stderr, "Error: Array index %lld out of bounds for %s\n", *start, array_names.names[arr_idx]);
+        return false;
+    }
+    *length = count > 1 ? range[1] : array->size - *start;
+    if (*length < 0 || *length > array->size - *start) {
+        fprintf(stderr, "Error: Range of %lld elements from %lld out of bounds for %s\n",
+                *length, *start, array_names.names[arr_idx]);
+        return false;
+    }
+    return true;
+}
+
+/*
+ * Execute SUM, MIN, MAX, COUNT or DOT over a range of an array; DOT's
+ * second array must hold the same range. An empty range gives 0, as
+ * does an error.
+ */
+int execute_reduce(int kind, int arr_idx, int other, int value, const int *range, int count) {
+    long long start, length;
+
+    if (!array_range(arr_idx, range, count, &start, &length)) {
+        return 0;
+    }
+    if (kind == REDUCE_DOT) {
+        long long other_start, other_length;
+        int limit[2];
+        limit[0] = (int)start;
+        limit[1] = (int)length;
+        if (!array_range(other, limit, 2, &other_start, &other_length)) {
+            return 0;
+        }
+    }
+    if (length == 0) {
+        return 0;
+    }
+    return reduce_kernel(NULL)(kind, arrays[arr_idx].data + start,
+                               kind == REDUCE_DOT ? arrays[other].data + start : NULL, value, length);
+}
+
+/*
+ * Execute SCAN: each element of the range of target becomes the total of
+ * source from the start of the range up to that element. A target that
+ * is not dimensioned takes the shape of source; the two may be the same.
+ */
+void execute_scan(int source, int target, const int *range, int count) {
+    Array *s = &arrays[source], *t = &arrays[target];
+    long long start, length;
+    ScanKernel scan;
+    int limit[2];
+
+    if (!array_range(source, range, count, &start, &length)) {
+        return;
+    }
+    if (!t->allocated) {
+        int extent[MAX_DIMS], d;
+        for (d = 0; d < s->dims; d++) {
+            extent[d] = (int)s->extent[d];
+        }
+        execute_dim(target, extent, s->dims);
+        if (!t->allocated) {
+            return;
+        }
+    }
+    limit[0] = (int)start;
+    limit[1] = (int)length;
+    if (!array_range(target, limit, 2, &start, &length)) {
+        return;
+    }
+    reduce_kernel(&scan);
+    scan(t->data + start, s->data + start, 0, length);
+}
+
+/*
+ * SORT orders keys as unsigned values: flipping the sign bit puts the
+ * negative ones first, and flipping every bit as well sorts descending.
+ * Both sorts are stable, so equal keys keep their companions in order.
+ */
+static inline unsigned int sort_key(int value, unsigned int flip) {
+    return ((unsigned int)value ^ 0x80000000u) ^ flip;
+}
+
+static void insertion_sort(int *keys, int *values, long long n, unsigned int flip) {
+    long long i, j;
+
+    for (i = 1; i < n; i++) {
+        int key = keys[i], value = values ? values[i] : 0;
+        unsigned int k = sort_key(key, flip);
+        for (j = i; j > 0 && sort_key(keys[j - 1], flip) > k; j--) {
+            keys[j] = keys[j - 1];
+            if (values) {
+                values[j] = values[j - 1];
+            }
+        }
+        keys[j] = key;
+        if (values) {
+            values[j] = value;
+        }
+    }
+}
+
+/*
+ * LSD radix sort a byte at a time. One pass counts every byte position;
+ * a position where all keys agree is skipped. Returns false if there is
+ * no memory for the scratch copy.
+ */
+static bool radix_sort(int *keys, int *values, long long n, unsigned int flip) {
+    static long long count[4][256];
+    int *key_buf, *value_buf = NULL, *src_keys = keys, *src_values = values;
+    long long i;
+    int pass;
+
+    key_buf = (int *)malloc((size_t)n * sizeof(int));
+    if (values) {
+        value_buf = (int *)malloc((size_t)n * sizeof(int));
+    }
+    if (!key_buf || (values && !value_buf)) {
+        free(key_buf);
+        free(value_buf);
+        return false;
+    }
+
+    memset(count, 0, sizeof(count));
+    for (i = 0; i < n; i++) {
+        unsigned int k = sort_key(keys[i], flip);
+        count[0][k & 0xff]++;
+        count[1][(k >> 8) & 0xff]++;
+        count[2][(k >> 16) & 0xff]++;
+        count[3][k >> 24]++;
+    }
+
+    for (pass = 0; pass < 4; pass++) {
+        int shift = pass * 8, *dst_keys, *dst_values;
+        long long offset = 0;
+        int b;
+
+        if (count[pass][(sort_key(keys[0], flip) >> shift) & 0xff] == n) {
+            continue;
+        }
+        for (b = 0; b < 256; b++) {
+            long long c = count[pass][b];
+            count[pass][b] = offset;
+            offset += c;
+        }
+        dst_keys = src_keys == keys ? key_buf : keys;
+        dst_values = src_values == values ? value_buf : values;
+        for (i = 0; i < n; i++) {
+            long long at = count[pass][(sort_key(src_keys[i], flip) >> shift) & 0xff]++;
+            dst_keys[at] = src_keys[i];
+            if (values) {
+                dst_values[at] = src_values[i];
+            }
+        }
+        src_keys = dst_keys;
+        src_values = dst_values;
+    }
+
+    if (src_keys != keys) {
+        memcpy(keys, src_keys, (size_t)n * sizeof(int));
+        if (values) {
+            memcpy(values, src_values, (size_t)n * sizeof(int));
+        }
+    }
+    free(key_buf);
+    free(value_buf);
+    return true;
+}
+
+/*
+ * Execute SORT: order the first *count elements of an array (all of them
+ * if count is NULL), rearranging those of a companion array, if one is
+ * given, in step with them.
+ */
+void execute_sort(int arr_idx, int with, bool descending, const int *count) {
+    unsigned int flip = descending ? 0xffffffffu : 0;
+    long long start, length;
+    int limit[2], *values = NULL;
+
+    limit[0] = 0;
+    limit[1] = count ? *count : 0;
+    if (!array_range(arr_idx, limit, count ? 2 : 0, &start, &length)) {
+        return;
+    }
+    if (with >= 0 && with != arr_idx) {
+        limit[1] = (int)length;
+        if (!array_range(with, limit, 2, &start, &length)) {
+            return;
+        }
+        values = arrays[with].data;
+    }
+    if (length <= SORT_INSERTION_LIMIT) {
+        insertion_sort(arrays[arr_idx].data, values, length, flip);
+    } else if (!radix_sort(arrays[arr_idx].data, values, length, flip)) {
+        fprintf(stderr, "Error: Memory allocation failed\n");
+    }
+}
+
+/* Scramble a hash so that its low bits, which pick the slot, depend on all of it */
+static inline unsigned int mix_hash(unsigned int h) {
+    h ^= h >> 16;
+    h *= 0x7feb352du;
+    h ^= h >> 15;
+    return h;
+}
+
+/* Key for an integer */
+MapKey int_map_key(int key) {
+    MapKey k;
+    k.hash = mix_hash((unsigned int)key * 2654435761u);
+    k.len = MAP_INT_KEY;
+    k.key = key;
+    k.text = NULL;
+    return k;
+}
+
+/* Key for a string, hashed with FNV-1a */
+MapKey string_map_key(const char *text, int len) {
+    unsigned int h = 2166136261u;
+    MapKey k;
+    int i;
+
+    for (i = 0; i < len; i++) {
+        h = (h ^ (unsigned char)text[i]) * 16777619u;
+    }
+    k.hash = mix_hash(h);
+    k.len = len;
+    k.key = 0;
+    k.text = text;
+    return k;
+}
+
+void release_maps(void) {
+    int i;
+    for (i = 0; i < MAX_MAPS; i++) {
+        free(maps[i].entries);
+        free(maps[i].keys);
+        memset(&maps[i], 0, sizeof(Map));
+    }
+}
+
+/* Execute DIM MAP: declare a map, emptying it if it already exists */
+void execute_map_dim(int map_idx) {
+    Map *map = &maps[map_idx];
+    unsigned int i;
+
+    if (!map->entries) {
+        map->entries = (MapEntry *)malloc(16 * sizeof(MapEntry));
+        if (!map->entries) {
+            fprintf(stderr, "Error: Memory allocation failed\n");
+            return;
+        }
+        map->mask = 15;
+    }
+    for (i = 0; i <= map->mask; i++) {
+        map->entries[i].len = MAP_EMPTY;
+    }
+    map->count = 0;
+    map->keys_len = map->keys_dead = 0;
+    map->declared = true;
+}
+
+static inline bool map_entry_placed(const MapEntry *e) {
+    return e->len >= 0 || e->len == MAP_INT_KEY;
+}
+
+/*
+ * Double the table in place. The block is reallocated, every entry of the
+ * old half is marked pending, and each pending entry moves to the first
+ * slot of its probe sequence that is not placed: a free slot, or one
+ * whose pending entry it swaps with and then places in turn. No placed
+ * entry's probe ever crosses a slot that is not placed, so vacating one
+ * cannot hide a key.
+ */
+static bool grow_map(Map *map) {
+    unsigned int old_cap = map->mask + 1, new_cap = old_cap * 2, i;
+    MapEntry *entries;
+
+    if (new_cap == 0 || (size_t)new_cap * sizeof(MapEntry) / sizeof(MapEntry) != new_cap) {
+        return false;
+    }
+    entries = (MapEntry *)realloc(map->entries, (size_t)new_cap * sizeof(MapEntry));
+    if (!entries) {
+        return false;
+    }
+    map->entries = entries;
+    map->mask = new_cap - 1;
+    for (i = old_cap; i < new_cap; i++) {
+        entries[i].len = MAP_EMPTY;
+    }
+    for (i = 0; i < old_cap; i++) {
+        if (entries[i].len != MAP_EMPTY) {
+            entries[i].len += MAP_PENDING;
+        }
+    }
+
+    for (i = 0; i < old_cap; i++) {
+        while (entries[i].len != MAP_EMPTY && !map_entry_placed(&entries[i])) {
+            MapEntry e = entries[i];
+            unsigned int j = e.hash & map->mask;
+            while (map_entry_placed(&entries[j])) {
+                j = (j + 1) & map->mask;
+            }
+            e.len -= MAP_PENDING;
+            if (j == i) {
+                entries[i] = e;
+            } else if (entries[j].len == MAP_EMPTY) {
+                entries[j] = e;
+                entries[i].len = MAP_EMPTY;
+            } else {
+                entries[i] = entries[j];
+                entries[j] = e;
+            }
+        }
+    }
+    return true;
+}
+
+/* Copy a string key into the key pool, compacting it first if it is mostly dead */
+static bool add_map_key(Map *map, const MapKey *k, int *offset) {
+    size_t need = map->keys_len + k->len;
+
+    if (map->keys_dead > map->keys_len / 2 && map->keys_dead >= 4096) {
+        char *keys = (char *)malloc(map->keys_cap);
+        size_t len = 0;
+        unsigned int i;
+        if (keys) {
+            for (i = 0; i <= map->mask; i++) {
+                MapEntry *e = &map->entries[i];
+                if (e->len >= 0) {
+                    memcpy(keys + len, map->keys + e->key, e->len);
+                    e->key = (int)len;
+                    len += e->len;
+                }
+            }
+            free(map->keys);
+            map->keys = keys;
+            map->keys_len = len;
+            map->keys_dead = 0;
+            need = len + k->len;
+        }
+    }
+    if (need > INT_MAX) {
+        return false;
+    }
+    if (need > map->keys_cap) {
+        size_t cap = map->keys_cap ? map->keys_cap : 256;
+        char *keys;
+        while (cap < need) {
+            cap *= 2;
+        }
+        keys = (char *)realloc(map->keys, cap);
+        if (!keys) {
+            return false;
+        }
+        map->keys = keys;
+        map->keys_cap = cap;
+    }
+    memcpy(map->keys + map->keys_len, k->text, k->len);
+    *offset = (int)map->keys_len;
+    map->keys_len += k->len;
+    return true;
+}
+
+/* The map for a statement, or NULL after reporting that it is not declared */
+static inline Map *declared_map(int map_idx) {
+    if (!maps[map_idx].declared) {
+        fprintf(stderr, "Error: Map %s not declared\n", map_names.names[map_idx]);
+        return NULL;
+    }
+    return &maps[map_idx];
+}
+
+/* The entry holding a key, or NULL with *slot set to the free slot it would take */
+static MapEntry *find_map_entry(Map *map, const MapKey *k, unsigned int *slot) {
+    unsigned int i = k->hash & map->mask;
+    MapEntry *e;
+
+    for (e = &map->entries[i]; e->len != MAP_EMPTY; e = &map->entries[i]) {
+        if (e->hash == k->hash && e->len == k->len &&
+            (k->len == MAP_INT_KEY ? e->key == k->key : memcmp(map->keys + e->key, k->text, k->len) == 0)) {
+            return e;
+        }
+        i = (i + 1) & map->mask;
+    }
+    *slot = i;
+    return NULL;
+}
+
+/*
+ * The value stored under a key, or NULL if there is none. With create, a
+ * missing key is added with the value 0; the table grows before it is
+ * three quarters full.
+ */
+int *map_value(int map_idx, const MapKey *k, bool create) {
+    Map *map = declared_map(map_idx);
+    MapEntry *e;
+    unsigned int i;
+
+    if (!map) {
+        return NULL;
+    }
+    e = find_map_entry(map, k, &i);
+    if (e || !create) {
+        return e ? &e->value : NULL;
+    }
+    if ((size_t)(map->count + 1) * 4 > (size_t)(map->mask + 1) * 3) {
+        if (!grow_map(map)) {
+            fprintf(stderr, "Error: Memory allocation failed\n");
+            return NULL;
+        }
+        find_map_entry(map, k, &i);
+    }
+
+    e = &map->entries[i];
+    e->key = k->key;
+    if (k->len != MAP_INT_KEY && !add_map_key(map, k, &e->key)) {
+        fprintf(stderr, "Error: Memory allocation failed\n");
+        return NULL;
+    }
+    e->hash = k->hash;
+    e->len = k->len;
+    e->value = 0;
+    map->count++;
+    return &e->value;
+}
+
+/*
+ * Execute DEL: remove a key if present. The rest of its probe run is
+ * shifted back over the hole, so the table never holds tombstones.
+ */
+void map_delete(int map_idx, const MapKey *k) {
+    Map *map = declared_map(map_idx);
+    MapEntry *e;
+    unsigned int i, j;
+
+    if (!map || !(e = find_map_entry(map, k, &i))) {
+        return;
+    }
+    i = (unsigned int)(e - map->entries);
+    if (e->len >= 0) {
+        map->keys_dead += e->len;
+    }
+    map->count--;
+    for (j = (i + 1) & map->mask; map->entries[j].len != MAP_EMPTY; j = (j + 1) & map->mask) {
+        unsigned int home = map->entries[j].hash & map->mask;
+        if (((j - home) & map->mask) >= ((j - i) & map->mask)) {
+            map->entries[i] = map->entries[j];
+            i = j;
+        }
+    }
+    map->entries[i].len = MAP_EMPTY;
+}
+
+/*
+ * Execute FOR statement. Returns false if the loop does not run at all;
+ * otherwise the loop body starts at body_pc (-1 in direct mode).
+ */
+bool execute_for(int var_slot, int start_val, int end_val, int step_val, int line_index, int body_pc) {
+    ForStackEntry *frame;
+
+    /* Re-executing a FOR whose frame is on top restarts the loop */
+    if (for_stack_ptr > 0 && for_stack[for_stack_ptr - 1].line_index == line_index && line_index >= 0) {
+        frame = &for_stack[for_stack_ptr - 1];
+    } else {
+        if (for_stack_ptr >= for_stack_cap) {
+            int new_cap = for_stack_cap ? for_stack_cap * 2 : 16;
+            ForStackEntry *grown = (ForStackEntry *)realloc(for_stack, new_cap * sizeof(ForStackEntry));
+            if (!grown) {
+                fprintf(stderr, "Error: FOR stack overflow\n");
+                prove_loop_bounds(line_index, start_val, end_val, step_val, false);
+                return true;
+            }
+            for_stack = grown;
+            for_stack_cap = new_cap;
+        }
+        frame = &for_stack[for_stack_ptr++];
+    }
+
+    variables[var_slot] = start_val;
+    frame->var_slot = var_slot;
+    frame->end_value = end_val;
+    frame->step_value = step_val;
+    frame->line_index = line_index;
+    frame->body_pc = body_pc;
+
+    /* Check condition */
+    bool done = false;
+    if (step_val > 0 && start_val > end_val) done = true;
+    else if (step_val < 0 && start_val < end_val) done = true;
+
+    if (done) {
+        for_stack_ptr--;
+    } else {
+        prove_loop_bounds(line_index, start_val, end_val, step_val, true);
+    }
+    return !done;
+}
+
+/*
+ * Bounds-check elimination. As the loop on a FOR line starts, the range
+ * of its variable is known, so each recorded access in the body is proven
+ * in bounds for the whole run at once and switched to its unchecked form,
+ * or back to the checked one when the proof fails (runs is false if the
+ * loop could not be set up). Arrays only grow once dimensioned.
+ */
+void prove_loop_bounds(int line_index, int start_val, int end_val, int step_val, bool runs) {
+    long long lo = start_val, hi = start_val;
+    int i;
+
+    if (line_index < 0 || !program_linked || !loop_bounds_count || loop_bounds_count[line_index] == 0) {
+        return;
+    }
+
+    /* The variable takes values between start and end, unless stepping wraps */
+    if (step_val > 0) {
+        hi = end_val;
+        runs = runs && (long long)end_val + step_val <= INT_MAX;
+    } else if (step_val < 0) {
+        lo = end_val;
+        runs = runs && (long long)end_val + step_val >= INT_MIN;
+    }
+
+    for (i = loop_bounds_first[line_index]; i < loop_bounds_first[line_index] + loop_bounds_count[line_index]; i++) {
+        const BoundsAccess *access = &bounds_accesses[i];
+        Instr *ip = &linked_code[access->pc];
+        long long offset = access->offset;
+        bool proven;
+        int op;
+
+#if HAVE_JIT
+        if (ip->op == OP_JIT_ENTER) {
+            ip = &jit_regions[ip->a].original;
+        }
+#endif
+        if (access->offset_var >= 0) {
+            offset += variables[access->offset_var];
+        }
+        proven = runs && arrays[ip->a].allocated &&
+                 (access->uses_loop_var ? lo : 0) + offset >= 0 &&
+                 (access->uses_loop_var ? hi : 0) + offset < arrays[ip->a].size;
+
+        op = access->checked_op;
+        if (proven) {
+            switch (op) {
+                case OP_LOAD_ARRAY: op = OP_LOAD_ARRAY_FAST; break;
+                case OP_CHECK_INDEX: op = OP_CHECK_INDEX_FAST; break;
+                case OP_LOAD_ARRAY_VAR: op = OP_LOAD_ARRAY_VAR_FAST; break;
+                case OP_CHECK_INDEX_VAR: op = OP_CHECK_INDEX_VAR_FAST; break;
+            }
+        }
+        if (ip->op != op) {
+            ip->op = op;
+            thread_code(ip, 1);
+        }
+    }
+}
+
+/*
+ * Execute NEXT statement: step the variable and return the code address
+ * of the loop body if the loop continues, or -1 to fall through.
+ */
+int execute_next(int var_slot) {
+    if (for_stack_ptr > 0 && for_stack[for_stack_ptr - 1].var_slot == var_slot) {
+        ForStackEntry *frame = &for_stack[for_stack_ptr - 1];
+        int current_val = (variables[var_slot] += frame->step_value);
+
+        if ((frame->step_value > 0 && current_val > frame->end_value) ||
+            (frame->step_value < 0 && current_val < frame->end_value)) {
+            for_stack_ptr--;
+            return -1;
+        }
+        return frame->body_pc;
+    }
+    fprintf(stderr, "Error: NEXT without matching FOR\n");
+    return -1;
+}
+
+/* Find the NEXT of var_slot matching the FOR at for_index, or -1 if there is none */
+int find_matching_next(int for_index, int var_slot) {
+    const char *name = var_names.names[var_slot];
+    int len = strlen(name);
+    int nesting = 0;
+    int i;
+
+    for (i = for_index + 1; i < program_size; i++) {
+        const char *ptr = line_text(i);
+        while (*ptr && isspace(*ptr)) ptr++;
+
+        if (at_assignment(ptr)) {
+            continue;
+        } else if (strncasecmp(ptr, "FOR", 3) == 0) {
+            nesting++;
+        } else if (strncasecmp(ptr, "NEXT", 4) == 0) {
+            if (nesting == 0) {
+                const char *vptr = ptr + 4;
+                while (*vptr && isspace(*vptr)) vptr++;
+                if (name_length(vptr) == len && strncasecmp(vptr, name, len) == 0) {
+                    return i;
+                }
+            } else {
+                nesting--;
+            }
+        }
+    }
+    return -1;
+}
+
+/* Hash a line number into the line index */
+static unsigned int hash_line_number(int line_number) {
+    return ((unsigned int)line_number * 2654435761u) >> 7;
+}
+
+/* Rebuild the line number index after the program has changed */
+void build_line_index(void) {
+    int size = 16;
+    int i;
+
+    while (size < program_size * 2) {
+        size *= 2;
+    }
+    if (size - 1 != line_hash_mask || !line_hash) {
+        free(line_hash);
+        line_hash = (int *)malloc(size * sizeof(int));
+        if (!line_hash) {
+            fprintf(stderr, "Error: Memory allocation failed\n");
+            exit(1);
+        }
+        line_hash_mask = size - 1;
+    }
+    for (i = 0; i < size; i++) {
+        line_hash[i] = -1;
+    }
+
+    for (i = 0; i < program_size; i++) {
+        unsigned int slot = hash_line_number(line_numbers[i]) & line_hash_mask;
+        while (line_hash[slot] >= 0) {
+            slot = (slot + 1) & line_hash_mask;
+        }
+        line_hash[slot] = i;
+    }
+}
+
+/* Make sure linked_code and line_start can hold the whole program */
+static void reserve_linked_code(int instructions) {
+    if (instructions > linked_cap) {
+        int new_cap = linked_cap ? linked_cap : 256;
+        while (new_cap < instructions) {
+            new_cap *= 2;
+        }
+        Instr *grown = (Instr *)realloc(linked_code, new_cap * sizeof(Instr));
+        if (!grown) {
+            fprintf(stderr, "Error: Memory allocation failed\n");
+            exit(1);
+        }
+        linked_code = grown;
+        linked_cap = new_cap;
+    }
+    if (program_size + 1 > line_start_cap) {
+        int new_cap = program_size + 1;
+        int *grown = (int *)realloc(line_start, new_cap * sizeof(int));
+        if (!grown) {
+            fprintf(stderr, "Error: Memory allocation failed\n");
+            exit(1);
+        }
+        line_start = grown;
+        line_start_cap = new_cap;
+    }
+}
+
+/* True if a line outside lines first..last jumps into them */
+static bool jumps_into(int line, int first, int last) {
+    int k;
+
+    for (k = 0; k < opt_len[line]; k++) {
+        const Instr *ip = &opt_code[line][k];
+        int target = -1;
+        if (ip->op == OP_GOTO_LINE) {
+            target = find_line(ip->a);
+        } else if (ip->op == OP_RECORD && ip->c >= 0) {
+            target = find_line(ip->c);
+        } else if (ip->op == OP_IF_GOTO_VV || ip->op == OP_IF_GOTO_VC) {
+            target = find_line(ip->d);
+        } else if (ip->op == OP_FOR) {
+            /* A FOR that does not run continues after its NEXT */
+            target = find_matching_next(line, ip->a);
+            if (target >= 0) {
+                target++;
+            }
+        }
+        if (target >= first && target <= last) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/*
+ * True if the body of the FOR at line for_line, ending with the NEXT at
+ * next_line, can only be entered through the FOR: nothing jumps into it
+ * from outside and no other NEXT can resume it. Another NEXT of the same
+ * variable only matters if the body can be left with its frame live.
+ */
+static bool loop_is_closed(int for_line, int next_line, int var_slot) {
+    bool leaves = false;
+    int i, k;
+
+    for (i = for_line + 1; i <= next_line; i++) {
+        if (jumps_into(i, 0, for_line) || jumps_into(i, next_line + 1, program_size - 1)) {
+            leaves = true;
+        }
+    }
+    for (i = 0; i < program_size; i++) {
+        bool inside = i > for_line && i <= next_line;
+        for (k = 0; k < opt_len[i] && leaves; k++) {
+            if (opt_code[i][k].op == OP_NEXT && opt_code[i][k].a == var_slot && !inside) {
+                return false;
+            }
+        }
+        if (!inside && i != for_line && jumps_into(i, for_line + 1, next_line)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/* Insert instructions at the start of a line */
+static void prepend_code(int line, const Instr *code, int len) {
+    Instr *grown = (Instr *)realloc(opt_code[line], (opt_len[line] + len) * sizeof(Instr));
+    if (!grown) {
+        fprintf(stderr, "Error: Memory allocation failed\n");
+        exit(1);
+    }
+    memmove(grown + len, grown, opt_len[line] * sizeof(Instr));
+    memcpy(grown, code, len * sizeof(Instr));
+    opt_code[line] = grown;
+    opt_len[line] += len;
+}
+
+/*
+ * Loop-invariant code motion: expressions in a FOR body that only read
+ * variables the body never assigns are computed once, into a temporary,
+ * at the start of the FOR line. Loops are visited innermost first, so an
+ * expression hoisted out of an inner loop can move out of the outer one
+ * too. Index arithmetic such as B(I*W+J) in a J loop is reduced this way
+ * to one addition per iteration.
+ */
+static void hoist_loop_invariants(void) {
+    bool assigned[MAX_VARS + MAX_TEMPS];
+    Instr *hoisted = NULL;
+    int hoisted_cap = 0;
+    int next_temp = MAX_VARS + CSE_TEMPS;
+    int i, j, k;
+
+    /* A computed GOTO could enter any loop */
+    for (i = 0; i < program_size; i++) {
+        for (k = 0; k < opt_len[i]; k++) {
+            if (opt_code[i][k].op == OP_GOTO) {
+                return;
+            }
+        }
+    }
+
+    for (i = program_size - 1; i >= 0 && next_temp < MAX_VARS + MAX_TEMPS; i--) {
+        int hoisted_len = 0;
+        int for_slot = -1;
+        int next_line;
+
+        for (k = 0; k < opt_len[i]; k++) {
+            if (opt_code[i][k].op == OP_FOR) {
+                for_slot = opt_code[i][k].a;
+            }
+        }
+        if (for_slot < 0) {
+            continue;
+        }
+        next_line = find_matching_next(i, for_slot);
+        if (next_line < 0 || !loop_is_closed(i, next_line, for_slot)) {
+            continue;
+        }
+
+        memset(assigned, 0, sizeof(assigned));
+        for (j = i + 1; j <= next_line; j++) {
+            for (k = 0; k < opt_len[j]; k++) {
+                int slot = assigned_variable(&opt_code[j][k]);
+                if (slot >= 0) {
+                    assigned[slot] = true;
+                }
+            }
+        }
+
+        for (j = i + 1; j <= next_line; j++) {
+            Instr *c = opt_code[j];
+            int n = opt_len[j];
+            int out = 0;
+
+            k = 0;
+            while (k < n) {
+                int best_end = -1, end, m;
+
+                /* Longest invariant expression starting here */
+                for (end = k + 2; end <= n; end++) {
+                    if (expression_start(c, end) != k) {
+                        continue;
+                    }
+                    for (m = k; m < end; m++) {
+                        if (c[m].op == OP_LOAD_VAR && assigned[c[m].a]) {
+                            break;
+                        }
+                    }
+                    if (m == end) {
+                        best_end = end;
+                    }
+                }
+                if (best_end < 0 || next_temp >= MAX_VARS + MAX_TEMPS) {
+                    c[out++] = c[k++];
+                    continue;
+                }
+
+                /* Reuse the temporary of an identical hoisted expression */
+                int len = best_end - k;
+                int temp = -1;
+                for (m = 0; m + len < hoisted_len; m++) {
+                    if (hoisted[m + len].op == OP_STORE_VAR && same_code(hoisted + m, c + k, len) &&
+                        expression_start(hoisted, m + len) == m) {
+                        temp = hoisted[m + len].a;
+                        break;
+                    }
+                }
+                if (temp < 0) {
+                    if (hoisted_len + len + 1 > hoisted_cap) {
+                        hoisted_cap = (hoisted_len + len + 1) * 2;
+                        hoisted = (Instr *)realloc(hoisted, hoisted_cap * sizeof(Instr));
+                        if (!hoisted) {
+                            fprintf(stderr, "Error: Memory allocation failed\n");
+                            exit(1);
+                        }
+                    }
+                    temp = next_temp++;
+                    memcpy(hoisted + hoisted_len, c + k, len * sizeof(Instr));
+                    hoisted_len += len;
+                    hoisted[hoisted_len] = c[k];
+                    hoisted[hoisted_len].op = OP_STORE_VAR;
+                    hoisted[hoisted_len].a = temp;
+                    hoisted[hoisted_len].b = 0;
+                    hoisted_len++;
+                }
+                c[out] = c[k];
+                c[out].op = OP_LOAD_VAR;
+                c[out].a = temp;
+                c[out].b = 0;
+                out++;
+                k = best_end;
+            }
+            opt_len[j] = out;
+        }
+
+        if (hoisted_len > 0) {
+            prepend_code(i, hoisted, hoisted_len);
+        }
+    }
+    free(hoisted);
+}
+
+/*
+ * Describe the index computed by code[start..end) as a BoundsAccess: sums
+ * of the loop variable, constants and at most one variable the loop does
+ * not assign. Returns false for any other expression.
+ */
+static bool linear_index(const Instr *code, int start, int end, int loop_var,
+                         const bool *assigned, BoundsAccess *out) {
+    BoundsAccess stack[MAX_EVAL_STACK];
+    int sp = 0;
+    int i;
+
+    for (i = start; i < end; i++) {
+        const Instr *ip = &code[i];
+        BoundsAccess *x, *y;
+
+        switch (ip->op) {
+            case OP_PUSH_INT:
+            case OP_LOAD_VAR:
+                if (sp >= MAX_EVAL_STACK) {
+                    return false;
+                }
+                x = &stack[sp++];
+                x->uses_loop_var = false;
+                x->offset = 0;
+                x->offset_var = -1;
+                if (ip->op == OP_PUSH_INT) {
+                    x->offset = ip->a;
+                } else if (ip->a == loop_var) {
+                    x->uses_loop_var = true;
+                } else if (!assigned[ip->a]) {
+                    x->offset_var = ip->a;
+                } else {
+                    return false;
+                }
+                break;
+            case OP_ADD_CONST:
+                stack[sp - 1].offset += ip->a;
+                break;
+            case OP_ADD:
+                x = &stack[sp - 2];
+                y = &stack[sp - 1];
+                if ((x->uses_loop_var && y->uses_loop_var) || (x->offset_var >= 0 && y->offset_var >= 0)) {
+                    return false;
+                }
+                x->uses_loop_var = x->uses_loop_var || y->uses_loop_var;
+                x->offset += y->offset;
+                if (y->offset_var >= 0) {
+                    x->offset_var = y->offset_var;
+                }
+                sp--;
+                break;
+            case OP_SUB:
+                x = &stack[sp - 2];
+                y = &stack[sp - 1];
+                if (y->uses_loop_var || y->offset_var >= 0) {
+                    return false;
+                }
+                x->offset -= y->offset;
+                sp--;
+                break;
+            default:
+                return false;
+        }
+    }
+    if (sp != 1) {
+        return false;
+    }
+    *out = stack[0];
+    return true;
+}
+
+/* True if an access is already proven by an inner loop */
+static bool access_recorded(int line, int pc) {
+    int i;
+
+    for (i = 0; i < bounds_access_count; i++) {
+        if (bounds_accesses[i].line == line && bounds_accesses[i].pc == pc) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/*
+ * Record the array accesses in closed FOR loops whose checks
+ * prove_loop_bounds() can do once per run of the loop. The loop variable
+ * must be assigned only by the NEXT that ends the body, and nothing on the
+ * FOR line may skip the FOR and fall into the body. Loops are visited
+ * innermost first, so an access belongs to the innermost loop that can
+ * prove it.
+ */
+static void find_provable_accesses(void) {
+    bool assigned[MAX_VARS + MAX_TEMPS];
+    BoundsAccess known[MAX_VARS + MAX_TEMPS];
+    bool tee_known[MAX_VARS + MAX_TEMPS];
+    int i, j, k;
+
+    bounds_access_count = 0;
+    if (program_size > loop_bounds_cap) {
+        int *grown_first = (int *)realloc(loop_bounds_first, program_size * sizeof(int));
+        int *grown_count = grown_first ? (int *)realloc(loop_bounds_count, program_size * sizeof(int)) : NULL;
+        if (!grown_first || !grown_count) {
+            fprintf(stderr, "Error: Memory allocation failed\n");
+            exit(1);
+        }
+        loop_bounds_first = grown_first;
+        loop_bounds_count = grown_count;
+        loop_bounds_cap = program_size;
+    }
+    memset(loop_bounds_count, 0, program_size * sizeof(int));
+
+    if (!optimize_enabled) {
+        return;
+    }
+    for (i = 0; i < program_size; i++) {
+        for (k = 0; k < opt_len[i]; k++) {
+            if (opt_code[i][k].op == OP_GOTO) {
+                return;
+            }
+        }
+    }
+
+    for (i = program_size - 1; i >= 0; i--) {
+        int for_slot = -1;
+        int next_line;
+        bool usable = true;
+
+        for (k = 0; k < opt_len[i] && for_slot < 0; k++) {
+            const Instr *ip = &opt_code[i][k];
+            if (ip->op == OP_FOR) {
+                for_slot = ip->a;
+            } else if (has_line_target(ip->op) || ip->op == OP_GOTO_LINE ||
+                       ip->op == OP_IF_GOTO_VV || ip->op == OP_IF_GOTO_VC) {
+                break;
+            }
+        }
+        if (for_slot < 0) {
+            continue;
+        }
+        next_line = find_matching_next(i, for_slot);
+        if (next_line < 0 || !loop_is_closed(i, next_line, for_slot)) {
+            continue;
+        }
+
+        memset(assigned, 0, sizeof(assigned));
+        for (j = i + 1; j <= next_line; j++) {
+            for (k = 0; k < opt_len[j]; k++) {
+                int slot = assigned_variable(&opt_code[j][k]);
+                if (slot == for_slot && (opt_code[j][k].op != OP_NEXT || j != next_line)) {
+                    usable = false;
+                }
+                if (slot >= 0) {
+                    assigned[slot] = true;
+                }
+            }
+        }
+        if (!usable) {
+            continue;
+        }
+
+        loop_bounds_first[i] = bounds_access_count;
+        for (j = i + 1; j <= next_line; j++) {
+            const Instr *c = opt_code[j];
+
+            /* Scratch values kept by OP_TEE_VAR earlier in the line */
+            memset(tee_known, 0, sizeof(tee_known));
+            for (k = 0; k < opt_len[j]; k++) {
+                BoundsAccess access;
+                int slot = assigned_variable(&c[k]);
+                bool found = false;
+                int start;
+
+                if (slot >= 0) {
+                    tee_known[slot] = false;
+                }
+                switch (c[k].op) {
+                    case OP_TEE_VAR:
+                        start = expression_start(c, k);
+                        if (start >= 0 && linear_index(c, start, k, for_slot, assigned, &known[slot])) {
+                            tee_known[slot] = true;
+                        }
+                        continue;
+                    case OP_LOAD_ARRAY_VAR:
+                    case OP_CHECK_INDEX_VAR:
+                        if (c[k].b == for_slot || !assigned[c[k].b]) {
+                            access.uses_loop_var = c[k].b == for_slot;
+                            access.offset = 0;
+                            access.offset_var = access.uses_loop_var ? -1 : c[k].b;
+                            found = true;
+                        } else if (tee_known[c[k].b]) {
+                            access = known[c[k].b];
+                            found = true;
+                        }
+                        break;
+                    case OP_LOAD_ARRAY:
+                    case OP_CHECK_INDEX:
+                        if (k > 0 && c[k - 1].op == OP_TEE_VAR && tee_known[c[k - 1].a]) {
+                            access = known[c[k - 1].a];
+                            found = true;
+                        } else {
+                            start = expression_start(c, k);
+                            found = start >= 0 && linear_index(c, start, k, for_slot, assigned, &access);
+                        }
+                        break;
+                }
+                if (!found || access_recorded(j, k)) {
+                    continue;
+                }
+
+                if (bounds_access_count >= bounds_access_cap) {
+                    int new_cap = bounds_access_cap ? bounds_access_cap * 2 : 64;
+                    BoundsAccess *grown = (BoundsAccess *)realloc(bounds_accesses, new_cap * sizeof(BoundsAccess));
+                    if (!grown) {
+                        fprintf(stderr, "Error: Memory allocation failed\n");
+                        exit(1);
+                    }
+                    bounds_accesses = grown;
+                    bounds_access_cap = new_cap;
+                }
+                access.pc = k;
+                access.line = j;
+                access.checked_op = c[k].op;
+                bounds_accesses[bounds_access_count++] = access;
+            }
+        }
+        loop_bounds_count[i] = bounds_access_count - loop_bounds_first[i];
+    }
+}
+
+/*
+ * Build the code that link_program() concatenates: a copy of each line's
+ * code, optimized across lines when the optimizer is on.
+ */
+static void optimize_program(void) {
+    int i, k;
+
+    if (program_size > opt_cap) {
+        Instr **grown_code = (Instr **)realloc(opt_code, program_size * sizeof(Instr *));
+        int *grown_len = grown_code ? (int *)realloc(opt_len, program_size * sizeof(int)) : NULL;
+        if (!grown_code || !grown_len) {
+            fprintf(stderr, "Error: Memory allocation failed\n");
+            exit(1);
+        }
+        opt_code = grown_code;
+        opt_len = grown_len;
+        opt_cap = program_size;
+    }
+
+    for (i = 0; i < program_size; i++) {
+        opt_len[i] = program[i].code_len;
+        opt_code[i] = (Instr *)malloc((opt_len[i] + 1) * sizeof(Instr));
+        if (!opt_code[i]) {
+            fprintf(stderr, "Error: Memory allocation failed\n");
+            exit(1);
+        }
+        memcpy(opt_code[i], program[i].code, opt_len[i] * sizeof(Instr));
+        /* Line exits go back to meaning "end of line" while code moves */
+        for (k = 0; k < opt_len[i]; k++) {
+            if (has_line_target(opt_code[i][k].op) && opt_code[i][k].target == opt_len[i]) {
+                opt_code[i][k].target = TARGET_LINE_END;
+            }
+        }
+    }
+
+    if (optimize_enabled) {
+        hoist_loop_invariants();
+    }
+
+    for (i = 0; i < program_size; i++) {
+        opt_len[i] = fuse_superinstructions(opt_code[i], opt_len[i]);
+        for (k = 0; k < opt_len[i]; k++) {
+            if (has_line_target(opt_code[i][k].op) && opt_code[i][k].target == TARGET_LINE_END) {
+                opt_code[i][k].target = opt_len[i];
+            }
+        }
+    }
+
+    find_provable_accesses();
+}
+
+/* Append a DATA constant to the pool READ takes items from */
+static void add_data_item(int line_number, const Instr *ip) {
+    if (data_count == data_cap) {
+        int new_cap = data_cap ? data_cap * 2 : 64;
+        DataItem *grown = (DataItem *)realloc(data_items, new_cap * sizeof(DataItem));
+        if (!grown) {
+            fprintf(stderr, "Error: Memory allocation failed\n");
+            exit(1);
+        }
+        data_items = grown;
+        data_cap = new_cap;
+    }
+    data_items[data_count].line_number = line_number;
+    data_items[data_count].value = ip->a;
+    data_items[data_count].len = ip->b;
+    data_count++;
+}
+
+/*
+ * Link the program before running: optimize it, concatenate the code of all
+ * lines so execution flows from one line into the next, relocate jumps, resolve
+ * constant GOTO targets and FOR/NEXT pairs, gather the DATA items, and thread
+ * the result.
+ */
+void link_program(void) {
+    int total = 1;
+    int i, j;
+
+    build_line_index();
+    program_linked = true;
+    optimize_program();
+
+    for (i = 0; i < program_size; i++) {
+        total += opt_len[i];
+    }
+    reserve_linked_code(total);
+
+    total = 0;
+    for (i = 0; i < program_size; i++) {
+        line_start[i] = total;
+        total += opt_len[i];
+    }
+    line_start[program_size] = total;
+    data_count = 0;
+
+    for (i = 0; i < program_size; i++) {
+        for (j = 0; j < opt_len[i]; j++) {
+            Instr *ip = &linked_code[line_start[i] + j];
+            *ip = opt_code[i][j];
+            if (has_line_target(ip->op)) {
+                ip->target += line_start[i];
+            } else if (ip->op == OP_GOTO_LINE) {
+                ip->b = find_line(ip->a);
+                ip->target = ip->b >= 0 ? line_start[ip->b] : -1;
+            } else if (ip->op == OP_IF_GOTO_VV || ip->op == OP_IF_GOTO_VC) {
+                int index = find_line(ip->d);
+                ip->target = index >= 0 ? line_start[index] : -1;
+            } else if (ip->op == OP_FOR) {
+                ip->b = find_matching_next(i, ip->a);
+                ip->c = i;
+                ip->target = ip->b >= 0 ? line_start[ip->b + 1] : -1;
+            } else if (ip->op == OP_DATA) {
+                add_data_item(line_numbers[i], ip);
+            } else if (ip->op == OP_RECORD) {
+                int index = ip->c >= 0 ? find_line(ip->c) : program_size;
+                ip->target = index >= 0 ? line_start[index] : -1;
+            }
+        }
+    }
+
+    for (i = 0; i < bounds_access_count; i++) {
+        bounds_accesses[i].pc += line_start[bounds_accesses[i].line];
+    }
+
+    for (i = 0; i < program_size; i++) {
+        free(opt_code[i]);
+    }
+
+    linked_code[total].op = OP_HALT;
+    thread_code(linked_code, total + 1);
+
+    jit_reset();
+    if (jit_enabled) {
+        jit_find_regions();
+    }
+}
+
+/* Instruction at a linked_code address, looking through JIT loop heads */
+static const Instr *linked_instr(int pc) {
+    const Instr *ip = &linked_code[pc];
+#if HAVE_JIT
+    if (ip->op == OP_JIT_ENTER) {
+        return &jit_regions[ip->a].original;
+    }
+#endif
+    return ip;
+}
+
+/* Index of the line containing a linked_code address */
+static int line_index_of(int pc) {
+    int lo = 0, hi = program_size - 1;
+    while (lo < hi) {
+        int mid = (lo + hi + 1) / 2;
+        if (line_start[mid] <= pc) {
+            lo = mid;
+        } else {
+            hi = mid - 1;
+        }
+    }
+    return lo;
+}
+
+/* Change in operand stack depth (ints, or strings if strings is set) */
+static int stack_effect(const Instr *ip, bool strings) {
+    switch (ip->op) {
+        case OP_PUSH_INT: case OP_LOAD_VAR: case OP_LOAD_ARRAY_VAR: case OP_LOAD_ARRAY_VAR_FAST:
+            return strings ? 0 : 1;
+        case OP_PUSH_STR: case OP_LOAD_STR:
+            return strings ? 1 : 0;
+        case OP_ADD: case OP_SUB: case OP_MUL: case OP_DIV: case OP_POP_INT:
+        case OP_CMP: case OP_JUMP_IF_FALSE: case OP_PRINT_INT: case OP_STORE_VAR:
+        case OP_GOTO: case OP_INPUT_ARRAY: case OP_READ_ARRAY: case OP_STORE_ARRAY_VAR:
+        case OP_LEFT: case OP_RIGHT:
+            return strings ? 0 : -1;
+        case OP_MID: case OP_STORE_ARRAY:
+            return strings ? 0 : -2;
+        case OP_LOAD_ARRAY_N: case OP_CHECK_INDEX_N:
+            return strings ? 0 : 1 - ip->b;
+        case OP_DIM: case OP_REDIM:
+            return strings ? 0 : -ip->b;
+        case OP_MAT:
+            return strings || ip->b != MAT_SCALE ? 0 : -1;
+        case OP_REDUCE:
+            return strings ? 0 : 1 - ip->d - (ip->b == REDUCE_COUNT);
+        case OP_SCAN: case OP_SORT:
+            return strings ? 0 : -ip->d;
+        case OP_LOAD_MAP: case OP_HAS_MAP:
+            return strings ? -ip->b : ip->b;
+        case OP_STORE_MAP:
+            return strings ? -ip->b : ip->b - 2;
+        case OP_DEL_MAP:
+            return strings ? -ip->b : ip->b - 1;
+        case OP_DIM_FILE:
+            return strings ? -1 : -ip->b;
+        case OP_FOR:
+            return strings ? 0 : -3;
+        case OP_INSTR:
+            return strings ? -2 : (ip->a ? 0 : 1);
+        case OP_STR_CMP:
+            return strings ? -2 : 1;
+        case OP_POP_STR: case OP_PRINT_STR: case OP_STORE_STR: case OP_CONCAT: case OP_OPEN:
+            return strings ? -1 : 0;
+    }
+    return 0;
+}
+
+#if HAVE_JIT
+/*
+ * x86-64 loop JIT.
+ *
+ * A region is compiled into a function that runs the loop natively and
+ * returns the linked_code address at which the interpreter continues.
+ * Operand stack values live in eax (top) and on the machine stack; rbx
+ * holds the stack pointer at entry, r12 points to variables[] and r13 to
+ * arrays[]. Work that native code does not cover (strings, PRINT, INPUT,
+ * failed checks, ...) leaves the function at the start of that statement,
+ * or of its line for failed checks, so the interpreter redoes it with
+ * identical results and error messages. A negative return value -(pc + 1)
+ * marks such a bail-out and keeps the interpreter from re-entering the
+ * same loop head straight away.
+ */
+
+/* x86 condition codes */
+enum {
+    CC_E = 0x4,
+    CC_NE = 0x5,
+    CC_AE = 0x3,
+    CC_S = 0x8,
+    CC_L = 0xC,
+    CC_GE = 0xD,
+    CC_LE = 0xE,
+    CC_G = 0xF,
+    CC_ALWAYS = -1
+};
+
+/* Append one byte of machine code */
+static void jit_byte(int b) {
+    if (jit_len >= jit_cap) {
+        int new_cap = jit_cap ? jit_cap * 2 : 4096;
+        unsigned char *grown = (unsigned char *)realloc(jit_buf, new_cap);
+        if (!grown) {
+            fprintf(stderr, "Error: Memory allocation failed\n");
+            exit(1);
+        }
+        jit_buf = grown;
+        jit_cap = new_cap;
+    }
+    jit_buf[jit_len++] = (unsigned char)b;
+}
+
+/* Append a little-endian 32-bit value */
+static void jit_u32(uint32_t v) {
+    jit_byte(v & 0xFF);
+    jit_byte((v >> 8) & 0xFF);
+    jit_byte((v >> 16) & 0xFF);
+    jit_byte((v >> 24) & 0xFF);
+}
+
+/* Append a little-endian 64-bit value */
+static void jit_u64(uint64_t v) {
+    jit_u32((uint32_t)v);
+    jit_u32((uint32_t)(v >> 32));
+}
+
+/* Append a rel32 field to be patched with the address of target */
+static void jit_rel32(int target) {
+    if (jit_fixup_count >= jit_fixup_cap) {
+        int new_cap = jit_fixup_cap ? jit_fixup_cap * 2 : 64;
+        JitFixup *grown = (JitFixup *)realloc(jit_fixups, new_cap * sizeof(JitFixup));
+        if (!grown) {
+            fprintf(stderr, "Error: Memory allocation failed\n");
+            exit(1);
+        }
+        jit_fixups = grown;
+        jit_fixup_cap = new_cap;
+    }
+    jit_fixups[jit_fixup_count].pos = jit_len;
+    jit_fixups[jit_fixup_count].target = target;
+    jit_fixup_count++;
+    jit_u32(0);
+}
+
+/* Start a short forward jump; returns the offset to hand to jit_patch8() */
+static int jit_jcc8(int cc) {
+    jit_byte(cc == CC_ALWAYS ? 0xEB : 0x70 + cc);
+    jit_byte(0);
+    return jit_len;
+}
+
+/* Point a short forward jump at the current position */
+static void jit_patch8(int after) {
+    jit_buf[after - 1] = (unsigned char)(jit_len - after);
+}
+
+/* mov/cmp-style instruction with a [r12 + disp32] variable operand */
+static void jit_var_op(int opcode, int reg, int slot) {
+    jit_byte(0x41);
+    jit_byte(opcode);
+    jit_byte(0x84 | (reg << 3));
+    jit_byte(0x24);
+    jit_u32(slot * sizeof(int));
+}
+
+/* mov eax/ecx, variables[slot] */
+static void jit_load_var(int reg, int slot) {
+    jit_var_op(0x8B, reg, slot);
+}
+
+/* mov variables[slot], eax/ecx */
+static void jit_store_var(int reg, int slot) {
+    jit_var_op(0x89, reg, slot);
+}
+
+/* Leave the native code, returning value, if condition cc holds */
+static void jit_exit_if(int cc, int value) {
+    int skip = cc == CC_ALWAYS ? -1 : jit_jcc8(cc ^ 1);
+    jit_byte(0xB8);                             /* mov eax, value */
+    jit_u32((uint32_t)value);
+    jit_byte(0xE9);                             /* jmp exit */
+    jit_rel32(JIT_EXIT_LABEL);
+    if (skip >= 0) {
+        jit_patch8(skip);
+    }
+}
+
+/* Jump to a linked_code address, inside the region or out of it */
+static void jit_branch(int cc, int target, int start, int end) {
+    if (target >= start && target < end) {
+        if (cc == CC_ALWAYS) {
+            jit_byte(0xE9);
+        } else {
+            jit_byte(0x0F);
+            jit_byte(0x80 + cc);
+        }
+        jit_rel32(target);
+    } else {
+        jit_exit_if(cc, target);
+    }
+}
+
+/* Make room for a new top of stack in eax */
+static void jit_push_tos(void) {
+    if (jit_depth > 0) {
+        jit_byte(0x50);                         /* push rax */
+    }
+    jit_depth++;
+}
+
+/* Discard the top of stack, reloading eax from the machine stack */
+static void jit_pop_tos(void) {
+    jit_depth--;
+    if (jit_depth > 0) {
+        jit_byte(0x58);                         /* pop rax */
+    }
+}
+
+/* Pop the value below the top of stack into ecx */
+static void jit_pop_second(void) {
+    jit_byte(0x59);                             /* pop rcx */
+    jit_depth--;
+}
+
+/* Bail out unless reg (eax or ecx) is below the 64-bit field at offset in arrays[] */
+static void jit_check_bound(int reg, size_t offset, int bail) {
+    jit_byte(0x48);                             /* movsxd reg, reg */
+    jit_byte(0x63);
+    jit_byte(0xC0 | (reg << 3) | reg);
+    jit_byte(0x49);                             /* cmp reg, [r13 + offset] */
+    jit_byte(0x3B);
+    jit_byte(0x85 | (reg << 3));
+    jit_u32(offset);
+    jit_exit_if(CC_AE, bail);
+}
+
+/* Bail out unless reg (eax or ecx) indexes into array arr_idx */
+static void jit_check_index(int reg, int arr_idx, int bail) {
+    jit_check_bound(reg, arr_idx * sizeof(Array) + offsetof(Array, size), bail);
+}
+
+/*
+ * Replace count indices (the last in eax) by the offset of their element
+ * in array arr_idx, bailing out if the array has another shape or any
+ * index is out of its range.
+ */
+static void jit_element_offset(int arr_idx, int count, int bail) {
+    size_t base = arr_idx * sizeof(Array);
+    int k;
+
+    jit_byte(0x41); jit_byte(0x81); jit_byte(0xBD); /* cmp dword [r13 + dims], count */
+    jit_u32(base + offsetof(Array, dims));
+    jit_u32((uint32_t)count);
+    jit_exit_if(CC_NE, bail);
+    jit_check_bound(0, base + offsetof(Array, extent) + (count - 1) * sizeof(long long), bail);
+    for (k = count - 2; k >= 0; k--) {
+        jit_pop_second();
+        jit_check_bound(1, base + offsetof(Array, extent) + k * sizeof(long long), bail);
+        jit_byte(0x49); jit_byte(0x0F); jit_byte(0xAF); jit_byte(0x8D); /* imul rcx, [r13 + stride] */
+        jit_u32(base + offsetof(Array, stride) + k * sizeof(long long));
+        jit_byte(0x48); jit_byte(0x01); jit_byte(0xC8); /* add rax, rcx */
+    }
+}
+
+/* mov rdx, arrays[arr_idx].data */
+static void jit_load_array_data(int arr_idx) {
+    jit_byte(0x49);
+    jit_byte(0x8B);
+    jit_byte(0x95);
+    jit_u32(arr_idx * sizeof(Array) + offsetof(Array, data));
+}
+
+/* x86 condition code for a comparison kind, or -1 for CMP_NONE */
+static int jit_condition(int cmp) {
+    switch (cmp) {
+        case CMP_EQ: return CC_E;
+        case CMP_LT: return CC_L;
+        case CMP_GT: return CC_G;
+        case CMP_LE: return CC_LE;
+        case CMP_GE: return CC_GE;
+        case CMP_NE: return CC_NE;
+    }
+    return -1;
+}
+
+/* True if the JIT can compile an instruction */
+static bool jit_supported(int op) {
+    switch (op) {
+        case OP_PUSH_INT: case OP_LOAD_VAR: case OP_LOAD_ARRAY: case OP_ADD:
+        case OP_SUB: case OP_MUL: case OP_DIV: case OP_POP_INT: case OP_CMP:
+        case OP_JUMP_IF_FALSE: case OP_STORE_VAR: case OP_CHECK_INDEX:
+        case OP_STORE_ARRAY: case OP_GOTO_LINE: case OP_FOR: case OP_NEXT:
+        case OP_INC_VAR: case OP_ADD_CONST: case OP_LOAD_ARRAY_VAR:
+        case OP_CHECK_INDEX_VAR: case OP_STORE_ARRAY_VAR: case OP_IF_GOTO_VV:
+        case OP_IF_GOTO_VC: case OP_TEE_VAR: case OP_LOAD_ARRAY_FAST:
+        case OP_CHECK_INDEX_FAST: case OP_LOAD_ARRAY_VAR_FAST: case OP_CHECK_INDEX_VAR_FAST:
+        case OP_LOAD_ARRAY_N: case OP_CHECK_INDEX_N:
+            return true;
+    }
+    return false;
+}
+
+/* Emit NEXT: step the top FOR frame and branch to its body */
+static void jit_emit_next(const Instr *ip, int pc, int bail, int start, int end) {
+    int skip_zero, skip_negative, skip_positive, skip_done_negative;
+    int p;
+
+    jit_byte(0x48);                             /* mov rsi, &for_stack_ptr */
+    jit_byte(0xBE);
+    jit_u64((uint64_t)(uintptr_t)&for_stack_ptr);
+    jit_byte(0x8B); jit_byte(0x16);             /* mov edx, [rsi] */
+    jit_byte(0x85); jit_byte(0xD2);             /* test edx, edx */
+    jit_exit_if(CC_E, bail);
+    jit_byte(0x48);                             /* mov rcx, &for_stack */
+    jit_byte(0xB9);
+    jit_u64((uint64_t)(uintptr_t)&for_stack);
+    jit_byte(0x48); jit_byte(0x8B); jit_byte(0x09); /* mov rcx, [rcx] */
+    jit_byte(0xFF); jit_byte(0xCA);             /* dec edx */
+    jit_byte(0x69); jit_byte(0xD2);             /* imul edx, edx, sizeof(ForStackEntry) */
+    jit_u32(sizeof(ForStackEntry));
+    jit_byte(0x48); jit_byte(0x01); jit_byte(0xD1); /* add rcx, rdx */
+    jit_byte(0x81); jit_byte(0x79);             /* cmp dword [rcx + var_slot], slot */
+    jit_byte(offsetof(ForStackEntry, var_slot));
+    jit_u32(ip->a);
+    jit_exit_if(CC_NE, bail);
+
+    jit_load_var(0, ip->a);
+    jit_byte(0x03); jit_byte(0x41);             /* add eax, [rcx + step_value] */
+    jit_byte(offsetof(ForStackEntry, step_value));
+    jit_store_var(0, ip->a);
+    jit_byte(0x8B); jit_byte(0x51);             /* mov edx, [rcx + step_value] */
+    jit_byte(offsetof(ForStackEntry, step_value));
+    jit_byte(0x85); jit_byte(0xD2);             /* test edx, edx */
+    skip_zero = jit_jcc8(CC_E);
+    skip_negative = jit_jcc8(CC_S);
+    jit_byte(0x3B); jit_byte(0x41);             /* cmp eax, [rcx + end_value] */
+    jit_byte(offsetof(ForStackEntry, end_value));
+    skip_positive = jit_jcc8(CC_LE);
+    p = jit_jcc8(CC_ALWAYS);                    /* done */
+    jit_patch8(skip_negative);
+    jit_byte(0x3B); jit_byte(0x41);             /* cmp eax, [rcx + end_value] */
+    jit_byte(offsetof(ForStackEntry, end_value));
+    skip_done_negative = jit_jcc8(CC_L);
+
+    /* Continue: branch to the body recorded in the frame */
+    jit_patch8(skip_zero);
+    jit_patch8(skip_positive);
+    jit_byte(0x8B); jit_byte(0x41);             /* mov eax, [rcx + body_pc] */
+    jit_byte(offsetof(ForStackEntry, body_pc));
+    for (int i = start; i < end; i++) {
+        const Instr *loop = linked_instr(i);
+        if (i == start || (loop->op == OP_FOR && i + 1 < end && loop->b >= 0 &&
+                           line_start[loop->b] <= pc && pc < line_start[loop->b + 1])) {
+            int body = i == start ? start : i + 1;
+            jit_byte(0x3D);                     /* cmp eax, body */
+            jit_u32(body);
+            jit_byte(0x0F);
+            jit_byte(0x80 + CC_E);
+            jit_rel32(body);
+        }
+    }
+    jit_byte(0xE9);                             /* jmp exit with eax */
+    jit_rel32(JIT_EXIT_LABEL);
+
+    /* Done: pop the frame */
+    jit_patch8(p);
+    jit_patch8(skip_done_negative);
+    jit_byte(0xFF); jit_byte(0x0E);             /* dec dword [rsi] */
+}
+
+/* Emit FOR through execute_for() */
+static void jit_emit_for(const Instr *ip, int pc, int bail, int start, int end) {
+    int skip;
+
+    if (ip->b < 0) {
+        /* No matching NEXT: let the interpreter report it */
+        jit_exit_if(CC_ALWAYS, bail);
+        return;
+    }
+    jit_byte(0x89); jit_byte(0xC1);             /* mov ecx, eax (step) */
+    jit_byte(0x5A);                             /* pop rdx (end) */
+    jit_byte(0x5E);                             /* pop rsi (start) */
+    jit_depth = 0;
+    jit_byte(0xBF);                             /* mov edi, var_slot */
+    jit_u32(ip->a);
+    jit_byte(0x41); jit_byte(0xB8);             /* mov r8d, line_index */
+    jit_u32(ip->c);
+    jit_byte(0x41); jit_byte(0xB9);             /* mov r9d, body_pc */
+    jit_u32(pc + 1);
+    jit_byte(0x48); jit_byte(0xB8);             /* mov rax, execute_for */
+    jit_u64((uint64_t)(uintptr_t)&execute_for);
+    jit_byte(0xFF); jit_byte(0xD0);             /* call rax */
+    jit_byte(0x84); jit_byte(0xC0);             /* test al, al */
+    skip = jit_jcc8(CC_NE);
+    jit_branch(CC_ALWAYS, ip->target, start, end);
+    jit_patch8(skip);
+}
+
+/* Emit native code for one supported instruction */
+static void jit_emit_instr(const Instr *ip, int pc, int start, int end) {
+    int bail = -(line_start[line_index_of(pc)] + 1);
+    int cc, skip;
+
+    switch (ip->op) {
+        case OP_PUSH_INT:
+            jit_push_tos();
+            jit_byte(0xB8);                     /* mov eax, value */
+            jit_u32((uint32_t)ip->a);
+            break;
+        case OP_LOAD_VAR:
+            jit_push_tos();
+            jit_load_var(0, ip->a);
+            break;
+        /* Proofs hold only for one run of a loop, so compiled code keeps its checks */
+        case OP_LOAD_ARRAY_VAR:
+        case OP_LOAD_ARRAY_VAR_FAST:
+            jit_push_tos();
+            jit_load_var(0, ip->b);
+            /* fall through */
+        case OP_LOAD_ARRAY:
+        case OP_LOAD_ARRAY_FAST:
+            jit_check_index(0, ip->a, bail);
+            jit_load_array_data(ip->a);
+            jit_byte(0x8B); jit_byte(0x04); jit_byte(0x82); /* mov eax, [rdx + rax*4] */
+            break;
+        case OP_LOAD_ARRAY_N:
+            jit_element_offset(ip->a, ip->b, bail);
+            jit_load_array_data(ip->a);
+            jit_byte(0x8B); jit_byte(0x04); jit_byte(0x82); /* mov eax, [rdx + rax*4] */
+            break;
+        case OP_CHECK_INDEX_N:
+            jit_element_offset(ip->a, ip->b, bail);
+            break;
+        case OP_ADD:
+            jit_pop_second();
+            jit_byte(0x01); jit_byte(0xC8);     /* add eax, ecx */
+            break;
+        case OP_SUB:
+            jit_pop_second();
+            jit_byte(0x29); jit_byte(0xC1);     /* sub ecx, eax */
+            jit_byte(0x89); jit_byte(0xC8);     /* mov eax, ecx */
+            break;
+        case OP_MUL:
+            jit_pop_second();
+            jit_byte(0x0F); jit_byte(0xAF); jit_byte(0xC1); /* imul eax, ecx */
+            break;
+        case OP_DIV:
+            jit_pop_second();
+            jit_byte(0x85); jit_byte(0xC0);     /* test eax, eax */
+            jit_exit_if(CC_E, bail);
+            jit_byte(0x83); jit_byte(0xF8); jit_byte(0xFF); /* cmp eax, -1 */
+            skip = jit_jcc8(CC_NE);
+            jit_byte(0x81); jit_byte(0xF9);     /* cmp ecx, INT_MIN */
+            jit_u32(0x80000000u);
+            jit_exit_if(CC_E, bail);
+            jit_patch8(skip);
+            jit_byte(0x41); jit_byte(0x89); jit_byte(0xC0); /* mov r8d, eax */
+            jit_byte(0x89); jit_byte(0xC8);     /* mov eax, ecx */
+            jit_byte(0x99);                     /* cdq */
+            jit_byte(0x41); jit_byte(0xF7); jit_byte(0xF8); /* idiv r8d */
+            break;
+        case OP_ADD_CONST:
+            jit_byte(0x05);                     /* add eax, value */
+            jit_u32((uint32_t)ip->a);
+            break;
+        case OP_POP_INT:
+            jit_pop_tos();
+            break;
+        case OP_CMP:
+            jit_pop_second();
+            cc = jit_condition(ip->a);
+            if (cc < 0) {
+                jit_byte(0x31); jit_byte(0xC0); /* xor eax, eax */
+            } else {
+                jit_byte(0x39); jit_byte(0xC1); /* cmp ecx, eax */
+                jit_byte(0x0F); jit_byte(0x90 + cc); jit_byte(0xC0); /* setcc al */
+                jit_byte(0x0F); jit_byte(0xB6); jit_byte(0xC0); /* movzx eax, al */
+            }
+            break;
+        case OP_JUMP_IF_FALSE:
+            jit_byte(0x85); jit_byte(0xC0);     /* test eax, eax */
+            jit_pop_tos();
+            jit_branch(CC_E, ip->target, start, end);
+            break;
+        case OP_STORE_VAR:
+            jit_store_var(0, ip->a);
+            jit_pop_tos();
+            break;
+        case OP_TEE_VAR:
+            jit_store_var(0, ip->a);
+            break;
+        case OP_CHECK_INDEX:
+        case OP_CHECK_INDEX_FAST:
+            jit_check_index(0, ip->a, bail);
+            break;
+        case OP_CHECK_INDEX_VAR:
+        case OP_CHECK_INDEX_VAR_FAST:
+            jit_load_var(1, ip->b);
+            jit_check_index(1, ip->a, bail);
+            break;
+        case OP_STORE_ARRAY:
+            jit_pop_second();
+            jit_load_array_data(ip->a);
+            jit_byte(0x89); jit_byte(0x04); jit_byte(0x8A); /* mov [rdx + rcx*4], eax */
+            jit_pop_tos();
+            break;
+        case OP_STORE_ARRAY_VAR:
+            jit_load_var(1, ip->b);
+            jit_load_array_data(ip->a);
+            jit_byte(0x89); jit_byte(0x04); jit_byte(0x8A); /* mov [rdx + rcx*4], eax */
+            jit_pop_tos();
+            break;
+        case OP_INC_VAR:
+            jit_load_var(1, ip->b);
+            jit_byte(0x81); jit_byte(0xC1);     /* add ecx, value */
+            jit_u32((uint32_t)ip->c);
+            jit_store_var(1, ip->a);
+            break;
+        case OP_GOTO_LINE:
+            if (ip->target < 0) {
+                jit_exit_if(CC_ALWAYS, bail);
+            } else {
+                jit_branch(CC_ALWAYS, ip->target, start, end);
+            }
+            break;
+        case OP_IF_GOTO_VV:
+        case OP_IF_GOTO_VC:
+            cc = jit_condition(ip->c);
+            if (cc < 0) {
+                break;
+            }
+            jit_load_var(1, ip->a);
+            if (ip->op == OP_IF_GOTO_VV) {
+                jit_var_op(0x3B, 1, ip->b);     /* cmp ecx, variables[b] */
+            } else {
+                jit_byte(0x81); jit_byte(0xF9); /* cmp ecx, value */
+                jit_u32((uint32_t)ip->b);
+            }
+            if (ip->target < 0) {
+                jit_exit_if(cc, bail);
+            } else {
+                jit_branch(cc, ip->target, start, end);
+            }
+            break;
+        case OP_NEXT:
+            jit_emit_next(ip, pc, bail, start, end);
+            break;
+        case OP_FOR:
+            jit_emit_for(ip, pc, bail, start, end);
+            break;
+    }
+}
+
+/* Record a loop as a JIT region unless another region starts there */
+static void jit_add_region(int start, int end) {
+    int i;
+
+    if (start >= end) {
+        return;
+    }
+    for (i = 0; i < jit_region_count; i++) {
+        if (jit_regions[i].start == start) {
+            /* Keep the innermost loop for a shared head */
+            if (end < jit_regions[i].end) {
+                jit_regions[i].end = end;
+            }
+            return;
+        }
+    }
+    if (jit_region_count >= jit_region_cap) {
+        int new_cap = jit_region_cap ? jit_region_cap * 2 : 16;
+        JitRegion *grown = (JitRegion *)realloc(jit_regions, new_cap * sizeof(JitRegion));
+        if (!grown) {
+            return;
+        }
+        jit_regions = grown;
+        jit_region_cap = new_cap;
+    }
+    memset(&jit_regions[jit_region_count], 0, sizeof(JitRegion));
+    jit_regions[jit_region_count].start = start;
+    jit_regions[jit_region_count].end = end;
+    jit_region_count++;
+}
+
+/* Find loops in the linked program and install their OP_JIT_ENTER heads */
+void jit_find_regions(void) {
+    int i, j;
+
+    for (i = 0; i < program_size; i++) {
+        for (j = line_start[i]; j < line_start[i + 1]; j++) {
+            const Instr *ip = &linked_code[j];
+            if (ip->op == OP_FOR && ip->b > i) {
+                jit_add_region(line_start[i + 1], line_start[ip->b + 1]);
+            } else if ((ip->op == OP_GOTO_LINE || ip->op == OP_IF_GOTO_VV ||
+                        ip->op == OP_IF_GOTO_VC) && ip->target >= 0 && ip->target <= j) {
+                jit_add_region(ip->target, line_start[i + 1]);
+            }
+        }
+    }
+
+    for (i = 0; i < jit_region_count; i++) {
+        Instr *head = &linked_code[jit_regions[i].start];
+        jit_regions[i].original = *head;
+        head->op = OP_JIT_ENTER;
+        head->a = i;
+        thread_code(head, 1);
+    }
+}
+
+/* Discard all compiled regions */
+void jit_reset(void) {
+    int i;
+
+    for (i = 0; i < jit_region_count; i++) {
+        if (jit_regions[i].native) {
+            munmap((void *)jit_regions[i].native, jit_regions[i].native_size);
+        }
+    }
+    jit_region_count = 0;
+    jit_resume_at = NULL;
+}
+
+/* Mark a region as not compilable and restore its loop head */
+static void jit_give_up(JitRegion *region) {
+    region->failed = true;
+    linked_code[region->start] = region->original;
+}
+
+/* Compile a hot region to native code */
+void jit_compile_region(int region_id) {
+    JitRegion *region = &jit_regions[region_id];
+    int start = region->start, end = region->end;
+    int *labels;
+    int exit_label;
+    int pc, i;
+
+    labels = (int *)malloc((end - start) * sizeof(int));
+    if (!labels) {
+        jit_give_up(region);
+        return;
+    }
+    for (i = 0; i < end - start; i++) {
+        labels[i] = -1;
+    }
+    jit_len = 0;
+    jit_fixup_count = 0;
+
+    /* Prologue: save callee-saved registers and keep rsp 16-byte aligned */
+    jit_byte(0x53);                             /* push rbx */
+    jit_byte(0x41); jit_byte(0x54);             /* push r12 */
+    jit_byte(0x41); jit_byte(0x55);             /* push r13 */
+    jit_byte(0x41); jit_byte(0x56);             /* push r14 */
+    jit_byte(0x48); jit_byte(0x83); jit_byte(0xEC); jit_byte(0x08); /* sub rsp, 8 */
+    jit_byte(0x48); jit_byte(0x89); jit_byte(0xE3); /* mov rbx, rsp */
+    jit_byte(0x49); jit_byte(0xBC);             /* mov r12, variables */
+    jit_u64((uint64_t)(uintptr_t)variables);
+    jit_byte(0x49); jit_byte(0xBD);             /* mov r13, arrays */
+    jit_u64((uint64_t)(uintptr_t)arrays);
+
+    /* Body: one statement-sized segment at a time */
+    pc = start;
+    while (pc < end) {
+        int seg_end = pc;
+        int depth = 0, str_depth = 0;
+        bool supported = true;
+
+        do {
+            const Instr *ip = linked_instr(seg_end);
+            depth += stack_effect(ip, false);
+            str_depth += stack_effect(ip, true);
+            if (!jit_supported(ip->op)) {
+                supported = false;
+            }
+            seg_end++;
+        } while (seg_end < end && (depth != 0 || str_depth != 0));
+
+        if (!supported && pc == start) {
+            free(labels);
+            jit_give_up(region);
+            return;
+        }
+
+        jit_depth = 0;
+        if (supported) {
+            for (i = pc; i < seg_end; i++) {
+                labels[i - start] = jit_len;
+                jit_emit_instr(linked_instr(i), i, start, end);
+            }
+        } else {
+            labels[pc - start] = jit_len;
+            jit_exit_if(CC_ALWAYS, -(pc + 1));
+        }
+        pc = seg_end;
+    }
+    jit_exit_if(CC_ALWAYS, end);
+
+    /* Epilogue */
+    exit_label = jit_len;
+    jit_byte(0x48); jit_byte(0x89); jit_byte(0xDC); /* mov rsp, rbx */
+    jit_byte(0x48); jit_byte(0x83); jit_byte(0xC4); jit_byte(0x08); /* add rsp, 8 */
+    jit_byte(0x41); jit_byte(0x5E);             /* pop r14 */
+    jit_byte(0x41); jit_byte(0x5D);             /* pop r13 */
+    jit_byte(0x41); jit_byte(0x5C);             /* pop r12 */
+    jit_byte(0x5B);                             /* pop rbx */
+    jit_byte(0xC3);                             /* ret */
+
+    for (i = 0; i < jit_fixup_count; i++) {
+        int target = jit_fixups[i].target;
+        int address = target == JIT_EXIT_LABEL ? exit_label : labels[target - start];
+        if (address < 0) {
+            free(labels);
+            jit_give_up(region);
+            return;
+        }
+        int32_t rel = address - (jit_fixups[i].pos + 4);
+        memcpy(jit_buf + jit_fixups[i].pos, &rel, 4);
+    }
+    free(labels);
+
+    size_t size = (jit_len + 4095) & ~(size_t)4095;
+    void *mem = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (mem == MAP_FAILED) {
+        jit_give_up(region);
+        return;
+    }
+    memcpy(mem, jit_buf, jit_len);
+    if (mprotect(mem, size, PROT_READ | PROT_EXEC) != 0) {
+        munmap(mem, size);
+        jit_give_up(region);
+        return;
+    }
+    region->native = (JitFunction)mem;
+    region->native_size = size;
+}
+#else
+/* Without JIT support there are no regions */
+void jit_find_regions(void) {
+}
+
+void jit_reset(void) {
+}
+#endif
+
+/* Find line by line number */
+int find_line(int line_number) {
+    if (!program_linked) {
+        link_program();
+    }
+
+    unsigned int slot = hash_line_number(line_number) & line_hash_mask;
+    while (line_hash[slot] >= 0) {
+        if (line_numbers[line_hash[slot]] == line_number) {
+            return line_hash[slot];
+        }
+        slot = (slot + 1) & line_hash_mask;
+    }
+    return -1;
+}
+
+/* Run the program */
+void run_program(void) {
+    if (program_size == 0) {
+        printf("No program to run.\n");
+        return;
+    }
+
+    if (!program_linked) {
+        link_program();
+    }
+
+    for_stack_ptr = 0;
+    data_next = 0;
+    execute_code(linked_code);
+    close_files();
+    flush_output(&channels[0]);
+}
+
+/* List the program */
+void list_program(void) {
+    int i;
+    for (i = 0; i < program_size; i++) {
+        printf("%d %s\n", line_numbers[i], line_text(i));
+    }
+}
+
+/* Print the linked code of each line, as optimized for RUN */
+void dump_program(void) {
+#define OPCODE_NAME(op) #op,
+    static const char *const names[OPCODE_COUNT] = { OPCODE_LIST(OPCODE_NAME) };
+#undef OPCODE_NAME
+    int i, pc;
+
+    if (program_size == 0) {
+        printf("No program to dump.\n");
+        return;
+    }
+    if (!program_linked) {
+        link_program();
+    }
+
+    for (i = 0; i < program_size; i++) {
+        printf("%d %s\n", line_numbers[i], line_text(i));
+        for (pc = line_start[i]; pc < line_start[i + 1]; pc++) {
+            const Instr *ip = linked_instr(pc);
+            printf("    %5d  %-20s %d", pc, names[ip->op] + 3, ip->a);
+            if (ip->b || ip->c || ip->d) {
+                printf(" %d %d %d", ip->b, ip->c, ip->d);
+            }
+            if (has_line_target(ip->op) || ip->op == OP_GOTO_LINE || ip->op == OP_FOR ||
+                ip->op == OP_IF_GOTO_VV || ip->op == OP_IF_GOTO_VC || ip->op == OP_RECORD) {
+                printf(" -> %d", ip->target);
+            }
+            printf("\n");
+        }
+    }
+}
+
+/* Turn the optimizer on or off, recompiling the program */
+void set_optimize(bool enabled) {
+    int i;
+
+    optimize_enabled = enabled;
+    for (i = 0; i < program_size; i++) {
+        free(program[i].code);
+        program[i].code_len = compile_line(line_text(i), &program[i].code);
+    }
+    program_linked = false;
+}
+
+/* Clear the program */
+void clear_program(void) {
+    int i;
+    for (i = 0; i < program_size; i++) {
+        free(program[i].code);
+        program[i].code = NULL;
+    }
+    for (i = 0; i < MAX_VARS; i++) {
+        release_string(&string_variables[i]);
+    }
+    arena_reset(&value_arena, false);
+    free(line_numbers);
+    free(program);
+    free(program_text);
+    line_numbers = NULL;
+    program = NULL;
+    program_text = NULL;
+    program_cap = program_text_len = program_text_cap = program_text_dead = 0;
+    program_size = 0;
+    program_linked = false;
+    init_interpreter();
+}
+
+/* Make room for a program of lines lines */
+static void reserve_program(int lines) {
+    if (lines > program_cap) {
+        int new_cap = program_cap ? program_cap : 64;
+        while (new_cap < lines) {
+            new_cap *= 2;
+        }
+        int *grown_numbers = (int *)realloc(line_numbers, new_cap * sizeof(int));
+        ProgramLine *grown = grown_numbers ? (ProgramLine *)realloc(program, new_cap * sizeof(ProgramLine)) : NULL;
+        if (!grown) {
+            fprintf(stderr, "Error: Memory allocation failed\n");
+            exit(1);
+        }
+        line_numbers = grown_numbers;
+        program = grown;
+        program_cap = new_cap;
+    }
+}
+
+/* Make room for bytes more bytes of program text */
+static void reserve_program_text(size_t bytes) {
+    if (program_text_len + bytes > (size_t)program_text_cap) {
+        size_t new_cap = program_text_cap ? (size_t)program_text_cap : 4096;
+        while (new_cap < program_text_len + bytes) {
+            new_cap *= 2;
+        }
+        if (new_cap > INT_MAX) {
+            fprintf(stderr, "Error: Program too large\n");
+            exit(1);
+        }
+        char *grown = (char *)realloc(program_text, new_cap);
+        if (!grown) {
+            fprintf(stderr, "Error: Memory allocation failed\n");
+            exit(1);
+        }
+        program_text = grown;
+        program_text_cap = (int)new_cap;
+    }
+}
+
+/*
+ * Copy len bytes of text into program_text and return its offset. Once
+ * more than half the buffer is dead text, the live lines are packed
+ * together first; a line whose text offset is -1 is being replaced.
+ */
+static int add_program_text(const char *text, int len) {
+    int offset, i;
+
+    if (program_text_dead > program_text_len / 2 && program_text_dead > 4096) {
+        char *packed = (char *)malloc(program_text_cap);
+        if (!packed) {
+            fprintf(stderr, "Error: Memory allocation failed\n");
+            exit(1);
+        }
+        program_text_len = 0;
+        for (i = 0; i < program_size; i++) {
+            if (program[i].text >= 0) {
+                int n = (int)strlen(line_text(i)) + 1;
+                memcpy(packed + program_text_len, line_text(i), n);
+                program[i].text = program_text_len;
+                program_text_len += n;
+            }
+        }
+        free(program_text);
+        program_text = packed;
+        program_text_dead = 0;
+    }
+
+    reserve_program_text((size_t)len + 1);
+    offset = program_text_len;
+    memcpy(program_text + offset, text, len);
+    program_text[offset + len] = '\0';
+    program_text_len += len + 1;
+    return offset;
+}
+
+/* Insert or replace a line in the program, or delete it if text is empty */
+void insert_line(int line_number, const char *text) {
+    int len = (int)strlen(text);
+    int lo = 0, hi = program_size;
+
+    program_linked = false;
+
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        if (line_numbers[mid] < line_number) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+
+    if (lo < program_size && line_numbers[lo] == line_number) {
+        /* Replace or delete the existing line */
+        program_text_dead += (int)strlen(line_text(lo)) + 1;
+        free(program[lo].code);
+        if (len == 0) {
+            memmove(line_numbers + lo, line_numbers + lo + 1, (program_size - lo - 1) * sizeof(int));
+            memmove(program + lo, program + lo + 1, (program_size - lo - 1) * sizeof(ProgramLine));
+            program_size--;
+            return;
+        }
+    } else if (len == 0) {
+        return;
+    } else {
+        reserve_program(program_size + 1);
+        memmove(line_numbers + lo + 1, line_numbers + lo, (program_size - lo) * sizeof(int));
+        memmove(program + lo + 1, program + lo, (program_size - lo) * sizeof(ProgramLine));
+        line_numbers[lo] = line_number;
+        program_size++;
+    }
+
+    program[lo].text = -1;     /* so packing skips the text being replaced */
+    program[lo].text = add_program_text(text, len);
+    program[lo].code_len = compile_line(line_text(lo), &program[lo].code);
+}
+
+/* Save program to file */
+void save_program(const char *filename) {
+    FILE *fp = fopen(filename, "w");
+    if (!fp) {
+        fprintf(stderr, "Error: Cannot open file %s for writing\n", filename);
+        return;
+    }
+    
+    int i;
+    for (i = 0; i < program_size; i++) {
+        fprintf(fp, "%d %s\n", line_numbers[i], line_text(i));
+    }
+    
+    fclose(fp);
+    printf("Program saved to %s\n", filename);
+}
+
+/* A numbered line found by load_program(), pointing into the file's contents */
+typedef struct {
+    int line_number;
+    int order;                  /* position in the file */
+    const char *text;
+    int len;
+} SourceLine;
+
+/* Order by line number, then by position in the file */
+static int compare_source_lines(const void *x, const void *y) {
+    const SourceLine *a = (const SourceLine *)x, *b = (const SourceLine *)y;
+    if (a->line_number != b->line_number) {
+        return a->line_number < b->line_number ? -1 : 1;
+    }
+    return a->order - b->order;
+}
+
+/*
+ * Read a whole file: mapped where possible, or into a malloc'd buffer
+ * (*mapped false). Returns NULL if the file cannot be read.
+ */
+static char *read_source_file(const char *filename, size_t *size, bool *mapped) {
+    char *data;
+#if HAVE_MMAP
+    struct stat st;
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0) {
+        return NULL;
+    }
+    if (fstat(fd, &st) == 0 && st.st_size > 0) {
+        data = (char *)mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (data != MAP_FAILED) {
+            close(fd);
+            *size = (size_t)st.st_size;
+            *mapped = true;
+            return data;
+        }
+    }
+    close(fd);
+#endif
+    FILE *fp = fopen(filename, "rb");
+    size_t len = 0, cap = 4096;
+    *mapped = false;
+    if (!fp) {
+        return NULL;
+    }
+    data = (char *)malloc(cap);
+    while (data) {
+        len += fread(data + len, 1, cap - len, fp);
+        if (len < cap) {
+            break;
+        }
+        char *grown = (char *)realloc(data, cap * 2);
+        if (!grown) {
+            free(data);
+        }
+        data = grown;
+        cap *= 2;
+    }
+    fclose(fp);
+    if (!data) {
+        fprintf(stderr, "Error: Memory allocation failed\n");
+        exit(1);
+    }
+    *size = len;
+    return data;
+}
+
+/*
+ * Load program from file; false if it cannot be read. The file is
+ * scanned in place for numbered lines, which are sorted once by line
+ * number (a later copy of a line replacing an earlier one, as if typed
+ * in) and then compiled straight into program storage in order.
+ */
+bool load_program(const char *filename) {
+    SourceLine *lines = NULL;
+    size_t size, count = 0, cap = 0, i;
+    bool mapped;
+    char *data = read_source_file(filename, &size, &mapped);
+    const char *p, *end;
+
+    if (!data) {
+        fprintf(stderr, "Error: Cannot open file %s for reading\n", filename);
+        return false;
+    }
+
+    clear_program();
+
+    /* Find the numbered lines, as "<number> <text>" */
+    for (p = data, end = data + size; p < end; ) {
+        const char *eol = (const char *)memchr(p, '\n', end - p);
+        const char *q = p;
+        unsigned int n = 0;
+        bool negative = false, digits = false;
+
+        if (!eol) {
+            eol = end;
+        }
+        while (q < eol && isspace((unsigned char)*q)) {
+            q++;
+        }
+        if (q < eol && (*q == '-' || *q == '+')) {
+            negative = *q++ == '-';
+        }
+        while (q < eol && isdigit((unsigned char)*q)) {
+            n = n * 10 + (unsigned int)(*q++ - '0');
+            digits = true;
+        }
+        while (q < eol && isspace((unsigned char)*q)) {
+            q++;
+        }
+        if (digits && q < eol) {
+            if (count == cap) {
+                cap = cap ? cap * 2 : 256;
+                SourceLine *grown = (SourceLine *)realloc(lines, cap * sizeof(SourceLine));
+                if (!grown) {
+                    fprintf(stderr, "Error: Memory allocation failed\n");
+                    exit(1);
+                }
+                lines = grown;
+            }
+            lines[count].line_number = (int)(negative ? 0u - n : n);
+            lines[count].order = (int)count;
+            lines[count].text = q;
+            lines[count].len = (int)(eol - q);
+            count++;
+        }
+        p = eol + 1;
+    }
+
+    if (count > 0) {
+        qsort(lines, count, sizeof(SourceLine), compare_source_lines);
+    }
+
+    /* Keep the last copy of each line number and compile it in place */
+    reserve_program((int)count);
+    reserve_program_text(size + count);
+    for (i = 0; i < count; i++) {
+        ProgramLine *line = &program[program_size];
+        if (i + 1 < count && lines[i + 1].line_number == lines[i].line_number) {
+            continue;
+        }
+        line_numbers[program_size] = lines[i].line_number;
+        line->text = add_program_text(lines[i].text, lines[i].len);
+        line->code_len = compile_line(line_text(program_size), &line->code);
+        program_size++;
+    }
+
+    free(lines);
+    if (mapped) {
+#if HAVE_MMAP
+        munmap(data, size);
+#endif
+    } else {
+        free(data);
+    }
+    return true;
+}
+
+/*
+ * Ahead-of-time compilation: translate the linked program into a
+ * standalone C program. Each operand stack slot becomes a local (s0, s1,
+ * ... for integers, t0, t1, ... for strings), variables become locals,
+ * jump targets become labels and arrays are allocated on the heap by
+ * DIM. The runtime below repeats the interpreter's checks and messages.
+ */
+static const char *const c_runtime[] = {
+    "#include <stdio.h>",
+    "#include <stdlib.h>",
+    "#include <string.h>",
+    "#include <stdbool.h>",
+    "#include <limits.h>",
+    "",
+    "typedef struct {",
+    "    int var_slot;",
+    "    int end_value;",
+    "    int step_value;",
+    "    int line_index;",
+    "    int body;",
+    "} ForFrame;",
+    "",
+    "static ForFrame *for_stack = NULL;",
+    "static int for_stack_ptr = 0;",
+    "static int for_stack_cap = 0;",
+    "",
+    "static inline char *copy_string(const char *s, int len) {",
+    "    char *ret = (char *)malloc(len + 1);",
+    "    if (ret) {",
+    "        memcpy(ret, s, len);",
+    "        ret[len] = '\\0';",
+    "    }",
+    "    return ret;",
+    "}",
+    "",
+    "typedef struct {",
+    "    char *text;",
+    "    int len;",
+    "    int capacity;",
+    "} StrBuf;",
+    "",
+    "static inline void set_string(StrBuf *s, char *text) {",
+    "    free(s->text);",
+    "    s->text = text ? text : copy_string(\"\", 0);",
+    "    s->len = s->text ? (int)strlen(s->text) : 0;",
+    "    s->capacity = s->len + 1;",
+    "}",
+    "",
+    "static inline char *load_string(const StrBuf *s) {",
+    "    return s->text ? copy_string(s->text, s->len) : copy_string(\"\", 0);",
+    "}",
+    "",
+    "typedef struct {",
+    "    int *data;",
+    "    long long size;",
+    "    int dims;",
+    "    long long extent[3];",
+    "    long long stride[3];",
+    "    bool allocated;",
+    "} Array;",
+    "",
+    "static inline bool check_index(const Array *array, const char *name, int index) {",
+    "    if (!array->allocated) {",
+    "        fprintf(stderr, \"Error: Array %s not dimensioned\\n\", name);",
+    "        return false;",
+    "    }",
+    "    if (index < 0 || index >= array->size) {",
+    "        fprintf(stderr, \"Error: Array index %d out of bounds for %s\\n\", index, name);",
+    "        return false;",
+    "    }",
+    "    return true;",
+    "}",
+    "",
+    "static inline long long element_offset(const Array *array, const char *name, const int *index, int count) {",
+    "    long long offset = 0;",
+    "    int k;",
+    "    if (!array->allocated) {",
+    "        fprintf(stderr, \"Error: Array %s not dimensioned\\n\", name);",
+    "        return -1;",
+    "    }",
+    "    if (count != array->dims) {",
+    "        fprintf(stderr, \"Error: Array %s has %d dimensions\\n\", name, array->dims);",
+    "        return -1;",
+    "    }",
+    "    for (k = 0; k < count; k++) {",
+    "        if (index[k] < 0 || index[k] >= array->extent[k]) {",
+    "            fprintf(stderr, \"Error: Array index %d out of bounds for %s\\n\", index[k], name);",
+    "            return -1;",
+    "        }",
+    "        offset += index[k] * array->stride[k];",
+    "    }",
+    "    return offset;",
+    "}",
+    "",
+    "static inline int load_element(const Array *array, const char *name, const int *index, int count) {",
+    "    long long offset = element_offset(array, name, index, count);",
+    "    return offset >= 0 ? array->data[offset] : 0;",
+    "}",
+    "",
+    "static inline long long shape_size(const char *name, const int *extent, int dims) {",
+    "    long long size = 1;",
+    "    int k;",
+    "    for (k = 0; k < dims; k++) {",
+    "        if (extent[k] <= 0) {",
+    "            fprintf(stderr, \"Error: Invalid array size %d\\n\", extent[k]);",
+    "            return -1;",
+    "        }",
+    "        size *= extent[k];",
+    "        if (size > 2147483647) {",
+    "            fprintf(stderr, \"Error: Array %s is too large\\n\", name);",
+    "            return -1;",
+    "        }",
+    "    }",
+    "    return size;",
+    "}",
+    "",
+    "static inline void set_shape(Array *array, long long first, const int *extent, int dims) {",
+    "    long long stride = 1;",
+    "    int k;",
+    "    array->dims = dims;",
+    "    for (k = dims - 1; k >= 0; k--) {",
+    "        array->extent[k] = k == 0 ? first : extent[k];",
+    "        array->stride[k] = stride;",
+    "        stride *= array->extent[k];",
+    "    }",
+    "    array->size = stride;",
+    "}",
+    "",
+    "static inline void dim_array(Array *array, const char *name, const int *extent, int dims) {",
+    "    long long size;",
+    "    if (array->allocated) {",
+    "        fprintf(stderr, \"Error: Array %s already dimensioned\\n\", name);",
+    "        return;",
+    "    }",
+    "    size = shape_size(name, extent, dims);",
+    "    if (size < 0) {",
+    "        return;",
+    "    }",
+    "    array->data = (int *)calloc(size, sizeof(int));",
+    "    if (!array->data) {",
+    "        fprintf(stderr, \"Error: Memory allocation failed\\n\");",
+    "        return;",
+    "    }",
+    "    set_shape(array, extent[0], extent, dims);",
+    "    array->allocated = true;",
+    "}",
+    "",
+    "/* Set once a FILE array exists; grows the array if it is one and returns true */",
+    "static bool (*grow_file_array)(Array *array, const char *name, long long size) = NULL;",
+    "",
+    "static inline void redim_array(Array *array, const char *name, const int *extent, int dims) {",
+    "    long long size;",
+    "    int *grown;",
+    "    int k;",
+    "    if (!array->allocated) {",
+    "        dim_array(array, name, extent, dims);",
+    "        return;",
+    "    }",
+    "    size = shape_size(name, extent, dims);",
+    "    if (size < 0) {",
+    "        return;",
+    "    }",
+    "    for (k = 1; k < dims && extent[k] == array->extent[k]; k++)",
+    "        ;",
+    "    if (dims != array->dims || k < dims) {",
+    "        fprintf(stderr, \"Error: REDIM can only change the first dimension of %s\\n\", name);",
+    "        return;",
+    "    }",
+    "    if (size < array->size) {",
+    "        fprintf(stderr, \"Error: Cannot shrink array %s to %d\\n\", name, extent[0]);",
+    "        return;",
+    "    }",
+    "    if (!grow_file_array || !grow_file_array(array, name, size)) {",
+    "        grown = (int *)realloc(array->data, (size_t)size * sizeof(int));",
+    "        if (!grown) {",
+    "            fprintf(stderr, \"Error: Memory allocation failed\\n\");",
+    "            return;",
+    "        }",
+    "        memset(grown + array->size, 0, (size_t)(size - array->size) * sizeof(int));",
+    "        array->data = grown;",
+    "    }",
+    "    set_shape(array, extent[0], extent, dims);",
+    "}",
+    "enum { MAT_COPY, MAT_ZER, MAT_CON, MAT_ADD, MAT_SUB, MAT_MUL, MAT_SCALE };",
+    "",
+    "static inline bool same_shape(const Array *x, const Array *y) {",
+    "    int k;",
+    "    if (x->dims != y->dims) {",
+    "        return false;",
+    "    }",
+    "    for (k = 0; k < x->dims; k++) {",
+    "        if (x->extent[k] != y->extent[k]) {",
+    "            return false;",
+    "        }",
+    "    }",
+    "    return true;",
+    "}",
+    "",
+    "static inline void mat_array(Array *target, const char *tname, const Array *left, const char *lname,",
+    "                             const Array *right, const char *rname, int op, int k) {",
+    "    long long i, n;",
+    "    if (!left->allocated || !right->allocated) {",
+    "        fprintf(stderr, \"Error: Array %s not dimensioned\\n\", left->allocated ? rname : lname);",
+    "        return;",
+    "    }",
+    "    if (!same_shape(left, right)) {",
+    "        fprintf(stderr, \"Error: MAT arrays %s and %s differ in shape\\n\", lname, rname);",
+    "        return;",
+    "    }",
+    "    if (!target->allocated) {",
+    "        int extent[3], d;",
+    "        for (d = 0; d < left->dims; d++) {",
+    "            extent[d] = (int)left->extent[d];",
+    "        }",
+    "        dim_array(target, tname, extent, left->dims);",
+    "        if (!target->allocated) {",
+    "            return;",
+    "        }",
+    "    } else if (!same_shape(target, left)) {",
+    "        fprintf(stderr, \"Error: MAT arrays %s and %s differ in shape\\n\", tname, lname);",
+    "        return;",
+    "    }",
+    "    n = target->size;",
+    "    switch (op) {",
+    "        case MAT_COPY:",
+    "            memmove(target->data, left->data, (size_t)n * sizeof(int));",
+    "            break;",
+    "        case MAT_ZER:",
+    "            memset(target->data, 0, (size_t)n * sizeof(int));",
+    "            break;",
+    "        case MAT_CON:",
+    "            for (i = 0; i < n; i++) target->data[i] = 1;",
+    "            break;",
+    "        case MAT_ADD:",
+    "            for (i = 0; i < n; i++) target->data[i] = (int)((unsigned)left->data[i] + (unsigned)right->data[i]);",
+    "            break;",
+    "        case MAT_SUB:",
+    "            for (i = 0; i < n; i++) target->data[i] = (int)((unsigned)left->data[i] - (unsigned)right->data[i]);",
+    "            break;",
+    "        case MAT_MUL:",
+    "            for (i = 0; i < n; i++) target->data[i] = (int)((unsigned)left->data[i] * (unsigned)right->data[i]);",
+    "            break;",
+    "        case MAT_SCALE:",
+    "            for (i = 0; i < n; i++) target->data[i] = (int)((unsigned)left->data[i] * (unsigned)k);",
+    "            break;",
+    "    }",
+    "}",
+    "",
+    "enum { REDUCE_SUM, REDUCE_MIN, REDUCE_MAX, REDUCE_COUNT, REDUCE_DOT };",
+    "",
+    "static inline bool array_range(const Array *array, const char *name, const int *range, int count,",
+    "                               long long *start, long long *length) {",
+    "    if (!array->allocated) {",
+    "        fprintf(stderr, \"Error: Array %s not dimensioned\\n\", name);",
+    "        return false;",
+    "    }",
+    "    *start = count > 0 ? range[0] : 0;",
+    "    if (*start < 0 || *start > array->size) {",
+    "        fprintf(stderr, \"Error: Array index %lld out of bounds for %s\\n\", *start, name);",
+    "        return false;",
+    "    }",
+    "    *length = count > 1 ? range[1] : array->size - *start;",
+    "    if (*length < 0 || *length > array->size - *start) {",
+    "        fprintf(stderr, \"Error: Range of %lld elements from %lld out of bounds for %s\\n\", *length, *start, name);",
+    "        return false;",
+    "    }",
+    "    return true;",
+    "}",
+    "",
+    "static inline int reduce_array(const Array *array, const char *name, const Array *other, const char *oname,",
+    "                               int kind, int value, const int *range, int count) {",
+    "    long long start, length, i;",
+    "    unsigned sum = 0;",
+    "    const int *x;",
+    "    int best;",
+    "    if (!array_range(array, name, range, count, &start, &length)) {",
+    "        return 0;",
+    "    }",
+    "    if (kind == REDUCE_DOT) {",
+    "        long long other_start, other_length;",
+    "        if (!array_range(other, oname, (int[]){ (int)start, (int)length }, 2, &other_start, &other_length)) {",
+    "            return 0;",
+    "        }",
+    "    }",
+    "    if (length == 0) {",
+    "        return 0;",
+    "    }",
+    "    x = array->data + start;",
+    "    best = x[0];",
+    "    switch (kind) {",
+    "        case REDUCE_SUM:",
+    "            for (i = 0; i < length; i++) sum += (unsigned)x[i];",
+    "            return (int)sum;",
+    "        case REDUCE_MIN:",
+    "            for (i = 1; i < length; i++) best = x[i] < best ? x[i] : best;",
+    "            return best;",
+    "        case REDUCE_MAX:",
+    "            for (i = 1; i < length; i++) best = x[i] > best ? x[i] : best;",
+    "            return best;",
+    "        case REDUCE_COUNT:",
+    "            for (i = 0; i < length; i++) sum += x[i] == value;",
+    "            return (int)sum;",
+    "        default:",
+    "            for (i = 0; i < length; i++) sum += (unsigned)x[i] * (unsigned)other->data[start + i];",
+    "            return (int)sum;",
+    "    }",
+    "}",
+    "",
+    "static inline void scan_array(const Array *source, const char *sname, Array *target, const char *tname,",
+    "                              const int *range, int count) {",
+    "    long long start, length, i;",
+    "    unsigned total = 0;",
+    "    if (!array_range(source, sname, range, count, &start, &length)) {",
+    "        return;",
+    "    }",
+    "    if (!target->allocated) {",
+    "        int extent[3], d;",
+    "        for (d = 0; d < source->dims; d++) {",
+    "            extent[d] = (int)source->extent[d];",
+    "        }",
+    "        dim_array(target, tname, extent, source->dims);",
+    "        if (!target->allocated) {",
+    "            return;",
+    "        }",
+    "    }",
+    "    if (!array_range(target, tname, (int[]){ (int)start, (int)length }, 2, &start, &length)) {",
+    "        return;",
+    "    }",
+    "    for (i = start; i < start + length; i++) {",
+    "        total += (unsigned)source->data[i];",
+    "        target->data[i] = (int)total;",
+    "    }",
+    "}",
+    "",
+    "static inline unsigned sort_key(int value, unsigned flip) {",
+    "    return ((unsigned)value ^ 0x80000000u) ^ flip;",
+    "}",
+    "",
+    "static inline void sort_array(Array *array, const char *name, Array *with, const char *wname, int descending, const int *count) {",
+    "    unsigned flip = descending ? 0xffffffffu : 0;",
+    "    long long start, length, i, j, n;",
+    "    int *keys = array->data, *values = NULL, *key_buf, *value_buf = NULL;",
+    "    if (!array_range(array, name, (int[]){ 0, count ? *count : 0 }, count ? 2 : 0, &start, &length)) {",
+    "        return;",
+    "    }",
+    "    if (with && with != array) {",
+    "        if (!array_range(with, wname, (int[]){ 0, (int)length }, 2, &start, &length)) {",
+    "            return;",
+    "        }",
+    "        values = with->data;",
+    "    }",
+    "    n = length;",
+    "    if (n <= 64) {",
+    "        for (i = 1; i < n; i++) {",
+    "            int key = keys[i], value = values ? values[i] : 0;",
+    "            for (j = i; j > 0 && sort_key(keys[j - 1], flip) > sort_key(key, flip); j--) {",
+    "                keys[j] = keys[j - 1];",
+    "                if (values) values[j] = values[j - 1];",
+    "            }",
+    "            keys[j] = key;",
+    "            if (values) values[j] = value;",
+    "        }",
+    "        return;",
+    "    }",
+    "    key_buf = malloc((size_t)n * sizeof(int));",
+    "    if (values) value_buf = malloc((size_t)n * sizeof(int));",
+    "    if (!key_buf || (values && !value_buf)) {",
+    "        fprintf(stderr, \"Error: Memory allocation failed\\n\");",
+    "        free(key_buf);",
+    "        free(value_buf);",
+    "        return;",
+    "    }",
+    "    for (int shift = 0; shift < 32; shift += 8) {",
+    "        long long count_of[256] = { 0 }, offset = 0;",
+    "        for (i = 0; i < n; i++) count_of[(sort_key(keys[i], flip) >> shift) & 0xff]++;",
+    "        for (int b = 0; b < 256; b++) {",
+    "            long long c = count_of[b];",
+    "            count_of[b] = offset;",
+    "            offset += c;",
+    "        }",
+    "        for (i = 0; i < n; i++) {",
+    "            long long at = count_of[(sort_key(keys[i], flip) >> shift) & 0xff]++;",
+    "            key_buf[at] = keys[i];",
+    "            if (values) value_buf[at] = values[i];",
+    "        }",
+    "        memcpy(keys, key_buf, (size_t)n * sizeof(int));",
+    "        if (values) memcpy(values, value_buf, (size_t)n * sizeof(int));",
+    "    }",
+    "    free(key_buf);",
+    "    free(value_buf);",
+    "}",
+    "",
+    "static inline bool input_value(int *target) {",
+    "    if (scanf(\"%d\", target) != 1) {",
+    "        fprintf(stderr, \"Error: Invalid input\\n\");",
+    "        while(getchar() != '\\n' && !feof(stdin));",
+    "        return false;",
+    "    }",
+    "    return true;",
+    "}",
+    "",
+    "static inline void input_string(StrBuf *s) {",
+    "    char buffer[256];",
+    "    if (scanf(\"%255s\", buffer) == 1) {",
+    "        set_string(s, copy_string(buffer, strlen(buffer)));",
+    "    }",
+    "}",
+    "",
+    "static inline void input_flush(void) {",
+    "    int c;",
+    "    while ((c = getchar()) != '\\n' && c != EOF);",
+    "}",
+    "",
+    "static inline char *string_left_right(char *str, int n, bool right) {",
+    "    char *ret = NULL;",
+    "    if (str) {",
+    "        int len = strlen(str);",
+    "        if (n < 0) n = 0;",
+    "        if (n > len) n = len;",
+    "        ret = copy_string(right ? str + (len - n) : str, n);",
+    "        free(str);",
+    "    }",
+    "    return ret;",
+    "}",
+    "",
+    "static inline char *string_mid(char *str, int start, int n) {",
+    "    char *ret = NULL;",
+    "    if (str) {",
+    "        int len = strlen(str);",
+    "        if (start < 1) start = 1;",
+    "        if (start > len) {",
+    "            ret = copy_string(\"\", 0);",
+    "        } else {",
+    "            int available = len - (start - 1);",
+    "            if (n < 0) n = 0;",
+    "            if (n > available) n = available;",
+    "            ret = copy_string(str + (start - 1), n);",
+    "        }",
+    "        free(str);",
+    "    }",
+    "    return ret;",
+    "}",
+    "",
+    "static inline bool string_fits(int len, int right_len) {",
+    "    if (len > INT_MAX / 2 - right_len) {",
+    "        fprintf(stderr, \"Error: String too long\\n\");",
+    "        return false;",
+    "    }",
+    "    return true;",
+    "}",
+    "",
+    "static inline char *string_concat(char *left, char *right) {",
+    "    if (left && right) {",
+    "        int len = (int)strlen(left), right_len = (int)strlen(right);",
+    "        if (string_fits(len, right_len)) {",
+    "            char *ret = (char *)realloc(left, len + right_len + 1);",
+    "            if (ret) {",
+    "                memcpy(ret + len, right, right_len + 1);",
+    "                left = ret;",
+    "            } else {",
+    "                fprintf(stderr, \"Error: Memory allocation failed\\n\");",
+    "            }",
+    "        }",
+    "    }",
+    "    free(right);",
+    "    return left;",
+    "}",
+    "",
+    "static inline void append_string(StrBuf *s, char *right) {",
+    "    if (right) {",
+    "        int right_len = (int)strlen(right);",
+    "        if (!s->text) set_string(s, NULL);",
+    "        if (s->text && string_fits(s->len, right_len)) {",
+    "            if (s->capacity - s->len <= right_len) {",
+    "                int capacity = (s->len + right_len + 1) * 2;",
+    "                char *grown = (char *)realloc(s->text, capacity);",
+    "                if (!grown) {",
+    "                    fprintf(stderr, \"Error: Memory allocation failed\\n\");",
+    "                    free(right);",
+    "                    return;",
+    "                }",
+    "                s->text = grown;",
+    "                s->capacity = capacity;",
+    "            }",
+    "            memcpy(s->text + s->len, right, right_len + 1);",
+    "            s->len += right_len;",
+    "        }",
+    "        free(right);",
+    "    }",
+    "}",
+    "",
+    "static inline int string_instr(char *haystack, char *needle, int start) {",
+    "    int result = 0;",
+    "    if (start < 1) start = 1;",
+    "    if (haystack && needle && start <= (int)strlen(haystack) + 1) {",
+    "        char *found = strstr(haystack + (start - 1), needle);",
+    "        if (found) {",
+    "            result = (int)(found - haystack) + 1;",
+    "        }",
+    "    }",
+    "    free(haystack);",
+    "    free(needle);",
+    "    return result;",
+    "}",
+    "",
+    "static FILE *files[17];",
+    "",
+    "static inline void print_string(FILE *fp, char *str) {",
+    "    if (str) {",
+    "        fputs(str, fp);",
+    "        free(str);",
+    "    }",
+    "}",
+    "",
+    "static inline void print_int(FILE *fp, int value) {",
+    "    char digits[12], *p = digits + sizeof(digits);",
+    "    unsigned int n = value < 0 ? 0u - (unsigned int)value : (unsigned int)value;",
+    "    do {",
+    "        *--p = (char)('0' + n % 10);",
+    "        n /= 10;",
+    "    } while (n);",
+    "    if (value < 0) *--p = '-';",
+    "    fwrite(p, 1, digits + sizeof(digits) - p, fp);",
+    "}",
+    "",
+    "static inline void open_file(int file, int append, char *path) {",
+    "    if (files[file]) {",
+    "        fprintf(stderr, \"Error: File #%d already open\\n\", file);",
+    "    } else if (path && !(files[file] = fopen(path, append ? \"a\" : \"w\"))) {",
+    "        fprintf(stderr, \"Error: Cannot open file %s for writing\\n\", path);",
+    "    }",
+    "    free(path);",
+    "}",
+    "",
+    "static inline void close_file(int file) {",
+    "    int i;",
+    "    if (file && !files[file]) {",
+    "        fprintf(stderr, \"Error: File #%d not open\\n\", file);",
+    "    }",
+    "    for (i = 1; i < 17; i++) {",
+    "        if ((!file || i == file) && files[i]) {",
+    "            fclose(files[i]);",
+    "            files[i] = NULL;",
+    "        }",
+    "    }",
+    "}",
+    "",
+    "",
+    "static inline bool for_start(int var_slot, int start_val, int end_val, int step_val, int line_index, int body) {",
+    "    ForFrame *frame;",
+    "    if (for_stack_ptr > 0 && for_stack[for_stack_ptr - 1].line_index == line_index) {",
+    "        frame = &for_stack[for_stack_ptr - 1];",
+    "    } else {",
+    "        if (for_stack_ptr >= for_stack_cap) {",
+    "            int new_cap = for_stack_cap ? for_stack_cap * 2 : 16;",
+    "            ForFrame *grown = (ForFrame *)realloc(for_stack, new_cap * sizeof(ForFrame));",
+    "            if (!grown) {",
+    "                fprintf(stderr, \"Error: FOR stack overflow\\n\");",
+    "                return true;",
+    "            }",
+    "            for_stack = grown;",
+    "            for_stack_cap = new_cap;",
+    "        }",
+    "        frame = &for_stack[for_stack_ptr++];",
+    "    }",
+    "    frame->var_slot = var_slot;",
+    "    frame->end_value = end_val;",
+    "    frame->step_value = step_val;",
+    "    frame->line_index = line_index;",
+    "    frame->body = body;",
+    "    if ((step_val > 0 && start_val > end_val) || (step_val < 0 && start_val < end_val)) {",
+    "        for_stack_ptr--;",
+    "        return false;",
+    "    }",
+    "    return true;",
+    "}",
+    "",
+    "/* Step the FOR frame of var_slot: the body to continue at, or -1 */",
+    "static inline int for_next(int *var, int var_slot) {",
+    "    if (for_stack_ptr > 0 && for_stack[for_stack_ptr - 1].var_slot == var_slot) {",
+    "        ForFrame *frame = &for_stack[for_stack_ptr - 1];",
+    "        int value = *var = (int)((unsigned)*var + (unsigned)frame->step_value);",
+    "        if ((frame->step_value > 0 && value > frame->end_value) ||",
+    "            (frame->step_value < 0 && value < frame->end_value)) {",
+    "            for_stack_ptr--;",
+    "            return -1;",
+    "        }",
+    "        return frame->body;",
+    "    }",
+    "    fprintf(stderr, \"Error: NEXT without matching FOR\\n\");",
+    "    return -1;",
+    "}",
+    NULL
+};
+
+/* Runtime for programs that use maps; simpler than the interpreter's, growing by rehashing */
+static const char *const c_map_runtime[] = {
+    "typedef struct {",
+    "    unsigned hash;",
+    "    int len;",
+    "    int key;",
+    "    int value;",
+    "    char *text;",
+    "} MapEntry;",
+    "",
+    "typedef struct {",
+    "    MapEntry *entries;",
+    "    unsigned mask;",
+    "    unsigned count;",
+    "    bool declared;",
+    "} Map;",
+    "",
+    "static inline unsigned map_hash(const char *text, int key) {",
+    "    unsigned h = (unsigned)key * 2654435761u;",
+    "    if (text) {",
+    "        h = 2166136261u;",
+    "        for (; *text; text++) h = (h ^ (unsigned char)*text) * 16777619u;",
+    "    }",
+    "    h ^= h >> 16;",
+    "    h *= 0x7feb352du;",
+    "    h ^= h >> 15;",
+    "    return h;",
+    "}",
+    "",
+    "static inline void dim_map(Map *map) {",
+    "    unsigned i;",
+    "    for (i = 0; map->entries && i <= map->mask; i++) free(map->entries[i].text);",
+    "    free(map->entries);",
+    "    map->entries = malloc(16 * sizeof(MapEntry));",
+    "    map->mask = 15;",
+    "    map->count = 0;",
+    "    map->declared = map->entries != NULL;",
+    "    for (i = 0; map->declared && i <= map->mask; i++) {",
+    "        map->entries[i].len = -1;",
+    "        map->entries[i].text = NULL;",
+    "    }",
+    "}",
+    "",
+    "static inline MapEntry *find_entry(Map *map, unsigned hash, const char *text, int key, unsigned *slot) {",
+    "    unsigned i = hash & map->mask;",
+    "    for (; map->entries[i].len != -1; i = (i + 1) & map->mask) {",
+    "        MapEntry *e = &map->entries[i];",
+    "        if (e->hash == hash && (text ? e->text && strcmp(e->text, text) == 0 : !e->text && e->key == key)) {",
+    "            return e;",
+    "        }",
+    "    }",
+    "    *slot = i;",
+    "    return NULL;",
+    "}",
+    "",
+    "static inline int *map_value(Map *map, const char *name, const char *text, int key, bool create) {",
+    "    unsigned hash = map_hash(text, key), slot, i;",
+    "    MapEntry *e;",
+    "    if (!map->declared) {",
+    "        fprintf(stderr, \"Error: Map %s not declared\\n\", name);",
+    "        return NULL;",
+    "    }",
+    "    e = find_entry(map, hash, text, key, &slot);",
+    "    if (e || !create) {",
+    "        return e ? &e->value : NULL;",
+    "    }",
+    "    if ((size_t)(map->count + 1) * 4 > (size_t)(map->mask + 1) * 3) {",
+    "        Map grown = { calloc((size_t)(map->mask + 1) * 2, sizeof(MapEntry)), map->mask * 2 + 1, map->count, true };",
+    "        if (!grown.entries) {",
+    "            fprintf(stderr, \"Error: Memory allocation failed\\n\");",
+    "            return NULL;",
+    "        }",
+    "        for (i = 0; i <= grown.mask; i++) grown.entries[i].len = -1;",
+    "        for (i = 0; i <= map->mask; i++) {",
+    "            if (map->entries[i].len != -1) {",
+    "                unsigned j = map->entries[i].hash & grown.mask;",
+    "                while (grown.entries[j].len != -1) j = (j + 1) & grown.mask;",
+    "                grown.entries[j] = map->entries[i];",
+    "            }",
+    "        }",
+    "        free(map->entries);",
+    "        *map = grown;",
+    "        find_entry(map, hash, text, key, &slot);",
+    "    }",
+    "    e = &map->entries[slot];",
+    "    e->text = text ? copy_string(text, (int)strlen(text)) : NULL;",
+    "    if (text && !e->text) {",
+    "        fprintf(stderr, \"Error: Memory allocation failed\\n\");",
+    "        return NULL;",
+    "    }",
+    "    e->hash = hash;",
+    "    e->len = text ? (int)strlen(text) : -2;",
+    "    e->key = key;",
+    "    e->value = 0;",
+    "    map->count++;",
+    "    return &e->value;",
+    "}",
+    "",
+    "static inline void map_delete(Map *map, const char *name, const char *text, int key) {",
+    "    unsigned hash = map_hash(text, key), slot, i, j;",
+    "    MapEntry *e;",
+    "    if (!map->declared) {",
+    "        fprintf(stderr, \"Error: Map %s not declared\\n\", name);",
+    "        return;",
+    "    }",
+    "    e = find_entry(map, hash, text, key, &slot);",
+    "    if (!e) {",
+    "        return;",
+    "    }",
+    "    free(e->text);",
+    "    map->count--;",
+    "    i = (unsigned)(e - map->entries);",
+    "    for (j = (i + 1) & map->mask; map->entries[j].len != -1; j = (j + 1) & map->mask) {",
+    "        unsigned home = map->entries[j].hash & map->mask;",
+    "        if (((j - home) & map->mask) >= ((j - i) & map->mask)) {",
+    "            map->entries[i] = map->entries[j];",
+    "            i = j;",
+    "        }",
+    "    }",
+    "    map->entries[i].len = -1;",
+    "    map->entries[i].text = NULL;",
+    "}",
+    "",
+    NULL
+};
+
+/* Runtime for FILE arrays and FLUSH, written only by programs that use them */
+static const char *const c_file_runtime[] = {
+    "#include <fcntl.h>",
+    "#include <unistd.h>",
+    "#include <sys/mman.h>",
+    "#include <sys/stat.h>",
+    "",
+    "static struct {",
+    "    Array *array;",
+    "    const char *name;",
+    "    int fd;",
+    "} *file_arrays = NULL;",
+    "static int file_array_count = 0;",
+    "",
+    "static int find_file_array(const Array *array) {",
+    "    int i;",
+    "    for (i = 0; i < file_array_count; i++) {",
+    "        if (file_arrays[i].array == array) return i;",
+    "    }",
+    "    return -1;",
+    "}",
+    "",
+    "static bool grow_mapped_file(Array *array, const char *name, long long size) {",
+    "    int i = find_file_array(array), fd;",
+    "    void *moved;",
+    "    if (i < 0) {",
+    "        return false;",
+    "    }",
+    "    fd = file_arrays[i].fd;",
+    "    if (fd < 0 || ftruncate(fd, (off_t)size * sizeof(int)) != 0) {",
+    "        fprintf(stderr, \"Error: Cannot extend the file of array %s\\n\", name);",
+    "        return true;",
+    "    }",
+    "    moved = mmap(NULL, (size_t)size * sizeof(int), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);",
+    "    if (moved == MAP_FAILED) {",
+    "        fprintf(stderr, \"Error: Cannot map the file of array %s\\n\", name);",
+    "        return true;",
+    "    }",
+    "    munmap(array->data, (size_t)array->size * sizeof(int));",
+    "    array->data = (int *)moved;",
+    "    return true;",
+    "}",
+    "",
+    "static inline void file_array(Array *array, const char *name, const int *extent, int dims, char *path) {",
+    "    int shape[3];",
+    "    long long size, first = extent[0];",
+    "    struct stat st;",
+    "    bool writable = true;",
+    "    void *mapped = MAP_FAILED;",
+    "    int fd = -1;",
+    "    memcpy(shape, extent, dims * sizeof(int));",
+    "    if (shape[0] == 0) shape[0] = 1;",
+    "    if (array->allocated) {",
+    "        fprintf(stderr, \"Error: Array %s already dimensioned\\n\", name);",
+    "        free(path);",
+    "        return;",
+    "    }",
+    "    size = shape_size(name, shape, dims);",
+    "    if (size >= 0) {",
+    "        fd = open(path, O_RDWR | O_CREAT, 0644);",
+    "        if (fd < 0) {",
+    "            writable = false;",
+    "            fd = open(path, O_RDONLY);",
+    "        }",
+    "        if (fd < 0 || fstat(fd, &st) != 0) {",
+    "            fprintf(stderr, \"Error: Cannot open file %s\\n\", path);",
+    "        } else {",
+    "            if (first == 0) {",
+    "                first = (long long)(st.st_size / sizeof(int)) / size;",
+    "                size *= first;",
+    "            }",
+    "            if (first < 1 || size > 2147483647) {",
+    "                fprintf(stderr, \"Error: File %s does not hold an array\\n\", path);",
+    "            } else if ((off_t)size * (off_t)sizeof(int) > st.st_size &&",
+    "                       (!writable || ftruncate(fd, (off_t)size * sizeof(int)) != 0)) {",
+    "                fprintf(stderr, \"Error: Cannot extend file %s\\n\", path);",
+    "            } else {",
+    "                mapped = mmap(NULL, (size_t)size * sizeof(int), PROT_READ | PROT_WRITE,",
+    "                              writable ? MAP_SHARED : MAP_PRIVATE, fd, 0);",
+    "                if (mapped == MAP_FAILED) {",
+    "                    fprintf(stderr, \"Error: Cannot map file %s\\n\", path);",
+    "                }",
+    "            }",
+    "        }",
+    "    }",
+    "    if (mapped != MAP_FAILED) {",
+    "        if (!writable) {",
+    "            close(fd);",
+    "            fd = -1;",
+    "        }",
+    "        array->data = (int *)mapped;",
+    "        set_shape(array, first, extent, dims);",
+    "        array->allocated = true;",
+    "        file_arrays = realloc(file_arrays, (file_array_count + 1) * sizeof(*file_arrays));",
+    "        if (!file_arrays) {",
+    "            fprintf(stderr, \"Error: Memory allocation failed\\n\");",
+    "            exit(1);",
+    "        }",
+    "        file_arrays[file_array_count].array = array;",
+    "        file_arrays[file_array_count].name = name;",
+    "        file_arrays[file_array_count++].fd = fd;",
+    "        grow_file_array = grow_mapped_file;",
+    "    } else if (fd >= 0) {",
+    "        close(fd);",
+    "    }",
+    "    free(path);",
+    "}",
+    "",
+    "static inline void flush_arrays(const Array *only, const char *name) {",
+    "    int i;",
+    "    if (only && find_file_array(only) < 0) {",
+    "        fprintf(stderr, \"Error: Array %s is not a FILE array\\n\", name);",
+    "        return;",
+    "    }",
+    "    for (i = 0; i < file_array_count; i++) {",
+    "        Array *array = file_arrays[i].array;",
+    "        if ((!only || array == only) && file_arrays[i].fd >= 0 &&",
+    "            msync(array->data, (size_t)array->size * sizeof(int), MS_SYNC) != 0) {",
+    "            fprintf(stderr, \"Error: Cannot write array %s to its file\\n\", file_arrays[i].name);",
+    "        }",
+    "    }",
+    "}",
+    NULL
+};
+
+/* Runtime for READ and RESTORE, written after the program's data_items table */
+static const char *const c_data_runtime[] = {
+    "static int data_next;",
+    "",
+    "static const DataItem *read_data(bool string) {",
+    "    if (data_next >= data_count) {",
+    "        fprintf(stderr, \"Error: Out of DATA\\n\");",
+    "        return NULL;",
+    "    }",
+    "    if ((data_items[data_next].text != NULL) != string) {",
+    "        fprintf(stderr, \"Error: Type mismatch in READ\\n\");",
+    "        return NULL;",
+    "    }",
+    "    return &data_items[data_next++];",
+    "}",
+    "",
+    "static inline bool read_int(int *target) {",
+    "    const DataItem *item = read_data(false);",
+    "    if (item) *target = item->value;",
+    "    return item != NULL;",
+    "}",
+    "",
+    "static inline bool read_string(StrBuf *target) {",
+    "    const DataItem *item = read_data(true);",
+    "    if (item) {",
+    "        set_string(target, copy_string(item->text, strlen(item->text)));",
+    "    }",
+    "    return item != NULL;",
+    "}",
+    NULL
+};
+
+/* Runtime for RESTORE, written only by programs that use it */
+static const char *const c_restore_runtime[] = {
+    "static void restore_data(int line) {",
+    "    int lo = 0, hi = data_count;",
+    "    while (lo < hi) {",
+    "        int mid = (lo + hi) / 2;",
+    "        if (data_items[mid].line < line) lo = mid + 1;",
+    "        else hi = mid;",
+    "    }",
+    "    data_next = lo;",
+    "}",
+    NULL
+};
+
+/* Runtime for RECORD, written only by programs that use it */
+static const char *const c_record_runtime[] = {
+    "static char *record_buffer = NULL;",
+    "static int record_capacity = 0;",
+    "",
+    "static bool read_record(StrBuf *text, Array *fields, const char *name) {",
+    "    const char *p, *end;",
+    "    int len = 0, count = 0;",
+    "    do {",
+    "        if (record_capacity - len < 2) {",
+    "            int capacity = record_capacity ? record_capacity * 2 : 65536;",
+    "            char *grown = (char *)realloc(record_buffer, capacity);",
+    "            if (!grown) {",
+    "                fprintf(stderr, \"Error: Memory allocation failed\\n\");",
+    "                break;",
+    "            }",
+    "            record_buffer = grown;",
+    "            record_capacity = capacity;",
+    "        }",
+    "        if (!fgets(record_buffer + len, record_capacity - len, stdin)) break;",
+    "        len += strlen(record_buffer + len);",
+    "    } while (record_buffer[len - 1] != '\\n');",
+    "    if (len == 0) return false;",
+    "    p = record_buffer;",
+    "    if (len > 0 && record_buffer[len - 1] == '\\n') len--;",
+    "    if (len > 0 && record_buffer[len - 1] == '\\r') len--;",
+    "    record_buffer[len] = '\\0';",
+    "    if (text) {",
+    "        set_string(text, copy_string(record_buffer, len));",
+    "    }",
+    "    if (!fields) return true;",
+    "    if (fields->allocated && fields->dims > 1) {",
+    "        fprintf(stderr, \"Error: RECORD needs a one-dimensional array, not %s\\n\", name);",
+    "        return true;",
+    "    }",
+    "    end = record_buffer + len;",
+    "    while (1) {",
+    "        unsigned n = 0;",
+    "        bool negative;",
+    "        while (p < end && (*p == ' ' || *p == '\\t')) p++;",
+    "        if (p == end) break;",
+    "        count++;",
+    "        if (count >= fields->size) {",
+    "            int extent = fields->size < 8 ? 16 : (int)fields->size * 2;",
+    "            redim_array(fields, name, &extent, 1);",
+    "            if (count >= fields->size) {",
+    "                count--;",
+    "                break;",
+    "            }",
+    "        }",
+    "        negative = *p == '-';",
+    "        if (*p == '-' || *p == '+') p++;",
+    "        while (p < end && *p >= '0' && *p <= '9') n = n * 10 + (unsigned)(*p++ - '0');",
+    "        fields->data[count] = (int)(negative ? 0u - n : n);",
+    "        while (p < end && *p != ' ' && *p != '\\t' && *p != ',') p++;",
+    "        while (p < end && (*p == ' ' || *p == '\\t')) p++;",
+    "        if (p < end && *p == ',') p++;",
+    "    }",
+    "    if (!fields->allocated) {",
+    "        int extent = 16;",
+    "        redim_array(fields, name, &extent, 1);",
+    "    }",
+    "    if (fields->allocated) {",
+    "        for (long long i = count + 1; i <= fields->data[0] && i < fields->size; i++) fields->data[i] = 0;",
+    "        fields->data[0] = count;",
+    "    }",
+    "    return true;",
+    "}",
+    NULL
+};
+
+/* Write a C string literal */
+static void write_c_string(FILE *fp, const char *s) {
+    fputc('"', fp);
+    for (; *s; s++) {
+        unsigned char c = (unsigned char)*s;
+        if (c == '"' || c == '\\') {
+            fprintf(fp, "\\%c", c);
+        } else if (c == '\n') {
+            fputs("\\n", fp);
+        } else if (c < 32 || c >= 127 || c == '?') {
+            fprintf(fp, "\\%03o", c);
+        } else {
+            fputc(c, fp);
+        }
+    }
+    fputc('"', fp);
+}
+
+/* Write count stack slots from first on as an index list argument, then the count */
+static void write_c_indices(FILE *fp, int first, int count) {
+    int i;
+    fputs("(int[]){ ", fp);
+    for (i = 0; i < count; i++) {
+        fprintf(fp, "%ss%d", i ? ", " : "", first + i);
+    }
+    fprintf(fp, " }, %d", count);
+}
+
+/* Write the optional range of an array function: its values, or none */
+static void write_c_range(FILE *fp, int first, int count) {
+    if (count > 0) {
+        write_c_indices(fp, first, count);
+    } else {
+        fputs("NULL, 0", fp);
+    }
+}
+
+/* Write the label of a linked_code address */
+static void write_c_label(FILE *fp, int pc, int total) {
+    int index;
+
+    if (pc >= total) {
+        fputs("halt", fp);
+        return;
+    }
+    index = line_index_of(pc);
+    if (line_start[index] == pc) {
+        fprintf(fp, "line_%d", line_numbers[index]);
+    } else {
+        fprintf(fp, "pc_%d", pc);
+    }
+}
+
+/* Write a switch that jumps to the label of each case value in targets */
+static void write_c_switch(FILE *fp, const char *value, const int *cases,
+                           const int *targets, int count, int total) {
+    int i;
+
+    fprintf(fp, "        switch (%s) {\n", value);
+    for (i = 0; i < count; i++) {
+        fprintf(fp, "            case %d: goto ", cases[i]);
+        write_c_label(fp, targets[i], total);
+        fputs(";\n", fp);
+    }
+    fputs("        }\n", fp);
+}
+
+/* C name of a variable slot; which selects one of two buffers, grown to fit */
+static const char *c_var_name(int slot, int which) {
+    static char *names[2];
+    static size_t caps[2];
+    const char *name = slot >= 0 && slot < MAX_VARS ? var_names.names[slot] : NULL;
+    size_t need = (name ? strlen(name) : 0) + 24;
+    if (need > caps[which]) {
+        char *grown = (char *)realloc(names[which], need);
+        if (!grown) {
+            fprintf(stderr, "Error: Memory allocation failed\n");
+            exit(1);
+        }
+        names[which] = grown;
+        caps[which] = need;
+    }
+    if (name) {
+        snprintf(names[which], caps[which], "var_%s", name);
+    } else {
+        snprintf(names[which], caps[which], "tmp_%d", slot - MAX_VARS);
+    }
+    return names[which];
+}
+
+/* Name of the variable, string, array or map in operand a, or "" */
+static const char *c_slot_name(const Instr *ip) {
+    switch (ip->op) {
+        case OP_FOR: case OP_NEXT:
+            return var_names.names[ip->a];
+        case OP_LOAD_STR: case OP_STORE_STR: case OP_STORE_STR_EMPTY: case OP_INPUT_STR:
+        case OP_READ_STR:
+            return str_names.names[ip->a];
+        case OP_LOAD_ARRAY: case OP_CHECK_INDEX: case OP_STORE_ARRAY: case OP_LOAD_ARRAY_N:
+        case OP_CHECK_INDEX_N: case OP_DIM: case OP_REDIM: case OP_DIM_FILE: case OP_MAT:
+        case OP_REDUCE: case OP_SCAN: case OP_SORT: case OP_INPUT_ARRAY: case OP_READ_ARRAY:
+        case OP_LOAD_ARRAY_VAR: case OP_CHECK_INDEX_VAR: case OP_STORE_ARRAY_VAR:
+            return array_names.names[ip->a];
+        case OP_FLUSH:
+            return ip->a >= 0 ? array_names.names[ip->a] : "";
+        case OP_DIM_MAP: case OP_LOAD_MAP: case OP_STORE_MAP: case OP_HAS_MAP: case OP_DEL_MAP:
+            return map_names.names[ip->a];
+    }
+    return "";
+}
+
+/*
+ * String variable slot if the LOAD_STR at pc starts a statement such as
+ * A$ = A$ + X$ + Y$, whose appends can go straight into the variable's
+ * buffer, or -1. The variable must not be read again before the store
+ * and nothing but appends may use the loaded value.
+ */
+static int c_append_slot(int pc, int end) {
+    const Instr *load = linked_instr(pc);
+    int k = 1;
+
+    for (pc++; pc < end; pc++) {
+        const Instr *ip = linked_instr(pc);
+        int reads;
+
+        if (has_line_target(ip->op) || ip->op == OP_GOTO || ip->op == OP_GOTO_LINE ||
+            ip->op == OP_IF_GOTO_VV || ip->op == OP_IF_GOTO_VC) {
+            return -1;
+        }
+        if ((ip->op == OP_LOAD_STR || ip->op == OP_INPUT_STR || ip->op == OP_READ_STR) &&
+            ip->a == load->a) {
+            return -1;
+        }
+        if (ip->op == OP_STORE_STR && k == 1) {
+            return ip->a == load->a ? load->a : -1;
+        }
+        if (ip->op == OP_CONCAT) {
+            reads = 2;
+        } else if (ip->op == OP_LEFT || ip->op == OP_RIGHT || ip->op == OP_MID) {
+            reads = 1;
+        } else {
+            reads = -stack_effect(ip, true);
+        }
+        if (k - reads < 1 && !(ip->op == OP_CONCAT && k == 2)) {
+            return -1;
+        }
+        k += stack_effect(ip, true);
+    }
+    return -1;
+}
+
+/*
+ * Translate one instruction; d and k are the int and string stack depths,
+ * and in_place is the string variable appended to in place, or -1.
+ */
+static void write_c_instr(FILE *fp, const Instr *ip, int pc, int d, int k, int total, int in_place) {
+    static const char *const c_compare[] = { NULL, "==", "<", ">", "<=", ">=", "!=" };
+    const char *name = c_slot_name(ip);
+    const char *var = c_var_name(ip->a, 0);
+    const char *var_b = c_var_name(ip->b, 1);
+    char value[16], stream[24] = "stdout";
+    int i, count;
+
+    if ((ip->op == OP_PRINT_INT || ip->op == OP_PRINT_STR || ip->op == OP_PRINT_SPACE ||
+         ip->op == OP_PRINT_NEWLINE) && ip->a > 0) {
+        snprintf(stream, sizeof(stream), "files[%d]", ip->a);
+    }
+    switch (ip->op) {
+        case OP_PUSH_INT:
+            fprintf(fp, "    s%d = %d;\n", d, ip->a);
+            break;
+        case OP_LOAD_VAR:
+            fprintf(fp, "    s%d = %s;\n", d, var);
+            break;
+        case OP_LOAD_ARRAY:
+            fprintf(fp, "    s%d = check_index(&arr_%s, \"%s\", s%d) ? arr_%s.data[s%d] : 0;\n",
+                    d - 1, name, name, d - 1, name, d - 1);
+            break;
+        case OP_ADD:
+        case OP_SUB:
+        case OP_MUL:
+            /* Wrap around on overflow like the interpreter's stack does */
+            fprintf(fp, "    s%d = (int)((unsigned)s%d %c (unsigned)s%d);\n", d - 2, d - 2,
+                    ip->op == OP_ADD ? '+' : ip->op == OP_SUB ? '-' : '*', d - 1);
+            break;
+        case OP_DIV:
+            fprintf(fp, "    if (s%d != 0) {\n        s%d /= s%d;\n    } else {\n"
+                        "        fprintf(stderr, \"Error: Division by zero\\n\");\n    }\n",
+                    d - 1, d - 2, d - 1);
+            break;
+        case OP_POP_INT:
+        case OP_HALT:
+            break;
+        case OP_INSTR:
+            if (ip->a) {
+                fprintf(fp, "    s%d = string_instr(t%d, t%d, s%d);\n", d - 1, k - 2, k - 1, d - 1);
+            } else {
+                fprintf(fp, "    s%d = string_instr(t%d, t%d, 1);\n", d, k - 2, k - 1);
+            }
+            break;
+        case OP_PUSH_STR:
+            fprintf(fp, "    t%d = copy_string(", k);
+            write_c_string(fp, string_pool + ip->a);
+            fprintf(fp, ", %d);\n", ip->b);
+            break;
+        case OP_LOAD_STR:
+            if (in_place < 0) {
+                fprintf(fp, "    t%d = load_string(&str_%s);\n", k, name);
+            }
+            break;
+        case OP_LEFT:
+        case OP_RIGHT:
+            fprintf(fp, "    t%d = string_left_right(t%d, s%d, %s);\n", k - 1, k - 1, d - 1,
+                    ip->op == OP_RIGHT ? "true" : "false");
+            break;
+        case OP_MID:
+            fprintf(fp, "    t%d = string_mid(t%d, s%d, s%d);\n", k - 1, k - 1, d - 2, d - 1);
+            break;
+        case OP_POP_STR:
+            fprintf(fp, "    free(t%d);\n", k - 1);
+            break;
+        case OP_CONCAT:
+            if (in_place >= 0) {
+                fprintf(fp, "    append_string(&str_%s, t%d);\n", str_names.names[in_place], k - 1);
+            } else {
+                fprintf(fp, "    t%d = string_concat(t%d, t%d);\n", k - 2, k - 2, k - 1);
+            }
+            break;
+        case OP_CMP:
+            if (ip->a == CMP_NONE) {
+                fprintf(fp, "    s%d = 0;\n", d - 2);
+            } else {
+                fprintf(fp, "    s%d = s%d %s s%d;\n", d - 2, d - 2, c_compare[ip->a], d - 1);
+            }
+            break;
+        case OP_STR_CMP:
+            if (ip->a == CMP_NONE) {
+                fprintf(fp, "    s%d = 0;\n", d);
+            } else {
+                fprintf(fp, "    s%d = t%d && t%d && strcmp(t%d, t%d) %s 0;\n",
+                        d, k - 2, k - 1, k - 2, k - 1, c_compare[ip->a]);
+            }
+            fprintf(fp, "    free(t%d);\n    free(t%d);\n", k - 2, k - 1);
+            break;
+        case OP_JUMP_IF_FALSE:
+            fprintf(fp, "    if (!s%d) goto ", d - 1);
+            write_c_label(fp, ip->target, total);
+            fputs(";\n", fp);
+            break;
+        case OP_PRINT_INT:
+            fprintf(fp, "    print_int(%s, s%d);\n", stream, d - 1);
+            break;
+        case OP_PRINT_STR:
+            fprintf(fp, "    print_string(%s, t%d);\n", stream, k - 1);
+            break;
+        case OP_PRINT_SPACE:
+            fprintf(fp, "    putc(' ', %s);\n", stream);
+            break;
+        case OP_PRINT_NEWLINE:
+            fprintf(fp, "    putc('\\n', %s);\n", stream);
+            break;
+        case OP_OPEN:
+            fprintf(fp, "    open_file(%d, %d, t%d);\n", ip->a, ip->b, k - 1);
+            break;
+        case OP_CLOSE:
+            fprintf(fp, "    close_file(%d);\n", ip->a);
+            break;
+        case OP_CHECK_FILE:
+            fprintf(fp, "    if (!files[%d]) {\n        fprintf(stderr, \"Error: File #%d not open\\n\");\n"
+                        "        goto ", ip->a, ip->a);
+            write_c_label(fp, ip->target, total);
+            fputs(";\n    }\n", fp);
+            break;
+        case OP_STORE_VAR:
+        case OP_TEE_VAR:
+            fprintf(fp, "    %s = s%d;\n", var, d - 1);
+            break;
+        case OP_STORE_STR:
+            if (in_place < 0) {
+                fprintf(fp, "    set_string(&str_%s, t%d);\n", name, k - 1);
+            }
+            break;
+        case OP_STORE_STR_EMPTY:
+            fprintf(fp, "    set_string(&str_%s, NULL);\n", name);
+            break;
+        case OP_CHECK_INDEX:
+            fprintf(fp, "    if (!check_index(&arr_%s, \"%s\", s%d)) goto ", name, name, d - 1);
+            write_c_label(fp, ip->target, total);
+            fputs(";\n", fp);
+            break;
+        case OP_STORE_ARRAY:
+            fprintf(fp, "    arr_%s.data[s%d] = s%d;\n", name, d - 2, d - 1);
+            break;
+        case OP_LOAD_ARRAY_N:
+            fprintf(fp, "    s%d = load_element(&arr_%s, \"%s\", ", d - ip->b, name, name);
+            write_c_indices(fp, d - ip->b, ip->b);
+            fputs(");\n", fp);
+            break;
+        case OP_CHECK_INDEX_N:
+            fprintf(fp, "    if ((s%d = (int)element_offset(&arr_%s, \"%s\", ", d - ip->b, name, name);
+            write_c_indices(fp, d - ip->b, ip->b);
+            fputs(")) < 0) goto ", fp);
+            write_c_label(fp, ip->target, total);
+            fputs(";\n", fp);
+            break;
+        case OP_GOTO: {
+            int *cases = (int *)malloc(program_size * sizeof(int));
+            if (!cases) {
+                break;
+            }
+            for (i = 0; i < program_size; i++) {
+                cases[i] = line_numbers[i];
+            }
+            snprintf(value, sizeof(value), "s%d", d - 1);
+            fputs("    {\n", fp);
+            write_c_switch(fp, value, cases, line_start, program_size, total);
+            fprintf(fp, "        fprintf(stderr, \"Error: Line %%d not found\\n\", s%d);\n    }\n", d - 1);
+            free(cases);
+            break;
+        }
+        case OP_GOTO_LINE:
+            if (ip->target >= 0) {
+                fputs("    goto ", fp);
+                write_c_label(fp, ip->target, total);
+                fputs(";\n", fp);
+            } else {
+                fprintf(fp, "    fprintf(stderr, \"Error: Line %d not found\\n\");\n", ip->a);
+            }
+            break;
+        case OP_DIM:
+        case OP_REDIM:
+            fprintf(fp, "    %s_array(&arr_%s, \"%s\", ", ip->op == OP_DIM ? "dim" : "redim", name, name);
+            write_c_indices(fp, d - ip->b, ip->b);
+            fputs(");\n", fp);
+            break;
+        case OP_DIM_FILE:
+            fprintf(fp, "    file_array(&arr_%s, \"%s\", ", name, name);
+            write_c_indices(fp, d - ip->b, ip->b);
+            fprintf(fp, ", t%d);\n", k - 1);
+            break;
+        case OP_MAT:
+            fprintf(fp, "    mat_array(&arr_%s, \"%s\", &arr_%s, \"%s\", &arr_%s, \"%s\", %d, ",
+                    name, name, array_names.names[ip->c], array_names.names[ip->c], array_names.names[ip->d], array_names.names[ip->d], ip->b);
+            if (ip->b == MAT_SCALE) {
+                fprintf(fp, "s%d);\n", d - 1);
+            } else {
+                fputs("0);\n", fp);
+            }
+            break;
+        case OP_REDUCE: {
+            int first = d - ip->d - (ip->b == REDUCE_COUNT);
+            fprintf(fp, "    s%d = reduce_array(&arr_%s, \"%s\", &arr_%s, \"%s\", %d, ",
+                    first, name, name, array_names.names[ip->c], array_names.names[ip->c], ip->b);
+            if (ip->b == REDUCE_COUNT) {
+                fprintf(fp, "s%d, ", first);
+            } else {
+                fputs("0, ", fp);
+            }
+            write_c_range(fp, d - ip->d, ip->d);
+            fputs(");\n", fp);
+            break;
+        }
+        case OP_SCAN:
+            fprintf(fp, "    scan_array(&arr_%s, \"%s\", &arr_%s, \"%s\", ", name, name, array_names.names[ip->b], array_names.names[ip->b]);
+            write_c_range(fp, d - ip->d, ip->d);
+            fputs(");\n", fp);
+            break;
+        case OP_SORT:
+            fprintf(fp, "    sort_array(&arr_%s, \"%s\", ", name, name);
+            if (ip->b >= 0) {
+                fprintf(fp, "&arr_%s, \"%s\", ", array_names.names[ip->b], array_names.names[ip->b]);
+            } else {
+                fputs("NULL, 0, ", fp);
+            }
+            if (ip->d) {
+                fprintf(fp, "%d, &s%d);\n", ip->c, d - 1);
+            } else {
+                fprintf(fp, "%d, NULL);\n", ip->c);
+            }
+            break;
+        case OP_DIM_MAP:
+            fprintf(fp, "    dim_map(&map_%s);\n", name);
+            break;
+        case OP_LOAD_MAP:
+        case OP_HAS_MAP: {
+            const char *result = ip->op == OP_HAS_MAP ? "v != NULL" : "v ? *v : 0";
+            if (ip->b) {
+                fprintf(fp, "    { int *v = map_value(&map_%s, \"%s\", t%d, 0, false); s%d = %s; free(t%d); }\n",
+                        name, name, k - 1, d, result, k - 1);
+            } else {
+                fprintf(fp, "    { int *v = map_value(&map_%s, \"%s\", NULL, s%d, false); s%d = %s; }\n",
+                        name, name, d - 1, d - 1, result);
+            }
+            break;
+        }
+        case OP_STORE_MAP:
+            if (ip->b) {
+                fprintf(fp, "    { int *v = map_value(&map_%s, \"%s\", t%d, 0, true); if (v) *v = s%d; free(t%d); }\n",
+                        name, name, k - 1, d - 1, k - 1);
+            } else {
+                fprintf(fp, "    { int *v = map_value(&map_%s, \"%s\", NULL, s%d, true); if (v) *v = s%d; }\n",
+                        name, name, d - 2, d - 1);
+            }
+            break;
+        case OP_DEL_MAP:
+            if (ip->b) {
+                fprintf(fp, "    map_delete(&map_%s, \"%s\", t%d, 0);\n    free(t%d);\n", name, name, k - 1, k - 1);
+            } else {
+                fprintf(fp, "    map_delete(&map_%s, \"%s\", NULL, s%d);\n", name, name, d - 1);
+            }
+            break;
+        case OP_FLUSH:
+            if (ip->a >= 0) {
+                fprintf(fp, "    flush_arrays(&arr_%s, \"%s\");\n", name, name);
+            } else {
+                fputs("    flush_arrays(NULL, NULL);\n", fp);
+            }
+            break;
+        case OP_INPUT_PROMPT:
+            fputs("    printf(\"%s\", ", fp);
+            write_c_string(fp, string_pool + ip->a);
+            fputs(");\n    fflush(stdout);\n", fp);
+            break;
+        case OP_INPUT_INT:
+            fprintf(fp, "    if (!input_value(&%s)) goto ", var);
+            write_c_label(fp, ip->target, total);
+            fputs(";\n", fp);
+            break;
+        case OP_INPUT_ARRAY:
+            fprintf(fp, "    if (!check_index(&arr_%s, \"%s\", s%d) || !input_value(&arr_%s.data[s%d])) goto ",
+                    name, name, d - 1, name, d - 1);
+            write_c_label(fp, ip->target, total);
+            fputs(";\n", fp);
+            break;
+        case OP_INPUT_STR:
+            fprintf(fp, "    input_string(&str_%s);\n", name);
+            break;
+        case OP_INPUT_FLUSH:
+            fputs("    input_flush();\n", fp);
+            break;
+        case OP_DATA:
+            break;
+        case OP_READ_INT:
+            fprintf(fp, "    if (!read_int(&%s)) goto ", var);
+            write_c_label(fp, ip->target, total);
+            fputs(";\n", fp);
+            break;
+        case OP_READ_ARRAY:
+            fprintf(fp, "    if (!check_index(&arr_%s, \"%s\", s%d) || !read_int(&arr_%s.data[s%d])) goto ",
+                    name, name, d - 1, name, d - 1);
+            write_c_label(fp, ip->target, total);
+            fputs(";\n", fp);
+            break;
+        case OP_READ_STR:
+            fprintf(fp, "    if (!read_string(&str_%s)) goto ", name);
+            write_c_label(fp, ip->target, total);
+            fputs(";\n", fp);
+            break;
+        case OP_RESTORE:
+            fprintf(fp, "    restore_data(%d);\n", ip->a);
+            break;
+        case OP_RECORD:
+            fputs("    if (!read_record(", fp);
+            if (ip->a >= 0) {
+                fprintf(fp, "&str_%s, ", str_names.names[ip->a]);
+            } else {
+                fputs("NULL, ", fp);
+            }
+            if (ip->b >= 0) {
+                fprintf(fp, "&arr_%s, \"%s\")) ", array_names.names[ip->b], array_names.names[ip->b]);
+            } else {
+                fputs("NULL, NULL)) ", fp);
+            }
+            if (ip->target < 0) {
+                fprintf(fp, "{\n        fprintf(stderr, \"Error: Line %d not found\\n\");\n"
+                            "        goto halt;\n    }\n", ip->c);
+            } else {
+                fputs("goto ", fp);
+                write_c_label(fp, ip->target, total);
+                fputs(";\n", fp);
+            }
+            break;
+        case OP_FOR:
+            fprintf(fp, "    %s = s%d;\n", var, d - 3);
+            fprintf(fp, "    if (!for_start(%d, s%d, s%d, s%d, %d, %d)) ",
+                    ip->a, d - 3, d - 2, d - 1, ip->c, pc + 1);
+            if (ip->b < 0) {
+                fprintf(fp, "{\n        fprintf(stderr, \"Error: Matching NEXT %s not found\\n\");\n"
+                            "        goto halt;\n    }\n", name);
+            } else {
+                fputs("goto ", fp);
+                write_c_label(fp, ip->target, total);
+                fputs(";\n", fp);
+            }
+            break;
+        case OP_NEXT: {
+            int *cases = (int *)malloc(total * sizeof(int));
+            if (!cases) {
+                break;
+            }
+            /* The body of any FOR over the same variable can be on top */
+            count = 0;
+            for (i = 0; i < total; i++) {
+                const Instr *loop = linked_instr(i);
+                if (loop->op == OP_FOR && loop->a == ip->a) {
+                    cases[count++] = i + 1;
+                }
+            }
+            fputs("    {\n", fp);
+            fprintf(fp, "        int body = for_next(&%s, %d);\n", var, ip->a);
+            write_c_switch(fp, "body", cases, cases, count, total);
+            fputs("    }\n", fp);
+            free(cases);
+            break;
+        }
+        case OP_END:
+            fputs("    goto halt;\n", fp);
+            break;
+        case OP_ERROR:
+            fputs("    fputs(", fp);
+            {
+                size_t len = strlen(string_pool + ip->a) + 9;
+                char *message = (char *)malloc(len);
+                if (!message) {
+                    fprintf(stderr, "Error: Memory allocation failed\n");
+                    exit(1);
+                }
+                snprintf(message, len, "Error: %s\n", string_pool + ip->a);
+                write_c_string(fp, message);
+                free(message);
+            }
+            fputs(", stderr);\n", fp);
+            break;
+        case OP_INC_VAR:
+            fprintf(fp, "    %s = (int)((unsigned)%s + %uu);\n", var, var_b, (unsigned)ip->c);
+            break;
+        case OP_ADD_CONST:
+            fprintf(fp, "    s%d = (int)((unsigned)s%d + %uu);\n", d - 1, d - 1, (unsigned)ip->a);
+            break;
+        case OP_LOAD_ARRAY_VAR:
+            fprintf(fp, "    s%d = check_index(&arr_%s, \"%s\", %s) ? arr_%s.data[%s] : 0;\n",
+                    d, name, name, var_b, name, var_b);
+            break;
+        case OP_CHECK_INDEX_VAR:
+            fprintf(fp, "    if (!check_index(&arr_%s, \"%s\", %s)) goto ", name, name, var_b);
+            write_c_label(fp, ip->target, total);
+            fputs(";\n", fp);
+            break;
+        case OP_STORE_ARRAY_VAR:
+            fprintf(fp, "    arr_%s.data[%s] = s%d;\n", name, var_b, d - 1);
+            break;
+        case OP_IF_GOTO_VV:
+        case OP_IF_GOTO_VC:
+            if (ip->c == CMP_NONE) {
+                break;
+            }
+            fprintf(fp, "    if (%s %s ", var, c_compare[ip->c]);
+            if (ip->op == OP_IF_GOTO_VV) {
+                fprintf(fp, "%s", var_b);
+            } else {
+                fprintf(fp, "%d", ip->b);
+            }
+            if (ip->target >= 0) {
+                fputs(") goto ", fp);
+                write_c_label(fp, ip->target, total);
+                fputs(";\n", fp);
+            } else {
+                fprintf(fp, ") fprintf(stderr, \"Error: Line %d not found\\n\");\n", ip->d);
+            }
+            break;
+    }
+}
 
-    int start_val = parse_expression();
-    skip_whitespace();
+/* Translate the program into a standalone C program */
+void compile_program_to_c(const char *filename) {
+    bool used_var[MAX_VARS + MAX_TEMPS] = { false };
+    bool used_str[MAX_VARS] = { false };
+    bool used_array[MAX_ARRAYS] = { false };
+    bool used_map[MAX_MAPS] = { false };
+    bool uses_files = false, uses_maps = false, uses_data = false, uses_restore = false;
+    bool uses_records = false;
+    bool *is_target;
+    int *depth, *str_depth;
+    int max_depth = 0, max_str_depth = 0, append_slot;
+    int total, pc, i;
+    FILE *fp;
 
-    if (strncasecmp(current_pos, "TO", 2) != 0) {
-        fprintf(stderr, "Error: Expected TO in FOR\n");
+    if (program_size == 0) {
+        printf("No program to compile.\n");
         return;
     }
-    current_pos += 2;
-
-    int end_val = parse_expression();
-    skip_whitespace();
-
-    int step_val = 1;
-    if (strncasecmp(current_pos, "STEP", 4) == 0) {
-        current_pos += 4;
-        step_val = parse_expression();
-    }
-
-    /* Check if this loop is already on stack */
-    if (for_stack_ptr > 0 && for_stack[for_stack_ptr - 1].line_index == current_line_index) {
-        /* Re-entry from NEXT, variable already incremented */
-    } else {
-        /* Initial entry */
-        if (for_stack_ptr >= MAX_FOR_STACK) {
-            fprintf(stderr, "Error: FOR stack overflow\n");
-            return;
-        }
-        variables[var_name - 'A'] = start_val;
-        for_stack[for_stack_ptr].var_name = var_name;
-        for_stack[for_stack_ptr].end_value = end_val;
-        for_stack[for_stack_ptr].step_value = step_val;
-        for_stack[for_stack_ptr].line_index = current_line_index;
-        for_stack_ptr++;
+    if (!program_linked) {
+        link_program();
     }
+    total = line_start[program_size];
 
-    /* Check condition */
-    int current_val = variables[var_name - 'A'];
-    bool done = false;
-    if (step_val > 0 && current_val > end_val) done = true;
-    else if (step_val < 0 && current_val < end_val) done = true;
-
-    if (done) {
-        for_stack_ptr--;
-        skip_to_next(var_name);
+    /* The generated code keeps every bounds check a previous RUN proved */
+    for (i = 0; i < program_size; i++) {
+        prove_loop_bounds(i, 0, 0, 0, false);
     }
-}
 
-/* Execute NEXT statement */
-void execute_next(void) {
-    skip_whitespace();
-    if (!isalpha(*current_pos)) {
-        fprintf(stderr, "Error: Expected variable name in NEXT\n");
+    is_target = (bool *)calloc(total + 1, sizeof(bool));
+    depth = (int *)malloc((total + 1) * sizeof(int));
+    str_depth = (int *)malloc((total + 1) * sizeof(int));
+    if (!is_target || !depth || !str_depth) {
+        fprintf(stderr, "Error: Memory allocation failed\n");
+        free(is_target);
+        free(depth);
+        free(str_depth);
         return;
     }
-    char var_name = toupper(*current_pos);
-    current_pos++;
-
-    if (for_stack_ptr > 0 && for_stack[for_stack_ptr - 1].var_name == var_name) {
-        variables[var_name - 'A'] += for_stack[for_stack_ptr - 1].step_value;
-        current_line_index = for_stack[for_stack_ptr - 1].line_index - 1;
-    } else {
-        fprintf(stderr, "Error: NEXT without matching FOR\n");
-    }
-}
 
-/* Skip to matching NEXT statement */
-void skip_to_next(char var_name) {
-    int nesting = 0;
-    while (current_line_index < program_size) {
-        current_line_index++;
-        if (current_line_index >= program_size) break;
+    /* Find stack depths, jump targets and the variables in use */
+    for (i = 0; i < program_size; i++) {
+        int d = 0, k = 0;
+        for (pc = line_start[i]; pc < line_start[i + 1]; pc++) {
+            const Instr *ip = linked_instr(pc);
+            depth[pc] = d;
+            str_depth[pc] = k;
+            d += stack_effect(ip, false);
+            k += stack_effect(ip, true);
+            if (d < 0) d = 0;
+            if (k < 0) k = 0;
+            if (d > max_depth) max_depth = d;
+            if (k > max_str_depth) max_str_depth = k;
 
-        char *ptr = program[current_line_index].text;
-        while (*ptr && isspace(*ptr)) ptr++;
+            switch (ip->op) {
+                case OP_JUMP_IF_FALSE: case OP_CHECK_INDEX: case OP_CHECK_INDEX_VAR: case OP_CHECK_INDEX_N:
+                case OP_CHECK_FILE: case OP_INPUT_INT: case OP_INPUT_ARRAY: case OP_GOTO_LINE:
+                case OP_IF_GOTO_VV: case OP_IF_GOTO_VC: case OP_READ_INT: case OP_READ_ARRAY:
+                case OP_READ_STR: case OP_RECORD:
+                    if (ip->target >= 0) {
+                        is_target[ip->target] = true;
+                    }
+                    break;
+                case OP_FOR:
+                    is_target[pc + 1] = true;
+                    if (ip->target >= 0) {
+                        is_target[ip->target] = true;
+                    }
+                    break;
+                case OP_GOTO:
+                    for (int j = 0; j < program_size; j++) {
+                        is_target[line_start[j]] = true;
+                    }
+                    break;
+            }
 
-        if (strncasecmp(ptr, "FOR", 3) == 0) {
-            nesting++;
-        } else if (strncasecmp(ptr, "NEXT", 4) == 0) {
-            if (nesting == 0) {
-                char *vptr = ptr + 4;
-                while (*vptr && isspace(*vptr)) vptr++;
-                if (toupper(*vptr) == var_name) {
-                    return;
-                }
-            } else {
-                nesting--;
+            switch (ip->op) {
+                case OP_LOAD_VAR: case OP_STORE_VAR: case OP_TEE_VAR: case OP_INPUT_INT:
+                case OP_FOR: case OP_NEXT: case OP_IF_GOTO_VC:
+                    used_var[ip->a] = true;
+                    break;
+                case OP_READ_INT:
+                    used_var[ip->a] = true;
+                    uses_data = true;
+                    break;
+                case OP_READ_ARRAY:
+                    used_array[ip->a] = true;
+                    uses_data = true;
+                    break;
+                case OP_READ_STR:
+                    used_str[ip->a] = true;
+                    uses_data = true;
+                    break;
+                case OP_RESTORE:
+                    uses_data = uses_restore = true;
+                    break;
+                case OP_RECORD:
+                    if (ip->a >= 0) {
+                        used_str[ip->a] = true;
+                    }
+                    if (ip->b >= 0) {
+                        used_array[ip->b] = true;
+                    }
+                    uses_records = true;
+                    break;
+                case OP_INC_VAR: case OP_IF_GOTO_VV:
+                    used_var[ip->a] = true;
+                    used_var[ip->b] = true;
+                    break;
+                case OP_LOAD_ARRAY_VAR: case OP_CHECK_INDEX_VAR: case OP_STORE_ARRAY_VAR:
+                    used_var[ip->b] = true;
+                    used_array[ip->a] = true;
+                    break;
+                case OP_LOAD_STR: case OP_STORE_STR: case OP_STORE_STR_EMPTY: case OP_INPUT_STR:
+                    used_str[ip->a] = true;
+                    break;
+                case OP_LOAD_ARRAY: case OP_CHECK_INDEX: case OP_STORE_ARRAY: case OP_INPUT_ARRAY:
+                case OP_LOAD_ARRAY_N: case OP_CHECK_INDEX_N: case OP_DIM: case OP_REDIM:
+                    used_array[ip->a] = true;
+                    break;
+                case OP_DIM_FILE:
+                    used_array[ip->a] = true;
+                    uses_files = true;
+                    break;
+                case OP_MAT:
+                    used_array[ip->a] = used_array[ip->c] = used_array[ip->d] = true;
+                    break;
+                case OP_REDUCE:
+                    used_array[ip->a] = used_array[ip->c] = true;
+                    break;
+                case OP_SCAN:
+                    used_array[ip->a] = used_array[ip->b] = true;
+                    break;
+                case OP_SORT:
+                    used_array[ip->a] = true;
+                    if (ip->b >= 0) {
+                        used_array[ip->b] = true;
+                    }
+                    break;
+                case OP_FLUSH:
+                    uses_files = true;
+                    break;
+                case OP_DIM_MAP: case OP_LOAD_MAP: case OP_STORE_MAP: case OP_HAS_MAP: case OP_DEL_MAP:
+                    used_map[ip->a] = true;
+                    uses_maps = true;
+                    break;
             }
         }
     }
-    fprintf(stderr, "Error: Matching NEXT %c not found\n", var_name);
-}
+    depth[total] = str_depth[total] = 0;
 
-/* Find line by line number */
-int find_line(int line_number) {
-    int i;
-    for (i = 0; i < program_size; i++) {
-        if (program[i].line_number == line_number) {
-            return i;
-        }
+    fp = fopen(filename, "w");
+    if (!fp) {
+        fprintf(stderr, "Error: Cannot open file %s for writing\n", filename);
+        free(is_target);
+        free(depth);
+        free(str_depth);
+        return;
     }
-    return -1;
-}
 
-/* Execute GOTO statement */
-void execute_goto(void) {
-    int line_num = parse_expression();
-    int index = find_line(line_num);
-    
-    if (index >= 0) {
-        current_line_index = index - 1; /* Will be incremented in run loop */
-    } else {
-        fprintf(stderr, "Error: Line %d not found\n", line_num);
+    fputs("/* Generated by basic_interpreter COMPILE; build with cc -O2 */\n", fp);
+    for (i = 0; c_runtime[i]; i++) {
+        fprintf(fp, "%s\n", c_runtime[i]);
     }
-}
-
-/* Parse string operand for comparison */
-char *parse_string_operand(void) {
-    skip_whitespace();
-    if (*current_pos == '"') {
-        char *s = read_string_literal();
-        if (s) {
-            char *ret = (char *)malloc(strlen(s) + 1);
-            if (ret) strcpy(ret, s);
-            return ret;
-        }
-    } else if (strncasecmp(current_pos, "LEFT$", 5) == 0) {
-        current_pos += 5;
-        skip_whitespace();
-        if (*current_pos == '(') {
-            current_pos++;
-            char *str = parse_string_operand();
-            skip_whitespace();
-            if (*current_pos == ',') {
-                current_pos++;
-                int n = parse_expression();
-                skip_whitespace();
-                if (*current_pos == ')') {
-                    current_pos++;
-                    char *ret = NULL;
-                    if (str) {
-                        int len = strlen(str);
-                        if (n < 0) n = 0;
-                        if (n > len) n = len;
-                        ret = (char *)malloc(n + 1);
-                        if (ret) {
-                            strncpy(ret, str, n);
-                            ret[n] = '\0';
-                        }
-                        free(str);
-                    }
-                    return ret;
-                } else {
-                    fprintf(stderr, "Error: Expected ')' in LEFT$\n");
-                }
-            } else {
-                fprintf(stderr, "Error: Expected ',' in LEFT$\n");
-            }
-            if (str) free(str);
-        } else {
-            fprintf(stderr, "Error: Expected '(' after LEFT$\n");
-        }
-    } else if (strncasecmp(current_pos, "RIGHT$", 6) == 0) {
-        current_pos += 6;
-        skip_whitespace();
-        if (*current_pos == '(') {
-            current_pos++;
-            char *str = parse_string_operand();
-            skip_whitespace();
-            if (*current_pos == ',') {
-                current_pos++;
-                int n = parse_expression();
-                skip_whitespace();
-                if (*current_pos == ')') {
-                    current_pos++;
-                    char *ret = NULL;
-                    if (str) {
-                        int len = strlen(str);
-                        if (n < 0) n = 0;
-                        if (n > len) n = len;
-                        ret = (char *)malloc(n + 1);
-                        if (ret) {
-                            strcpy(ret, str + (len - n));
-                        }
-                        free(str);
-                    }
-                    return ret;
-                } else {
-                    fprintf(stderr, "Error: Expected ')' in RIGHT$\n");
-                }
+    for (i = 0; uses_files && c_file_runtime[i]; i++) {
+        fprintf(fp, "%s\n", c_file_runtime[i]);
+    }
+    for (i = 0; uses_maps && c_map_runtime[i]; i++) {
+        fprintf(fp, "%s\n", c_map_runtime[i]);
+    }
+    if (uses_data) {
+        fputs("typedef struct {\n    int line;\n    int value;\n    const char *text;\n} DataItem;\n\n"
+              "static const DataItem data_items[] = {\n", fp);
+        for (i = 0; i < data_count; i++) {
+            const DataItem *item = &data_items[i];
+            fprintf(fp, "    { %d, %d, ", item->line_number, item->len < 0 ? item->value : 0);
+            if (item->len < 0) {
+                fputs("NULL", fp);
             } else {
-                fprintf(stderr, "Error: Expected ',' in RIGHT$\n");
+                write_c_string(fp, string_pool + item->value);
             }
-            if (str) free(str);
-        } else {
-            fprintf(stderr, "Error: Expected '(' after RIGHT$\n");
+            fputs(" },\n", fp);
         }
-    } else if (strncasecmp(current_pos, "MID$", 4) == 0) {
-        current_pos += 4;
-        skip_whitespace();
-        if (*current_pos == '(') {
-            current_pos++;
-            char *str = parse_string_operand();
-            skip_whitespace();
-            if (*current_pos == ',') {
-                current_pos++;
-                int start = parse_expression();
-                skip_whitespace();
-                if (*current_pos == ',') {
-                    current_pos++;
-                    int n = parse_expression();
-                    skip_whitespace();
-                    if (*current_pos == ')') {
-                        current_pos++;
-                        char *ret = NULL;
-                        if (str) {
-                            int len = strlen(str);
-                            if (start < 1) start = 1;
-                            if (start > len) {
-                                ret = (char *)malloc(1);
-                                if (ret) *ret = '\0';
-                            } else {
-                                int available = len - (start - 1);
-                                if (n < 0) n = 0;
-                                if (n > available) n = available;
-                                ret = (char *)malloc(n + 1);
-                                if (ret) {
-                                    strncpy(ret, str + (start - 1), n);
-                                    ret[n] = '\0';
-                                }
-                            }
-                            free(str);
-                        }
-                        return ret;
-                    }
-                }
-            }
-            if (str) free(str);
+        fprintf(fp, "    { 0, 0, NULL }\n};\nstatic const int data_count = %d;\n\n", data_count);
+        for (i = 0; c_data_runtime[i]; i++) {
+            fprintf(fp, "%s\n", c_data_runtime[i]);
         }
-    } else if (isalpha(*current_pos)) {
-         char *save_pos = current_pos;
-         char var = toupper(*current_pos++);
-         if (*current_pos == '$') {
-             current_pos++; /* skip $ */
-             int idx = var - 'A';
-             char *val = string_variables[idx];
-             if (val) {
-                 char *ret = (char *)malloc(strlen(val) + 1);
-                 if (ret) strcpy(ret, val);
-                 return ret;
-             } else {
-                 char *ret = (char *)malloc(1);
-                 if (ret) *ret = '\0';
-                 return ret;
-             }
-         }
-         current_pos = save_pos; /* backtrack */
-    }
-    return NULL;
-}
-
-/* Execute IF statement */
-void execute_if(void) {
-    skip_whitespace();
-
-    char *left_str = NULL;
-    char *right_str = NULL;
-    bool is_string_comp = false;
-
-    int left_val = 0;
-
-    char *save_pos = current_pos;
-    left_str = parse_string_operand();
-
-    if (left_str) {
-        is_string_comp = true;
-    } else {
-        current_pos = save_pos;
-        left_val = parse_expression();
-    }
-
-    skip_whitespace();
-    
-    char op[3] = {0};
-    int op_len = 0;
-    
-    /* Read comparison operator */
-    if (*current_pos == '=' || *current_pos == '<' || *current_pos == '>') {
-        op[op_len++] = *current_pos++;
-        if (*current_pos == '=' || (*current_pos == '>' && op[0] == '<')) {
-            op[op_len++] = *current_pos++;
+        for (i = 0; uses_restore && c_restore_runtime[i]; i++) {
+            fprintf(fp, "%s\n", c_restore_runtime[i]);
         }
     }
-    
-    int right_val = 0;
-
-    if (is_string_comp) {
-        right_str = parse_string_operand();
-        if (!right_str) {
-            fprintf(stderr, "Error: Type mismatch in IF\n");
-            if (left_str) free(left_str);
-            return;
-        }
-    } else {
-        right_val = parse_expression();
+    for (i = 0; uses_records && c_record_runtime[i]; i++) {
+        fprintf(fp, "%s\n", c_record_runtime[i]);
     }
-
-    bool condition = false;
-    
-    if (is_string_comp) {
-        int cmp = strcmp(left_str, right_str);
-        if (strcmp(op, "=") == 0 || strcmp(op, "==") == 0) {
-            condition = (cmp == 0);
-        } else if (strcmp(op, "<") == 0) {
-            condition = (cmp < 0);
-        } else if (strcmp(op, ">") == 0) {
-            condition = (cmp > 0);
-        } else if (strcmp(op, "<=") == 0) {
-            condition = (cmp <= 0);
-        } else if (strcmp(op, ">=") == 0) {
-            condition = (cmp >= 0);
-        } else if (strcmp(op, "<>") == 0 || strcmp(op, "!=") == 0) {
-            condition = (cmp != 0);
-        }
-
-        free(left_str);
-        free(right_str);
-    } else {
-        /* Evaluate integer condition */
-        if (strcmp(op, "=") == 0 || strcmp(op, "==") == 0) {
-            condition = (left_val == right_val);
-        } else if (strcmp(op, "<") == 0) {
-            condition = (left_val < right_val);
-        } else if (strcmp(op, ">") == 0) {
-            condition = (left_val > right_val);
-        } else if (strcmp(op, "<=") == 0) {
-            condition = (left_val <= right_val);
-        } else if (strcmp(op, ">=") == 0) {
-            condition = (left_val >= right_val);
-        } else if (strcmp(op, "<>") == 0 || strcmp(op, "!=") == 0) {
-            condition = (left_val != right_val);
+    fputc('\n', fp);
+    for (i = 0; i < MAX_ARRAYS; i++) {
+        if (used_array[i]) {
+            fprintf(fp, "static Array arr_%s;\n", array_names.names[i]);
         }
     }
-    
-    /* Look for THEN or GOTO */
-    skip_whitespace();
-    if (strncasecmp(current_pos, "THEN", 4) == 0) {
-        current_pos += 4;
-        skip_whitespace();
-    }
-    
-    if (condition) {
-        if (strncasecmp(current_pos, "GOTO", 4) == 0) {
-            current_pos += 4;
-            execute_goto();
-        } else if (strncasecmp(current_pos, "PRINT", 5) == 0) {
-            current_pos += 5;
-            execute_print();
-        } else if (strncasecmp(current_pos, "LET", 3) == 0) {
-            current_pos += 3;
-            execute_let();
-        } else if (isalpha(*current_pos)) {
-            /* Direct assignment without LET */
-            execute_let();
+    for (i = 0; i < MAX_MAPS; i++) {
+        if (used_map[i]) {
+            fprintf(fp, "static Map map_%s;\n", map_names.names[i]);
         }
     }
-}
 
-/* Execute a single line */
-void execute_line(int line_index) {
-    char *line = program[line_index].text;
-    current_pos = line;
-    
-    skip_whitespace();
-    
-    if (strncasecmp(current_pos, "PRINT", 5) == 0) {
-        current_pos += 5;
-        execute_print();
-    } else if (strncasecmp(current_pos, "LET", 3) == 0) {
-        current_pos += 3;
-        execute_let();
-    } else if (strncasecmp(current_pos, "GOTO", 4) == 0) {
-        current_pos += 4;
-        execute_goto();
-    } else if (strncasecmp(current_pos, "IF", 2) == 0) {
-        current_pos += 2;
-        execute_if();
-    } else if (strncasecmp(current_pos, "DIM", 3) == 0) {
-        current_pos += 3;
-        execute_dim();
-    } else if (strncasecmp(current_pos, "INPUT", 5) == 0) {
-        current_pos += 5;
-        execute_input();
-    } else if (strncasecmp(current_pos, "FOR", 3) == 0) {
-        current_pos += 3;
-        execute_for();
-    } else if (strncasecmp(current_pos, "NEXT", 4) == 0) {
-        current_pos += 4;
-        execute_next();
-    } else if (strncasecmp(current_pos, "END", 3) == 0) {
-        current_line_index = program_size; /* Exit program */
-    } else if (*current_pos) {
-        /* Assume it's a LET statement without LET keyword */
-        execute_let();
+    fputs("\nint main(void) {\n", fp);
+    for (i = 0; i < MAX_VARS + MAX_TEMPS; i++) {
+        if (used_var[i]) fprintf(fp, "    int %s = 0;\n", c_var_name(i, 0));
     }
-}
-
-/* Run the program */
-void run_program(void) {
-    if (program_size == 0) {
-        printf("No program to run.\n");
-        return;
+    for (i = 0; i < MAX_VARS; i++) {
+        if (used_str[i]) fprintf(fp, "    StrBuf str_%s = { NULL, 0, 0 };\n", str_names.names[i]);
     }
-    
-    for (current_line_index = 0; current_line_index < program_size; current_line_index++) {
-        execute_line(current_line_index);
+    for (i = 0; i < max_depth; i++) {
+        fprintf(fp, "    int s%d = 0;\n", i);
     }
-}
-
-/* List the program */
-void list_program(void) {
-    int i;
-    for (i = 0; i < program_size; i++) {
-        printf("%d %s\n", program[i].line_number, program[i].text);
+    for (i = 0; i < max_str_depth; i++) {
+        fprintf(fp, "    char *t%d = NULL;\n", i);
     }
-}
-
-/* Clear the program */
-void clear_program(void) {
-    program_size = 0;
-    init_interpreter();
-}
 
-/* Insert or replace a line in the program */
-void insert_line(int line_number, const char *text) {
-    int i;
-    
-    /* Find insertion point */
-    int insert_pos = 0;
     for (i = 0; i < program_size; i++) {
-        if (program[i].line_number == line_number) {
-            /* Replace existing line */
-            if (strlen(text) == 0) {
-                /* Delete line */
-                for (int j = i; j < program_size - 1; j++) {
-                    program[j] = program[j + 1];
+        const char *text;
+        fprintf(fp, "\n    /* %d ", line_numbers[i]);
+        for (text = line_text(i); *text; text++) {
+            /* Keep the source text from closing the comment */
+            fputc(text[0] == '*' && text[1] == '/' ? '+' : text[0], fp);
+        }
+        fputs(" */\n", fp);
+        append_slot = -1;
+        for (pc = line_start[i]; pc < line_start[i + 1]; pc++) {
+            const Instr *ip = linked_instr(pc);
+            int in_place = -1;
+            if (is_target[pc]) {
+                write_c_label(fp, pc, total);
+                fputs(":;\n", fp);
+            }
+            if (ip->op == OP_LOAD_STR && str_depth[pc] == 0) {
+                append_slot = c_append_slot(pc, line_start[i + 1]);
+                in_place = append_slot;
+            } else if ((ip->op == OP_CONCAT && str_depth[pc] == 2) || ip->op == OP_STORE_STR) {
+                in_place = append_slot;
+                if (ip->op == OP_STORE_STR) {
+                    append_slot = -1;
                 }
-                program_size--;
-            } else {
-                strncpy(program[i].text, text, MAX_LINE_LENGTH - 1);
-                program[i].text[MAX_LINE_LENGTH - 1] = '\0';
             }
-            return;
+            write_c_instr(fp, ip, pc, depth[pc], str_depth[pc], total, in_place);
         }
-        if (program[i].line_number < line_number) {
-            insert_pos = i + 1;
-        }
-    }
-    
-    /* Insert new line */
-    if (strlen(text) > 0 && program_size < MAX_LINES) {
-        for (i = program_size; i > insert_pos; i--) {
-            program[i] = program[i - 1];
-        }
-        program[insert_pos].line_number = line_number;
-        strncpy(program[insert_pos].text, text, MAX_LINE_LENGTH - 1);
-        program[insert_pos].text[MAX_LINE_LENGTH - 1] = '\0';
-        program_size++;
     }
-}
-
-/* Save program to file */
-void save_program(const char *filename) {
-    FILE *fp = fopen(filename, "w");
-    if (!fp) {
-        fprintf(stderr, "Error: Cannot open file %s for writing\n", filename);
-        return;
+    fputs("    goto halt;\n\nhalt:\n", fp);
+    for (i = 0; i < max_depth; i++) {
+        fprintf(fp, "    (void)s%d;\n", i);
     }
-    
-    int i;
-    for (i = 0; i < program_size; i++) {
-        fprintf(fp, "%d %s\n", program[i].line_number, program[i].text);
+    for (i = 0; i < max_str_depth; i++) {
+        fprintf(fp, "    (void)t%d;\n", i);
     }
-    
+    fputs("    fflush(stdout);\n    return 0;\n}\n", fp);
+
     fclose(fp);
-    printf("Program saved to %s\n", filename);
+    free(is_target);
+    free(depth);
+    free(str_depth);
+    printf("Program compiled to %s\n", filename);
 }
 
-/* Load program from file */
-void load_program(const char *filename) {
-    FILE *fp = fopen(filename, "r");
-    if (!fp) {
-        fprintf(stderr, "Error: Cannot open file %s for reading\n", filename);
-        return;
-    }
-    
-    clear_program();
-    
-    char line[MAX_LINE_LENGTH];
-    while (fgets(line, sizeof(line), fp)) {
-        int line_num;
-        char rest[MAX_LINE_LENGTH];
-        
-        /* Remove newline */
-        line[strcspn(line, "\n")] = '\0';
-        
-        if (sscanf(line, "%d %[^\n]", &line_num, rest) == 2) {
-            insert_line(line_num, rest);
-        }
+/* Turn the loop JIT on or off; takes effect when the program is next linked */
+void set_jit(bool enabled) {
+#if HAVE_JIT
+    jit_enabled = enabled;
+    program_linked = false;
+#else
+    if (enabled) {
+        fprintf(stderr, "Error: JIT not supported on this platform\n");
     }
-    
-    fclose(fp);
-    printf("Program loaded from %s\n", filename);
+#endif
 }
 
 /* Main interpreter loop */
-int main(void) {
-    char input[MAX_LINE_LENGTH];
+int main(int argc, char **argv) {
+    char *input = NULL;
+    int input_cap = 0;
+    int i;
     
     init_interpreter();
+
+    for (i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--jit") == 0) {
+            set_jit(true);
+        } else if (strcmp(argv[i], "--compile") == 0 && i + 2 < argc) {
+            /* Translate a saved program to C and exit */
+            int status;
+            if (load_program(argv[i + 1])) {
+                printf("Program loaded from %s\n", argv[i + 1]);
+            }
+            status = program_size > 0 ? 0 : 1;
+            compile_program_to_c(argv[i + 2]);
+            cleanup_interpreter();
+            return status;
+        } else if (strcmp(argv[i], "-f") == 0 && i + 1 < argc) {
+            /* Run a saved program once, with standard input as its data, and exit */
+            int status = load_program(argv[i + 1]) && program_size > 0 ? 0 : 1;
+            if (status == 0) {
+                run_program();
+            }
+            cleanup_interpreter();
+            return status;
+        } else {
+            fprintf(stderr, "Usage: %s [--jit] [--compile <program.bas> <file.c>] [-f <program.bas>]\n", argv[0]);
+            return 1;
+        }
+    }
     
     printf("Tiny BASIC Interpreter\n");
-    printf("Commands: NEW, LIST, RUN, LOAD <file>, SAVE <file>, QUIT\n");
-    printf("Statements: PRINT, LET, GOTO, IF, DIM, END, FOR, NEXT\n\n");
+    printf("Commands: NEW, LIST, RUN, LOAD <file>, SAVE <file>, COMPILE <file.c>, DUMP, OPTIMIZE ON/OFF, JIT ON/OFF, MEMORY, QUIT\n");
+    printf("Statements: PRINT, LET, GOTO, IF, DIM, REDIM, FLUSH, MAT, SCAN, SORT, DEL, OPEN, CLOSE, INPUT, READ, DATA, RESTORE, RECORD, END, FOR, NEXT\n\n");
     
     while (1) {
         printf("> ");
-        if (!fgets(input, sizeof(input), stdin)) {
+        if (!read_input_line(&input, &input_cap)) {
             break;
         }
         
@@ -1107,43 +9133,41 @@ int main(void) {
             list_program();
         } else if (strcasecmp(input, "RUN") == 0) {
             run_program();
+        } else if (strcasecmp(input, "DUMP") == 0) {
+            dump_program();
+        } else if (strcasecmp(input, "MEMORY") == 0) {
+            print_memory_stats();
+        } else if (strcasecmp(input, "OPTIMIZE ON") == 0) {
+            set_optimize(true);
+        } else if (strcasecmp(input, "OPTIMIZE OFF") == 0) {
+            set_optimize(false);
+        } else if (strcasecmp(input, "JIT ON") == 0) {
+            set_jit(true);
+        } else if (strcasecmp(input, "JIT OFF") == 0) {
+            set_jit(false);
         } else if (strncasecmp(input, "LOAD ", 5) == 0) {
-            load_program(input + 5);
+            if (load_program(input + 5)) {
+                printf("Program loaded from %s\n", input + 5);
+            }
         } else if (strncasecmp(input, "SAVE ", 5) == 0) {
             save_program(input + 5);
+        } else if (strncasecmp(input, "COMPILE ", 8) == 0) {
+            compile_program_to_c(input + 8);
         } else {
-            /* Check if it's a numbered line */
-            int line_num;
-            char rest[MAX_LINE_LENGTH];
+            /* Check if it's a numbered line; with no text it is deleted */
+            char *rest;
+            int line_num = (int)strtol(input, &rest, 10);
             
-            if (sscanf(input, "%d %[^\n]", &line_num, rest) == 2) {
+            if (rest != input) {
+                while (isspace((unsigned char)*rest)) {
+                    rest++;
+                }
                 insert_line(line_num, rest);
-            } else if (sscanf(input, "%d", &line_num) == 1) {
-                /* Line number with no text - delete the line */
-                insert_line(line_num, "");
             } else {
                 /* Direct execution of statement */
-                current_pos = input;
-                current_line_index = 0;
-                
-                if (strncasecmp(current_pos, "PRINT", 5) == 0) {
-                    current_pos += 5;
-                    execute_print();
-                } else if (strncasecmp(current_pos, "LET", 3) == 0) {
-                    current_pos += 3;
-                    execute_let();
-                } else if (strncasecmp(current_pos, "DIM", 3) == 0) {
-                    current_pos += 3;
-                    execute_dim();
-                } else if (strncasecmp(current_pos, "INPUT", 5) == 0) {
-                    current_pos += 5;
-                    execute_input();
-                } else if (strncasecmp(current_pos, "FOR", 3) == 0) {
-                    current_pos += 3;
-                    execute_for();
-                } else if (strncasecmp(current_pos, "NEXT", 4) == 0) {
-                    current_pos += 4;
-                    execute_next();
+                const Statement *stmt = find_statement(input);
+                if (stmt && stmt->direct) {
+                    execute_direct(input);
                 } else {
                     printf("Unknown command or invalid syntax\n");
                 }
@@ -1151,6 +9175,7 @@ int main(void) {
         }
     }
     
+    free(input);
     cleanup_interpreter();
     printf("Goodbye!\n");
     return 0;
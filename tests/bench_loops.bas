@@ -0,0 +1,13 @@
+10 DIM A(1000)
+20 S = 0
+30 FOR I = 1 TO 10000
+40 FOR J = 0 TO 999
+50 A(J) = A(J) + J
+60 S = S + 1
+70 NEXT J
+80 NEXT I
+90 K = 0
+100 K = K + 1
+110 IF K < 10000000 THEN GOTO 100
+120 PRINT S, K, A(999)
+RUN
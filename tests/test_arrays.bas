@@ -0,0 +1,69 @@
+10 DIM A(3000000)
+20 FOR I = 0 TO 2999999 STEP 1000
+30 A(I) = I / 1000
+40 NEXT I
+50 PRINT "BIG: ", A(0), A(1000), A(2999000), A(2999999)
+60 DIM B(1)
+70 FOR I = 2 TO 5000
+80 REDIM B(I)
+90 B(I - 1) = B(I - 2) + 1
+100 NEXT I
+110 PRINT "REDIM: ", B(0), B(4999)
+120 REDIM A(4000000)
+130 PRINT "GROWN: ", A(2999000), A(3999999)
+140 DIM F(100) FILE "/tmp/basic_test_arrays.dat"
+150 FOR I = 0 TO 99
+160 F(I) = I * I
+170 NEXT I
+180 FLUSH F
+190 DIM G(0) FILE "/tmp/basic_test_arrays.dat"
+200 PRINT "FILE: ", G(0), G(99)
+210 DIM M(3, 4)
+220 FOR I = 0 TO 2
+230 FOR J = 0 TO 3
+240 M(I, J) = I * 10 + J
+250 NEXT J
+260 NEXT I
+270 DIM C(2, 3, 4)
+280 C(1, 2, 3) = 99
+290 PRINT "MATRIX: ", M(2, 3), M(1, 0), M(5), C(23)
+300 REDIM M(4, 4)
+310 PRINT "ROWS: ", M(2, 3), M(3, 3)
+320 DIM P(2, 3)
+330 DIM Q(2, 3)
+340 FOR I = 0 TO 5
+350 P(I) = I
+360 Q(I) = 10 - I
+370 NEXT I
+380 MAT R = P + Q
+390 MAT S = P * Q
+400 K = 3
+410 MAT T = (K) * P
+420 MAT U = P
+430 MAT Q = CON
+440 MAT P = ZER
+450 PRINT "MAT: ", R(1, 2), S(1, 1), T(5), U(4), Q(0), P(5)
+460 R(5) = -20
+470 SCAN R TO V
+480 PRINT "REDUCE: ", SUM(R), MIN(R), MAX(R, 0, 5), COUNT(R, 10), DOT(R, S), V(5)
+490 SCAN Q TO Q, 2, 3
+500 PRINT "SCAN: ", Q(1), Q(2), Q(4), SUM(Q, 3)
+510 DIM K(6)
+520 DIM W(6)
+530 FOR I = 0 TO 5
+540 K(I) = 3 - I * 2
+550 W(I) = I
+560 NEXT I
+570 K(4) = 3
+580 SORT K WITH W
+590 PRINT "SORT: ", K(0), W(0), K(4), W(4), K(5), W(5)
+600 SORT K, 3, DESC
+610 PRINT "DESC: ", K(0), K(2), K(3)
+620 DIM L(3000)
+630 FOR I = 0 TO 2999
+640 L(I) = 1500 - I
+650 NEXT I
+660 L(7) = 100000
+670 SORT L
+680 PRINT "RADIX: ", L(0), L(1), L(2998), L(2999)
+RUN
@@ -0,0 +1,23 @@
+10 DIM A(10)
+20 FOR I = 0 TO 9
+30 A(I) = I * I
+40 NEXT I
+50 LET S = 0
+60 FOR I = 1 TO 8
+70 S = S + A(I - 1) + A(I + 1)
+80 NEXT I
+90 PRINT S
+100 FOR I = 9 TO 0 STEP -2
+110 PRINT A(I + 1)
+120 NEXT I
+130 FOR K = 0 TO 5
+140 FOR I = 0 TO 4
+150 A(I + K) = A(I + K) + 1
+160 NEXT I
+170 NEXT K
+180 PRINT A(0), A(5), A(9)
+190 FOR I = 0 TO 3
+200 PRINT B(I)
+210 NEXT I
+RUN
+DUMP
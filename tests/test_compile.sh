@@ -0,0 +1,47 @@
+#!/bin/bash
+# Compile a BASIC program to C and check that it behaves like the interpreter.
+# This script requires `basic_interpreter` to be in the parent directory (or build directory).
+
+INTERPRETER=../basic_interpreter
+if [ ! -f "$INTERPRETER" ]; then
+    echo "Interpreter not found at $INTERPRETER"
+    # Try current dir if run from root
+    if [ -f "./basic_interpreter" ]; then
+        INTERPRETER=./basic_interpreter
+    else
+        exit 1
+    fi
+fi
+
+TMP=$(mktemp -d)
+trap 'rm -rf "$TMP"' EXIT
+
+cat > "$TMP/prog.bas" <<'EOF2'
+10 DIM A(10)
+20 FOR I = 0 TO 10
+30 LET A(I) = I * I
+40 NEXT I
+50 LET S$ = "hello world"
+60 PRINT A(9), LEFT$(S$, 5), MID$(S$, 7, 3), INSTR(S$, "wor")
+70 PRINT 10 / 0
+80 GOTO 20 * 5
+100 S$ = S$ + "!" + LEFT$(S$, 1)
+110 PRINT "done", S$
+EOF2
+
+$INTERPRETER --compile "$TMP/prog.bas" "$TMP/prog.c" > /dev/null &&
+    cc -O2 "$TMP/prog.c" -o "$TMP/prog" || { echo "FAILED: could not build generated C"; exit 1; }
+
+# Same output and error messages as RUN in the interpreter
+EXPECTED=$(printf '81 hello wor 7\n10\ndone hello world!h\nError: Array index 10 out of bounds for A\nError: Division by zero')
+ACTUAL=$("$TMP/prog" 2> "$TMP/errors"; cat "$TMP/errors")
+
+if [ "$EXPECTED" == "$ACTUAL" ]; then
+    echo "PASSED: Compiled program matches the interpreter"
+    exit 0
+else
+    echo "FAILED: Compiled program output differs"
+    echo "Expected:"; echo "$EXPECTED"
+    echo "Actual:"; echo "$ACTUAL"
+    exit 1
+fi
@@ -0,0 +1,24 @@
+10 DATA 3, -7, +12, "two words", plain text
+20 READ N, M, P, A$, B$
+30 PRINT "READ: ", N, M, P, A$, B$
+40 DIM SQ(4)
+50 FOR I = 0 TO 3
+60 READ SQ(I)
+70 NEXT I
+80 DATA 0, 1, 4, 9
+90 PRINT "ARRAY: ", SUM(SQ), SQ(3)
+100 RESTORE 80
+110 READ X
+120 READ Y$
+130 RESTORE
+140 READ X
+150 PRINT "RESTORE: ", X
+160 RESTORE 200
+170 READ X
+180 INPUT "VALUES? ", V, W, N$
+190 PRINT "INPUT: ", V + W, N$
+200 INPUT Z
+210 PRINT "AFTER: ", Z
+RUN
+ 40 -2 word  ignored
+oops
@@ -0,0 +1,15 @@
+10 FOR I = 1 TO 3
+20 FOR J = I TO 1 STEP -1
+30 print "I: ", I, " J: ", J
+40 NEXT J
+50 NEXT I
+60 N = 3
+70 FOR K = 1 TO N
+80 N = 10
+90 print "K: ", K
+100 NEXT K
+110 FOR L = 5 TO 1
+120 print "never printed"
+130 NEXT L
+140 print "after: ", I, K, L
+RUN
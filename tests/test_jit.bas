@@ -0,0 +1,27 @@
+JIT ON
+10 DIM A(100)
+20 FOR I = 0 TO 101
+30 A(I) = I * 2
+40 NEXT I
+50 PRINT A(99)
+60 FOR I = 1 TO 300
+70 LET X = 1000 / (I - 150)
+80 S = S + X
+90 NEXT I
+100 PRINT S, X
+110 K = 0
+120 K = K + 1
+130 IF K < 1000 THEN GOTO 120
+140 PRINT K
+150 FOR I = 1 TO 100 STEP 7
+160 FOR J = 10 TO 1 STEP -3
+170 T = T + I * J - A(J)
+180 NEXT J
+190 IF I > 90 THEN PRINT "I=", I
+200 NEXT I
+210 PRINT T, I, J
+220 FOR I = 1 TO 100
+230 IF I = 99 THEN GOTO 250
+240 NEXT I
+250 PRINT "out", I
+RUN
@@ -0,0 +1,23 @@
+10 DIM MAP H
+20 H{7} = 70
+30 H{"seven"} = 7
+40 A$ = "sev"
+50 H{A$ + "en"} = H{"seven"} + 1
+60 PRINT "KEYS: ", H{7}, H{"seven"}, H{8}, HAS(H, 7), HAS(H, 8), HAS(H, "7")
+70 FOR I = 1 TO 5000
+80 H{I * 31} = I
+90 NEXT I
+100 FOR I = 1 TO 5000 STEP 2
+110 DEL H{I * 31}
+120 NEXT I
+130 C = 0
+140 FOR I = 1 TO 5000
+150 C = C + HAS(H, I * 31)
+160 NEXT I
+170 PRINT "GROWN: ", C, H{62}, H{31}, H{155000}
+180 DEL H{"seven"}
+190 PRINT "DEL: ", HAS(H, "seven"), H{7}
+200 DIM MAP H
+210 PRINT "CLEARED: ", HAS(H, 7), H{62}
+220 PRINT G{1}
+RUN
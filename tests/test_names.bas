@@ -0,0 +1,26 @@
+10 TOTAL = 0
+20 FOR ROW = 1 TO 3
+30 FOR COL_2 = 1 TO 4
+40 TOTAL = TOTAL + ROW * COL_2
+50 NEXT COL_2
+60 NEXT ROW
+70 PRINTED = TOTAL
+80 FORMAT$ = "rows"
+90 PRINT "NAMES: ", TOTAL, PRINTED, Total, FORMAT$, T
+100 DIM SQUARES(5)
+110 FOR I = 0 TO 4
+120 SQUARES(I) = (5 - I) * (5 - I)
+130 NEXT I
+140 SORT SQUARES
+150 DIM MAP SEEN
+160 SEEN{"rows"} = SUM(SQUARES)
+170 PRINT "ARRAYS: ", SQUARES(1), SQUARES(4), SEEN{FORMAT$}, HAS(SEEN, "cols")
+180 IF TOTAL > 50 THEN LETTERS = 1
+190 PRINT "IF: ", LETTERS
+200 IF (TOTAL) = 60 THEN PRINT "IF (TOTAL): yes"
+210 IF(TOTAL+1)=61 THEN PRINT "IF(TOTAL+1): yes"
+220 INSTRUCTIONS = 4
+230 COUNT = COUNT + 1
+240 PRINT "FUNCTION NAMES: ", INSTRUCTIONS, COUNT, COUNT(SQUARES, 4)
+250 PRINT SQUARES(5)
+RUN
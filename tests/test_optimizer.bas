@@ -0,0 +1,16 @@
+10 LET W = 10
+20 DIM B(100)
+30 FOR I = 0 TO 9
+40 FOR J = 0 TO 9
+50 B(I*W+J) = B(I*W+J) + I + 2 * 3 * W
+60 NEXT J
+70 NEXT I
+80 PRINT B(55), B(99), 2 * 3 + 4, 10 - 0
+90 PRINT 7 / 0
+100 LET W = 11
+110 FOR I = 0 TO 9
+120 IF I = 5 THEN W = 0
+130 PRINT I * W
+140 NEXT I
+RUN
+DUMP
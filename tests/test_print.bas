@@ -0,0 +1,19 @@
+10 PRINT "INTS: ", 0, 7, -7, 99, 100, -12345, 2147483647, -2147483647 - 1
+20 OPEN "/tmp/basic_test_print.txt" FOR OUTPUT AS #1
+30 FOR I = 1 TO 3
+40 PRINT #1, "LINE", I, I * I
+50 NEXT I
+60 CLOSE #1
+70 OPEN "/tmp/basic_test_print.txt" FOR APPEND AS #2
+80 PRINT #2, "APPENDED", -1
+90 CLOSE
+100 PRINT #2, "CLOSED"
+110 PRINT "AFTER"
+120 CLOSE #3
+130 PRINT #17, 1
+140 S = 0
+150 FOR I = 1 TO 1000
+160 S = S + I
+170 NEXT I
+180 PRINT "SUM: ", S
+RUN
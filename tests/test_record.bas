@@ -0,0 +1,15 @@
+10 DIM MAP SEEN
+20 RECORD LINE$, F, 80
+30 TOTAL = TOTAL + F(2)
+40 SEEN{LEFT$(LINE$, 1)} = SEEN{LEFT$(LINE$, 1)} + 1
+50 IF F(0) <> 2 THEN PRINT "FIELDS: ", LINE$, F(0), F(2), F(3)
+60 RECORDS = RECORDS + 1
+70 GOTO 20
+80 PRINT "TOTAL: ", RECORDS, TOTAL, SEEN{"a"}, SEEN{"b"}
+RUN
+a 10
+b 20,x
+a 5, -3, 7
+
+b,2
+c 1
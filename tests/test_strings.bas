@@ -3,4 +3,10 @@
 30 print "RIGHT: ", right$(A$, 2)
 40 print "MID: ", mid$(A$, 2, 2)
 50 print "LITERAL: ", left$("world", 3)
+60 B$ = ""
+70 for I = 1 to 5
+80 B$ = B$ + mid$(A$, I, 1) + "-"
+90 next I
+100 print "JOIN: ", B$ + "!", instr(B$ + A$, "-h")
+110 print "INSTR: ", instr(B$, "-"), instr(B$, "-", 3), instr(B$, "-", 11), instr(B$ + B$, "l-l-o-h")
 RUN